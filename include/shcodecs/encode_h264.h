@@ -970,5 +970,31 @@ shcodecs_encoder_set_h264_constrained_intra_pred(SHCodecs_Encoder *
 						 unsigned long
 						 h264_constrained_intra_pred);
 
+/**
+ * Get the number of reference frames for H.264 P pictures.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \returns The h264_ref_frames
+ * \retval -1 \a encoder invalid
+ */
+unsigned long
+shcodecs_encoder_get_h264_ref_frames(SHCodecs_Encoder * encoder);
+
+/**
+ * Set the number of reference frames for H.264 P pictures. A second
+ * reference helps most where the background is static, such as a fixed
+ * camera. Each reference frame beyond the first costs another local decode
+ * image of width*height*3/2 bytes of contiguous memory, rounded up to
+ * whole macroblocks, and the level must allow the larger decoded picture
+ * buffer. This must be set before encoding starts.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param h264_ref_frames The new value for \a h264_ref_frames, 1 (default) or 2
+ * \returns The previous value of \a h264_ref_frames
+ * \retval -1 \a encoder invalid, \a h264_ref_frames out of range,
+ * or encoding has started
+ */
+unsigned long
+shcodecs_encoder_set_h264_ref_frames(SHCodecs_Encoder * encoder,
+				     unsigned long h264_ref_frames);
+
 
 #endif				/* __SHCODECS_ENCODE_H264_H__ */
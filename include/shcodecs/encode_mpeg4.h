@@ -934,7 +934,13 @@ unsigned long
 shcodecs_encoder_get_mpeg4_b_vop_num(SHCodecs_Encoder * encoder);
 
 /**
- * Set the mpeg4_b_vop_num.
+ * Set the mpeg4_b_vop_num, the number of B-VOPs between anchor VOPs.
+ * The encoder holds each input frame that will be a B-VOP until the
+ * following anchor VOP has been encoded, so it needs
+ * shcodecs_encoder_get_min_input_frames() input buffers. VOPs are output
+ * in decoding order; the access unit output callback gives the frame
+ * number of each in display order. Ignored for H.263, and must be set
+ * before encoding starts.
  * \param encoder The SHCodecs_Encoder* handle
  * \param mpeg4_b_vop_num The new value for \a mpeg4_b_vop_num
  * \returns The previous value of \a mpeg4_b_vop_num
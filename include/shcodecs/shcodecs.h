@@ -90,6 +90,8 @@ extern "C" {
 
 #include <shcodecs/shcodecs_decoder.h>
 #include <shcodecs/shcodecs_encoder.h>
+#include <shcodecs/shcodecs_rtp.h>
+#include <shcodecs/shcodecs_simulcast.h>
 
 #ifdef __cplusplus
 }
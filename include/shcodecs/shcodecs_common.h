@@ -19,6 +19,15 @@ typedef enum {
     SHCodecs_Format_H264  = 2
 } SHCodecs_Format;
 
+/**
+ * A presentation timestamp. The units are chosen by the application;
+ * libshcodecs only carries timestamps through and compares them.
+ */
+typedef long long SHCodecs_Timestamp;
+
+/** Value of an SHCodecs_Timestamp when no timestamp is known */
+#define SHCODECS_TIMESTAMP_NONE	(-1LL)
+
 /** Minimum frame width */
 #define	SHCODECS_MIN_FX		48
 
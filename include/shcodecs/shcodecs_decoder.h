@@ -18,6 +18,48 @@
 struct SHCodecs_Decoder;
 typedef struct SHCodecs_Decoder SHCodecs_Decoder;
 
+/** Metadata flag: VUI timing information */
+#define SHCODECS_METADATA_TIMING         (1<<0)
+
+/** Metadata flag: VUI bitstream restriction (reordering and buffering) */
+#define SHCODECS_METADATA_BUFFERING      (1<<1)
+
+/** Metadata flag: Picture timing SEI */
+#define SHCODECS_METADATA_PIC_TIMING     (1<<2)
+
+/** Metadata flag: Recovery point SEI */
+#define SHCODECS_METADATA_RECOVERY_POINT (1<<3)
+
+/**
+ * Stream metadata for a decoded frame, from the H.264 VUI parameters and
+ * SEI messages. Each group of fields is only valid if the corresponding
+ * SHCODECS_METADATA_* flag is set in \a present.
+ */
+typedef struct {
+	int present;	/**< SHCODECS_METADATA_* flags of valid fields */
+	int changed;	/**< SHCODECS_METADATA_* flags of fields that differ
+			     from those of the previous frame */
+
+	/* SHCODECS_METADATA_TIMING */
+	unsigned long num_units_in_tick;
+	unsigned long time_scale;
+	int fixed_frame_rate;
+
+	/* SHCODECS_METADATA_BUFFERING */
+	unsigned long num_reorder_frames;
+	unsigned long max_dec_frame_buffering;
+
+	/* SHCODECS_METADATA_PIC_TIMING */
+	long cpb_removal_delay;
+	long dpb_output_delay;
+	int pic_struct;
+
+	/* SHCODECS_METADATA_RECOVERY_POINT */
+	unsigned long recovery_frame_cnt;
+	int exact_match;
+	int broken_link;
+} SHCodecs_Decoder_Metadata;
+
 /**
  * Signature of a callback for libshcodecs to call when it has decoded
  * YUV 4:2:0 data. To pause decoding, return 1 from this callback.
@@ -95,9 +137,44 @@ int
 shcodecs_decode (SHCodecs_Decoder * decoder, unsigned char * data, int len);
 
 /**
- * Finalize decoding of a stream. This will flush any partial decode state,
- * which may result in a final frame being extracted. The previously
- * registered callback will be called if a complete frame is decoded.
+ * Decode buffers of input data for several streams at once. This behaves
+ * like calling shcodecs_decode() for each decoder, but pictures are
+ * decoded round-robin, one from each stream, and the VPU is locked once
+ * per round rather than once per picture. The decoded callbacks are
+ * called after each round, with the VPU unlocked. If a callback returns
+ * 1, decoding of that stream is paused for the rest of this call.
+ * \param decoders An array of SHCodecs_Decoder* handles
+ * \param data An array of memory buffers containing compressed video data,
+ * one per decoder
+ * \param len An array of the lengths in bytes of each buffer in \a data
+ * \param used An array which is filled in with the number of bytes of
+ * each buffer that were used
+ * \param nr_decoders The number of entries in each array
+ * \returns The number of frames decoded by this call, or -1 on error
+ */
+int
+shcodecs_decode_multi (SHCodecs_Decoder ** decoders, unsigned char ** data,
+                       int * len, int * used, int nr_decoders);
+
+/**
+ * Decode the last data of a stream. shcodecs_decode() holds back data
+ * until it finds the start of the next picture, so the final picture of
+ * a stream is only decoded when the data remaining after the last call
+ * of shcodecs_decode() is passed to this function. The decoder does not
+ * keep a reference to the data after this call returns.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \param data The remaining encoded data
+ * \param len The length in bytes of the data
+ * \returns The number of bytes used, or -1 on error
+ */
+int
+shcodecs_decode_final (SHCodecs_Decoder * decoder, unsigned char * data, int len);
+
+/**
+ * Finalize decoding of a stream. This outputs the frames still held by
+ * the decoder, through the previously registered callback. Any data not
+ * used by shcodecs_decode() should first be passed to
+ * shcodecs_decode_final(); finalize does not decode any more input.
  * Note that previously generated frames will be referenced, so do not
  * free any of the image buffers you were using for shcodecs_decode()
  * before calling this function.
@@ -113,12 +190,40 @@ shcodecs_decode (SHCodecs_Decoder * decoder, unsigned char * data, int len);
  * reference the previously generated frames (both during normal decode and
  * during finalization).
  *
+ * This is equivalent to shcodecs_decoder_flush().
+ *
  * \param decoder The SHCodecs_Decoder* handle
  * \returns The number of final frames extracted by this call
  */
 int
 shcodecs_decoder_finalize (SHCodecs_Decoder * decoder);
 
+/**
+ * Flush the decoder. Every picture still held by the decoder for
+ * reordering is output, in display order, through the previously
+ * registered callback. The input state is then cleared, so that decoding
+ * can continue with new data, for example from a new stream with the same
+ * dimensions. No input data is decoded; pass the remaining data of the
+ * stream to shcodecs_decode_final() first.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \returns The number of frames output by this call, or -1 on error
+ */
+int
+shcodecs_decoder_flush (SHCodecs_Decoder * decoder);
+
+/**
+ * Reset the decoder, eg. for seeking. All buffered input and pending
+ * pictures are discarded without being output, and decoding restarts
+ * from the next data passed to shcodecs_decode(), which should begin at
+ * a random access point (an IDR picture or I-VOP). Memory allocated by
+ * shcodecs_decoder_init() is reused. The frame count is reset to zero.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shcodecs_decoder_reset (SHCodecs_Decoder * decoder);
+
 /**
  * Retrieve the count of decoded frames.
  * \param decoder The SHCodecs_Decoder* handle
@@ -127,4 +232,89 @@ shcodecs_decoder_finalize (SHCodecs_Decoder * decoder);
 int
 shcodecs_decoder_get_frame_count (SHCodecs_Decoder * decoder);
 
+/**
+ * Attach a presentation timestamp to the input data. The timestamp applies
+ * to the first picture whose data starts at or after \a offset, and is
+ * carried through decoding and reordering to the output frame, where it
+ * can be retrieved with shcodecs_decoder_get_frame_timestamp().
+ * \param decoder The SHCodecs_Decoder* handle
+ * \param offset The byte offset of the timestamped data, relative to the
+ * start of the buffer passed to the next call of shcodecs_decode(). Note
+ * that data which was not used by a previous call must be passed again,
+ * and counts towards this offset.
+ * \param ts The timestamp
+ * \retval 0 Success
+ * \retval -1 Invalid parameters
+ */
+int
+shcodecs_decoder_set_input_timestamp (SHCodecs_Decoder * decoder,
+                                      int offset, SHCodecs_Timestamp ts);
+
+/**
+ * Retrieve the timestamp of the frame currently being output. This
+ * function is intended to be called from within an SHCodecs_Decoded_Callback.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \returns The timestamp set with shcodecs_decoder_set_input_timestamp()
+ * for the data of this frame, or SHCODECS_TIMESTAMP_NONE if none was set.
+ */
+SHCodecs_Timestamp
+shcodecs_decoder_get_frame_timestamp (SHCodecs_Decoder * decoder);
+
+/**
+ * Retrieve the latency of the frame currently being output, measured
+ * from the call of shcodecs_decoder_set_input_timestamp() for its data
+ * to the start of the SHCodecs_Decoded_Callback. This function is intended
+ * to be called from within an SHCodecs_Decoded_Callback.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \returns The latency in microseconds, or -1 if the frame has no timestamp
+ */
+long
+shcodecs_decoder_get_frame_latency (SHCodecs_Decoder * decoder);
+
+/**
+ * Retrieve the VUI and SEI metadata of the frame currently being output.
+ * The metadata is collected by the VPU middleware during decoding, so no
+ * additional parsing of the stream is required. This function is intended
+ * to be called from within an SHCodecs_Decoded_Callback; the returned
+ * structure is owned by the decoder and is only valid until the callback
+ * returns. Metadata is only available for H.264 streams.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \returns The metadata of the current frame, or NULL on error
+ */
+const SHCodecs_Decoder_Metadata *
+shcodecs_decoder_get_metadata (SHCodecs_Decoder * decoder);
+
+/**
+ * Enable or disable error resilience, for lossy input such as network
+ * streams. When enabled, the middleware conceals the damaged part of a
+ * picture in which an error is found, and the picture is output. The
+ * decoder then skips slice NAL units, without using the VPU, until the
+ * next IDR picture or recovery point SEI. This mode is only available for
+ * H.264 streams.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \param enable Flag: Error resilience is enabled if set to a non-zero value
+ * \retval 0 Success
+ * \retval -1 Error, or the stream format is not H.264
+ */
+int
+shcodecs_decoder_set_error_resilience (SHCodecs_Decoder * decoder, int enable);
+
+/**
+ * Retrieve the number of NAL units skipped while waiting for a random
+ * access point in error resilience mode.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \returns The number of skipped NAL units
+ */
+int
+shcodecs_decoder_get_skipped_count (SHCodecs_Decoder * decoder);
+
+/**
+ * Retrieve the number of pictures in which errors were concealed in
+ * error resilience mode.
+ * \param decoder The SHCodecs_Decoder* handle
+ * \returns The number of concealed pictures
+ */
+int
+shcodecs_decoder_get_concealed_count (SHCodecs_Decoder * decoder);
+
 #endif /* __SHCODECS_DECODER_H__ */
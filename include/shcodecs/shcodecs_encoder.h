@@ -5,6 +5,8 @@
 #ifndef __SHCODECS_ENCODER_H__
 #define __SHCODECS_ENCODER_H__
 
+#include <sys/uio.h>
+
 #include <shcodecs/shcodecs_common.h>
 
 /** \file
@@ -56,6 +58,168 @@ typedef int (*SHCodecs_Encoder_Output) (SHCodecs_Encoder * encoder,
                                         unsigned char * data, int length,
                                         void * user_data);
 
+/**
+ * Signature of a callback for libshcodecs to call for a buffer to encode
+ * the next picture, or H.264 slice, into. The callback is made while the
+ * VPU is locked, so it should return quickly.
+ * The encoder never keeps a buffer beyond the output callbacks for the
+ * data encoded into it. A buffer smaller than \a min_length is ignored, as
+ * is any buffer returned for a frame that is then skipped: it is not used,
+ * and remains owned by the application, which can tell from the data
+ * passed to the output callbacks whether a buffer was used.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param min_length The size in bytes the buffer must have to be used
+ * \param length Returns the size of the buffer in bytes
+ * \param user_data Arbitrary data supplied by user
+ * \returns The buffer, or NULL to use the encoder's own buffer for this
+ * picture or slice
+ */
+typedef unsigned char * (*SHCodecs_Encoder_Output_Buffer) (SHCodecs_Encoder * encoder,
+                                                           int min_length, int * length,
+                                                           void * user_data);
+
+/**
+ * Picture types of encoded frames.
+ */
+typedef enum {
+    SHCodecs_Picture_IDR = 0,
+    SHCodecs_Picture_I,
+    SHCodecs_Picture_P,
+    SHCodecs_Picture_B,
+    SHCodecs_Picture_End  /**< End of stream code, not a picture */
+} SHCodecs_Picture_Type;
+
+/**
+ * Information about an encoded access unit.
+ */
+typedef struct {
+    SHCodecs_Picture_Type pic_type;
+    long frame_number;             /**< Frame number passed to the VPU, in display order */
+    SHCodecs_Timestamp timestamp;  /**< Timestamp of the input frame, see shcodecs_encoder_set_input_timestamp() */
+    void * user_data;              /**< User data passed with the input frame */
+    int header_bytes;              /**< Bytes of AUD, SEI, SPS, PPS and filler */
+    int slice_bytes;               /**< Bytes of slice data */
+    int nr_slices;
+} SHCodecs_Encoder_AU_Info;
+
+/**
+ * Information about an encoded H.264 slice.
+ */
+typedef struct {
+    SHCodecs_Picture_Type pic_type;
+    long frame_number;  /**< Frame number passed to the VPU */
+    SHCodecs_Timestamp timestamp;  /**< Timestamp of the input frame */
+    void * user_data;   /**< User data passed with the input frame */
+    int index;          /**< Index of the slice within the picture */
+    int first_mb;       /**< Address of the first macroblock in the slice */
+    int nr_mbs;         /**< Number of macroblocks in the slice */
+    int last;           /**< 1 for the last slice of the picture, else 0 */
+} SHCodecs_Encoder_Slice_Info;
+
+/**
+ * Signature of a callback for libshcodecs to call as soon as each slice
+ * has been encoded, before the rest of the picture.
+ * To pause encoding, return 1 from this callback.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param data The slice NAL unit
+ * \param length Length of the slice in bytes
+ * \param info Information about the slice
+ * \param user_data Arbitrary data supplied by user
+ * \retval 0 Continue encoding
+ * \retval 1 Pause encoding, return from shcodecs_encode()
+ */
+typedef int (*SHCodecs_Encoder_Slice_Output) (SHCodecs_Encoder * encoder,
+                                              unsigned char * data, int length,
+                                              const SHCodecs_Encoder_Slice_Info * info,
+                                              void * user_data);
+
+/**
+ * Keyframe statistics.
+ */
+typedef struct {
+    long nr_frames;            /**< Frames encoded, not including skipped frames */
+    long nr_keyframes;         /**< IDR and I frames encoded */
+    long nr_forced;            /**< Keyframes due to shcodecs_encoder_force_keyframe() or scene cuts */
+    long last_keyframe_bytes;  /**< Size of the most recent keyframe */
+    long max_keyframe_bytes;   /**< Size of the largest keyframe */
+    long long keyframe_bytes;  /**< Total size of all keyframes */
+    long last_interval;        /**< Frames between the two most recent keyframes */
+    long frames_since_keyframe;
+} SHCodecs_Encoder_Keyframe_Stats;
+
+/**
+ * Scene analysis statistics. The savings are estimated from the average
+ * size and VPU time of recent inter frames.
+ */
+typedef struct {
+    long nr_frames;             /**< Input frames analysed */
+    long nr_scene_cuts;         /**< Keyframes forced at scene cuts */
+    long nr_static_skipped;     /**< Static frames skipped */
+    long long bits_saved;       /**< Estimated picture bits saved by skipping */
+    double vpu_ms_saved;        /**< Estimated VPU time saved by skipping */
+} SHCodecs_Encoder_Scene_Stats;
+
+/**
+ * Statistics of one input frame, which was either encoded or skipped.
+ */
+typedef struct {
+    long frame_number;             /**< Frame number passed to the VPU */
+    SHCodecs_Timestamp timestamp;  /**< Timestamp of the input frame */
+    void * user_data;              /**< User data passed with the input frame */
+    SHCodecs_Picture_Type pic_type;  /**< Not valid for skipped frames */
+    int skipped;                   /**< 1 if rate control or scene analysis skipped the frame, else 0 */
+    long bits;                     /**< Bits of picture data, not including headers */
+    int nr_slices;                 /**< Number of slices (1 for MPEG-4) */
+    const long * slice_bits;       /**< Bits of each slice */
+    double average_qp;             /**< Quantizer averaged over all macroblocks */
+    double vpu_ms;                 /**< Time the VPU spent encoding the picture */
+    double lock_wait_ms;           /**< Time spent waiting for the VPU lock */
+    double wall_ms;                /**< Total time in shcodecs_encoder_encode_1frame() */
+} SHCodecs_Encoder_Frame_Stats;
+
+/**
+ * Signature of a callback for libshcodecs to call with the statistics of
+ * each input frame, once the frame has been encoded or skipped and the
+ * VPU has been released. The statistics, including \a slice_bits, remain
+ * valid until the callback returns.
+ * To pause encoding, return 1 from this callback.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param stats The statistics of the frame
+ * \param user_data Arbitrary data supplied by user
+ * \retval 0 Continue encoding
+ * \retval 1 Pause encoding, return from shcodecs_encode()
+ */
+typedef int (*SHCodecs_Encoder_Frame_Stats_Callback) (SHCodecs_Encoder * encoder,
+                                                      const SHCodecs_Encoder_Frame_Stats * stats,
+                                                      void * user_data);
+
+/**
+ * A region of interest. The region is extended to whole macroblocks.
+ */
+typedef struct {
+    int x, y;           /**< Top left corner in pixels */
+    int width, height;  /**< Size in pixels */
+    int qp_offset;      /**< Added to the quantizer, negative for higher quality */
+} SHCodecs_Encoder_ROI;
+
+/**
+ * Signature of a callback for libshcodecs to call when it has encoded a
+ * complete access unit. The segments are NAL units in bitstream order and
+ * remain valid until the callback returns.
+ * To pause encoding, return 1 from this callback.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param iov The segments of the access unit
+ * \param iovcnt The number of segments
+ * \param info Information about the access unit
+ * \param user_data Arbitrary data supplied by user
+ * \retval 0 Continue encoding
+ * \retval 1 Pause encoding, return from shcodecs_encode()
+ */
+typedef int (*SHCodecs_Encoder_AU_Output) (SHCodecs_Encoder * encoder,
+                                           const struct iovec * iov, int iovcnt,
+                                           const SHCodecs_Encoder_AU_Info * info,
+                                           void * user_data);
+
 /**
  * Initialize the VPU4 for encoding a given video format.
  * \param width The video image width
@@ -74,6 +238,30 @@ shcodecs_encoder_init(int width, int height, SHCodecs_Format format);
 void
 shcodecs_encoder_close (SHCodecs_Encoder * encoder);
 
+/**
+ * Reset an encoder for a new stream, as if it had been closed and
+ * initialized again for the same format, but without freeing and
+ * reallocating its memory. The local decode images, work areas, stream
+ * buffers and input buffers are kept, so the new size must fit in them:
+ * it may be smaller than the size the encoder was initialized with, but
+ * not larger. All encoding parameters return to their defaults, and
+ * features such as rate control lookahead, scene analysis and regions of
+ * interest are disabled. The callbacks are kept. MPEG-4 inputs held for
+ * B-VOPs are released without being encoded.
+ * Call shcodecs_encoder_finish() first to complete the current stream.
+ * This must not be called while encoding, or while asynchronous encoding
+ * is running.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param width The video image width
+ * \param height The video image height
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, asynchronous encoding is running, the new
+ * size does not fit the buffers, or out of memory. The encoder is
+ * unchanged if the size does not fit.
+ */
+int
+shcodecs_encoder_reset (SHCodecs_Encoder * encoder, int width, int height);
+
 /**
  * Set the callback for libshcodecs to call when encoded data is available.
  * \param encoder The SHCodecs_Encoder* handle
@@ -85,6 +273,78 @@ shcodecs_encoder_set_output_callback (SHCodecs_Encoder * encoder,
                                       SHCodecs_Encoder_Output output_cb,
                                       void * user_data);
 
+/**
+ * Set the callback for libshcodecs to call for a buffer to encode each
+ * picture, or H.264 slice, into, so that the encoded data is passed to the
+ * output callbacks in place rather than having to be copied out of the
+ * encoder's own buffer before the next picture is encoded. A slice needs
+ * a buffer somewhat larger than the limit set with
+ * shcodecs_encoder_set_max_slice_bytes(), and a whole picture needs a
+ * buffer large enough for the worst case. If the buffer returned is too
+ * small, the picture or slice is encoded into the encoder's
+ * own buffer instead, and a new buffer is requested for the next one; the
+ * application can tell which buffers were used from the data passed to
+ * the output callbacks. A buffer is not used if the frame is skipped.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param output_buffer_cb The callback function, or NULL to always use
+ * the encoder's own buffer
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_set_output_buffer_callback (SHCodecs_Encoder * encoder,
+                                             SHCodecs_Encoder_Output_Buffer output_buffer_cb,
+                                             void * user_data);
+
+/**
+ * Set the callback for libshcodecs to call when a complete access unit has
+ * been encoded. While set, it is called instead of the output callback.
+ * For MPEG-4, each access unit is a single VOP. This must not be called
+ * while a frame is being encoded.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param au_output_cb The callback function, or NULL to use the output
+ * callback again
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or out of memory
+ */
+int
+shcodecs_encoder_set_au_output_callback (SHCodecs_Encoder * encoder,
+                                         SHCodecs_Encoder_AU_Output au_output_cb,
+                                         void * user_data);
+
+/**
+ * Set the callback for libshcodecs to call as each slice is encoded.
+ * While set, slices are passed to this callback instead of the output
+ * callback; other NAL units still go to the output callback. In access
+ * unit mode, slices are passed to this callback and also included in the
+ * access unit. Only H.264 is supported.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param slice_output_cb The callback function, or NULL
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 Not an H.264 encoder
+ */
+int
+shcodecs_encoder_set_slice_output_callback (SHCodecs_Encoder * encoder,
+                                            SHCodecs_Encoder_Slice_Output slice_output_cb,
+                                            void * user_data);
+
+/**
+ * Limit the size of each H.264 slice, for low latency transport.
+ * Each slice is returned by the VPU, and passed to the slice output
+ * callback, as soon as it is encoded. The VPU ends a slice once it reaches
+ * the given size, so allow some headroom below the transport MTU.
+ * This must be called before encoding starts.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param max_bytes The maximum bytes per slice, or 0 for one slice per picture
+ * \retval 0 Success
+ * \retval -1 Not an H.264 encoder, or encoding has started
+ */
+int
+shcodecs_encoder_set_max_slice_bytes (SHCodecs_Encoder * encoder, int max_bytes);
+
 /**
  * Set the callback for libshcodecs to call when raw YUV data is required.
  * \param encoder The SHCodecs_Encoder* handle
@@ -111,6 +371,47 @@ shcodecs_encoder_set_input_release_callback (SHCodecs_Encoder * encoder,
 void *
 shcodecs_encoder_get_input_user_data(SHCodecs_Encoder *encoder);
 
+/**
+ * Allocate input buffers owned by the encoder.
+ * The buffers are physically contiguous and visible to the VPU, so frames
+ * written into them are encoded without being copied. Buffers are obtained
+ * with shcodecs_encoder_get_input_buffer() and are returned to the pool
+ * once the encoder has made the input release callback for them. They are
+ * freed by shcodecs_encoder_close().
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param nr_buffers The number of buffers to allocate (at most 16)
+ * \retval 0 Success
+ * \retval -1 Invalid number of buffers, buffers already allocated, or out of memory
+ */
+int
+shcodecs_encoder_alloc_input_buffers(SHCodecs_Encoder * encoder, int nr_buffers);
+
+/**
+ * Get a free input buffer from the encoder's pool.
+ * This function may be called from a different thread to the one encoding.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input Returns the Y plane of the buffer
+ * \param c_input Returns the CbCr plane of the buffer
+ * \retval 0 Success
+ * \retval -1 No buffer is free
+ */
+int
+shcodecs_encoder_get_input_buffer(SHCodecs_Encoder * encoder,
+				  unsigned char **y_input,
+				  unsigned char **c_input);
+
+/**
+ * Return an input buffer to the encoder's pool without encoding it.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input The Y plane of the buffer, as returned by
+ * shcodecs_encoder_get_input_buffer()
+ * \retval 0 Success
+ * \retval -1 Not an encoder input buffer
+ */
+int
+shcodecs_encoder_put_input_buffer(SHCodecs_Encoder * encoder,
+				  unsigned char *y_input);
+
 
 /**
  * Provide input data to the encoder.
@@ -151,13 +452,52 @@ shcodecs_encoder_run (SHCodecs_Encoder * encoder);
  * \param encoder The SHCodecs_Encoder* handle
  * \param y_input Pointer to the Y plane of input data
  * \param c_input Pointer to the CbCr plane of input data
- * \param user_data User data that is available during the input release callback
+ * \param user_data User data that is available during the input release
+ * callback, and is delivered with the encoded data of the frame
  * \retval 0 Success
  */
 int
 shcodecs_encoder_encode_1frame(SHCodecs_Encoder * encoder,
 	void *y_input, void *c_input, void *user_data);
 
+/**
+ * Attach a timestamp to the next input frame, passed to
+ * shcodecs_encoder_encode_1frame() or shcodecs_encoder_submit(), or
+ * provided from an SHCodecs_Encoder_Input callback. The timestamp and the
+ * frame's user data are carried through B-VOP reordering to the encoded
+ * data of the frame, and to its statistics if the frame is skipped.
+ * The units of the timestamp are chosen by the application.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param ts The timestamp
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_set_input_timestamp(SHCodecs_Encoder * encoder,
+				     SHCodecs_Timestamp ts);
+
+/**
+ * Retrieve the timestamp of the frame currently being output. This
+ * function is intended to be called from within an SHCodecs_Encoder_Output
+ * callback; the other output callbacks are given the timestamp directly.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \returns The timestamp set with shcodecs_encoder_set_input_timestamp()
+ * for this frame, or SHCODECS_TIMESTAMP_NONE if none was set or the data
+ * is the end of stream code.
+ */
+SHCodecs_Timestamp
+shcodecs_encoder_get_output_timestamp(SHCodecs_Encoder * encoder);
+
+/**
+ * Retrieve the user data of the frame currently being output. This
+ * function is intended to be called from within an SHCodecs_Encoder_Output
+ * callback.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \returns The user data passed with this frame, or NULL
+ */
+void *
+shcodecs_encoder_get_output_user_data(SHCodecs_Encoder * encoder);
+
 /**
  * Finish encoding.
  * \param encoder The SHCodecs_Encoder* handle
@@ -182,6 +522,248 @@ int shcodecs_encoder_get_width (SHCodecs_Encoder * encoder);
  */
 int shcodecs_encoder_get_height (SHCodecs_Encoder * encoder);
 
+/**
+ * Start asynchronous encoding.
+ * A worker thread encodes frames passed to shcodecs_encoder_submit(), so
+ * that the next frames can be prepared while the VPU is busy. The output
+ * and input release callbacks are made from the worker thread. Other
+ * encoder functions must not be called until shcodecs_encoder_stop_async().
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param depth The maximum number of frames submitted but not yet collected
+ * with shcodecs_encoder_wait_async() (at most 16)
+ * \retval 0 Success
+ * \retval -1 Invalid depth, already started, or failure to start the worker
+ */
+int
+shcodecs_encoder_start_async(SHCodecs_Encoder * encoder, int depth);
+
+/**
+ * Submit a frame for asynchronous encoding.
+ * This blocks while \a depth frames are in flight.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input Pointer to the Y plane of input data
+ * \param c_input Pointer to the CbCr plane of input data
+ * \param user_data User data returned with the completed frame
+ * \retval 0 Success
+ * \retval -1 Asynchronous encoding not started
+ */
+int
+shcodecs_encoder_submit(SHCodecs_Encoder * encoder,
+			void *y_input, void *c_input, void *user_data);
+
+/**
+ * Collect the next encoded frame, in submission order, waiting until it
+ * has been encoded. Every submitted frame must be collected to make room
+ * for further submissions. The input buffers of a collected frame are no
+ * longer used by the encoder and may be reused. An MPEG-4 frame held to
+ * be encoded as a B-VOP is collected before it is encoded; the encoder
+ * keeps a copy of it, and its data is output with a later frame.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input Returns the Y plane of the frame, may be NULL
+ * \param c_input Returns the CbCr plane of the frame, may be NULL
+ * \param user_data Returns the user data of the frame, may be NULL
+ * \param rc Returns the result of shcodecs_encoder_encode_1frame() for
+ * the frame, may be NULL
+ * \retval 0 Success
+ * \retval -1 No frames are in flight
+ */
+int
+shcodecs_encoder_wait_async(SHCodecs_Encoder * encoder,
+			    void **y_input, void **c_input, void **user_data,
+			    int *rc);
+
+/**
+ * Stop asynchronous encoding once all submitted frames are encoded.
+ * Frames that have not been collected are discarded.
+ * shcodecs_encoder_finish() may then be called.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \retval 0 Success
+ * \retval -1 Asynchronous encoding not started
+ */
+int
+shcodecs_encoder_stop_async(SHCodecs_Encoder * encoder);
+
+/**
+ * Change the target bitrate.
+ * Before encoding starts this is the same as shcodecs_encoder_set_bitrate().
+ * Once encoding has started, the change takes effect from the next frame
+ * without restarting the stream, provided that param_changeable was enabled
+ * before the first frame was encoded. The bitrate may not exceed
+ * changeable_max_bitrate, if set. This may be called from any thread.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param bitrate The new bitrate in bits per second
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or the change is not allowed
+ */
+int
+shcodecs_encoder_change_bitrate(SHCodecs_Encoder * encoder, long bitrate);
+
+/**
+ * Change the frame rate used by rate control.
+ * This takes effect in the same way as shcodecs_encoder_change_bitrate().
+ * The frame rate signalled in the stream headers is not changed.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param frame_rate The new frame rate x10 (i.e. 300=30fps)
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or the change is not allowed
+ */
+int
+shcodecs_encoder_change_frame_rate(SHCodecs_Encoder * encoder, long frame_rate);
+
+/**
+ * Change the I-frame interval.
+ * This takes effect in the same way as shcodecs_encoder_change_bitrate().
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param I_vop_interval The new interval in frames
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or the change is not allowed
+ */
+int
+shcodecs_encoder_change_I_vop_interval(SHCodecs_Encoder * encoder, long I_vop_interval);
+
+/**
+ * Force the next frame to be encoded as a keyframe.
+ * For H.264 this is an IDR picture, preceded by the SPS and PPS, and for
+ * MPEG-4 an I-VOP. A decoder can start decoding from the keyframe, so this
+ * is typically called when a new receiver joins or reports loss. This may
+ * be called from any thread.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_force_keyframe(SHCodecs_Encoder * encoder);
+
+/**
+ * Use gradual intra refresh instead of periodic keyframes.
+ * Intra macroblocks are spread over \a cycle frames, so that every
+ * macroblock is refreshed once per cycle without the bitrate spike of a
+ * keyframe. Only the first frame is a keyframe, and a decoder joining the
+ * stream is fully refreshed after at most \a cycle frames.
+ * shcodecs_encoder_force_keyframe() can still be used.
+ * This must be called before encoding starts.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param cycle The intra refresh cycle in frames, or 0 to disable
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or encoding has started
+ */
+int
+shcodecs_encoder_set_intra_refresh(SHCodecs_Encoder * encoder, long cycle);
+
+/**
+ * Get keyframe statistics. This may be called from any thread.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param stats Returns the statistics
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_get_keyframe_stats(SHCodecs_Encoder * encoder,
+				    SHCodecs_Encoder_Keyframe_Stats * stats);
+
+/**
+ * Set regions of interest, whose quality differs from the rest of the
+ * picture, for example to spend fewer bits on a static background.
+ * The regions apply from the next frame encoded until they are changed.
+ * At most three distinct non-zero offsets may be used. The first call must
+ * be made before encoding starts, as it selects the user weighted-Q mode;
+ * after that, regions may be changed from any thread.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param rois The regions; later regions take precedence where they
+ * overlap. NULL to clear.
+ * \param nr_rois The number of regions
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, too many distinct offsets, encoding
+ * started with another weighted-Q mode, or out of memory
+ */
+int
+shcodecs_encoder_set_roi(SHCodecs_Encoder * encoder,
+			 const SHCodecs_Encoder_ROI * rois, int nr_rois);
+
+/**
+ * Set a quantizer offset for each macroblock, in the same way as
+ * shcodecs_encoder_set_roi().
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param map One offset per macroblock in raster order, with at most
+ * three distinct non-zero values. NULL to clear.
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, too many distinct offsets, encoding
+ * started with another weighted-Q mode, or out of memory
+ */
+int
+shcodecs_encoder_set_qp_offset_map(SHCodecs_Encoder * encoder,
+				   const signed char * map);
+
+/**
+ * Enable the lookahead rate controller, which runs on the CPU in addition
+ * to the VPU rate control. The complexity of each input frame is measured
+ * and compared with the frames that follow it and with recent frames, and
+ * the bits of each frame are compared with the target. The bitrate given
+ * to the VPU is adjusted before each frame, so that complex frames get
+ * more bits and the output bitrate follows the target closely.
+ * With asynchronous encoding, frames are analysed as they are submitted,
+ * so the frames waiting to be encoded are used as the lookahead.
+ * This enables param_changeable, and must be called before encoding starts.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param enable 1 to enable, 0 to disable
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, encoding has started, or out of memory
+ */
+int
+shcodecs_encoder_set_lookahead_rate_control(SHCodecs_Encoder * encoder, int enable);
+
+/**
+ * Enable scene analysis, which runs on the CPU before each frame is
+ * encoded. Each frame is compared with the last frame passed on to the
+ * VPU, using the luma decimated 2:1 in each direction.
+ * If the luma histogram has changed by at least \a cut_percent, and the
+ * last frame no longer predicts the new one well, the frame is a scene
+ * cut and is encoded as a keyframe (IDR for H.264).
+ * If no part of the frame has changed beyond noise, the frame is static
+ * and is skipped, as the VPU skips frames to meet the bitrate: the frame
+ * numbers of later frames account for it, and the frame statistics show
+ * it as skipped. At most \a max_static_skip frames are skipped in a row,
+ * so a static scene is still refreshed regularly.
+ * This must be called before encoding starts.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param cut_percent Histogram change in percent that marks a scene cut,
+ * 1 to 100, or 0 to not detect scene cuts. 40 is a reasonable value.
+ * \param max_static_skip Most static frames to skip in a row, or 0 to not
+ * skip frames
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, encoding has started, or out of memory
+ */
+int
+shcodecs_encoder_set_scene_analysis(SHCodecs_Encoder * encoder,
+				    int cut_percent, int max_static_skip);
+
+/**
+ * Get scene analysis statistics, including the estimated bits and VPU
+ * time saved by skipping static frames. This may be called from any
+ * thread.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param stats Returns the statistics
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or scene analysis is not enabled
+ */
+int
+shcodecs_encoder_get_scene_stats(SHCodecs_Encoder * encoder,
+				 SHCodecs_Encoder_Scene_Stats * stats);
+
+/**
+ * Set the callback for libshcodecs to call with the statistics of each
+ * input frame. This must not be called while a frame is being encoded.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param frame_stats_cb The callback function, or NULL
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or out of memory
+ */
+int
+shcodecs_encoder_set_frame_stats_callback(SHCodecs_Encoder * encoder,
+					  SHCodecs_Encoder_Frame_Stats_Callback frame_stats_cb,
+					  void * user_data);
+
 /**
  * Get the number of input frames elapsed since the last output callback.
  * This is typically called by the client in the encoder output callback.
@@ -195,9 +777,10 @@ shcodecs_encoder_get_frame_num_delta(SHCodecs_Encoder *encoder);
 
 /**
  * Get the minimum number of input frames required.
- * Since the encoder may encoder frames out of order due to BVOPs, it may not
+ * Since the encoder may encode frames out of order due to B-VOPs, it may not
  * release an input buffer immediately. Therefore, you may need to use several
- * input frames.
+ * input frames. For MPEG-4 this is one more than the number of B-VOPs
+ * between anchor VOPs.
  * \param encoder The SHCodecs_Encoder* handle
  * \retval The minimum number of input frames required
  * \retval -1 \a encoder invalid
@@ -0,0 +1,116 @@
+#ifndef __SHCODECS_RTP_H__
+#define __SHCODECS_RTP_H__
+
+#include <sys/uio.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+/** \file
+ *
+ * RTP packetization of H.264 encoder output (RFC 6184, non-interleaved
+ * mode). Packets are built as iovecs that point into the encoder's buffers,
+ * so NAL unit payloads are never copied.
+ */
+
+/**
+ * An opaque handle to an RTP packetizer.
+ */
+struct SHCodecs_RTP_Packetizer;
+typedef struct SHCodecs_RTP_Packetizer SHCodecs_RTP_Packetizer;
+
+/**
+ * Signature of a callback for libshcodecs to call for each RTP packet.
+ * The first segment is the RTP header. The segments remain valid until
+ * the callback returns, so they can be passed straight to writev() or
+ * sendmsg().
+ * \param rtp The SHCodecs_RTP_Packetizer* handle
+ * \param iov The segments of the packet
+ * \param iovcnt The number of segments
+ * \param length The total length of the packet in bytes
+ * \param user_data Arbitrary data supplied by user
+ * \retval 0 Continue
+ * \retval <0 Stop packetizing, and return this value
+ */
+typedef int (*SHCodecs_RTP_Output) (SHCodecs_RTP_Packetizer * rtp,
+                                    const struct iovec * iov, int iovcnt,
+                                    int length, void * user_data);
+
+/**
+ * Create an RTP packetizer for an H.264 encoder.
+ * RTP timestamps use the 90kHz clock and are calculated from the frame
+ * number and the encoder's frame rate.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param mtu The maximum packet size, including the RTP header
+ * \param payload_type The RTP payload type
+ * \param ssrc The RTP synchronization source
+ * \param output_cb The callback function for each packet
+ * \param user_data Additional data to pass to the callback function
+ * \return rtp The SHCodecs_RTP_Packetizer* handle
+ * \retval NULL Invalid arguments, or out of memory
+ */
+SHCodecs_RTP_Packetizer *
+shcodecs_rtp_packetizer_init (SHCodecs_Encoder * encoder, int mtu,
+                              int payload_type, unsigned long ssrc,
+                              SHCodecs_RTP_Output output_cb, void * user_data);
+
+/**
+ * Free an RTP packetizer.
+ * \param rtp The SHCodecs_RTP_Packetizer* handle
+ */
+void
+shcodecs_rtp_packetizer_close (SHCodecs_RTP_Packetizer * rtp);
+
+/**
+ * Packetize an access unit, typically from an SHCodecs_Encoder_AU_Output
+ * callback. NAL units small enough are aggregated into STAP-A packets,
+ * larger ones are fragmented into FU-A packets, and the marker bit is set
+ * on the last packet.
+ * \param rtp The SHCodecs_RTP_Packetizer* handle
+ * \param iov The NAL units of the access unit
+ * \param iovcnt The number of NAL units
+ * \param info Information about the access unit
+ * \retval 0 Success
+ * \retval <0 Error returned by the output callback
+ */
+int
+shcodecs_rtp_packetize_au (SHCodecs_RTP_Packetizer * rtp,
+                           const struct iovec * iov, int iovcnt,
+                           const SHCodecs_Encoder_AU_Info * info);
+
+/**
+ * Packetize a single NAL unit, for example from an SHCodecs_Encoder_Output
+ * or SHCodecs_Encoder_Slice_Output callback. The NAL unit is sent as a
+ * single NAL unit packet, or fragmented into FU-A packets.
+ * \param rtp The SHCodecs_RTP_Packetizer* handle
+ * \param data The NAL unit, with or without a start code
+ * \param length The length of the NAL unit in bytes
+ * \param timestamp The RTP timestamp, see shcodecs_rtp_timestamp()
+ * \param last 1 if this is the last NAL unit of the access unit, else 0
+ * \retval 0 Success
+ * \retval <0 Error returned by the output callback
+ */
+int
+shcodecs_rtp_packetize_nal (SHCodecs_RTP_Packetizer * rtp,
+                            unsigned char * data, int length,
+                            unsigned long timestamp, int last);
+
+/**
+ * Get the RTP timestamp of a frame.
+ * \param rtp The SHCodecs_RTP_Packetizer* handle
+ * \param frame_number The frame number passed to the VPU, as given in
+ * SHCodecs_Encoder_AU_Info or SHCodecs_Encoder_Slice_Info
+ * \returns The RTP timestamp
+ */
+unsigned long
+shcodecs_rtp_timestamp (SHCodecs_RTP_Packetizer * rtp, long frame_number);
+
+/**
+ * Get the number of packets output.
+ * \param rtp The SHCodecs_RTP_Packetizer* handle
+ * \returns The number of packets
+ * \retval -1 \a rtp invalid
+ */
+long
+shcodecs_rtp_get_packet_count (SHCodecs_RTP_Packetizer * rtp);
+
+#endif /* __SHCODECS_RTP_H__ */
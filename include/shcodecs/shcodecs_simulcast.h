@@ -0,0 +1,176 @@
+#ifndef __SHCODECS_SIMULCAST_H__
+#define __SHCODECS_SIMULCAST_H__
+
+#include <shcodecs/shcodecs_encoder.h>
+
+/** \file
+ *
+ * Simulcast encoding: one input frame is encoded into several renditions,
+ * which may differ in size, bitrate or format. The renditions share the
+ * VPU data and the input buffers. Each frame is encoded in order of
+ * rendition priority, and lower priority renditions are skipped when they
+ * would make the next frame of the highest priority rendition late.
+ */
+
+/**
+ * An opaque handle to a simulcast encoder.
+ */
+struct SHCodecs_Simulcast;
+typedef struct SHCodecs_Simulcast SHCodecs_Simulcast;
+
+/**
+ * Signature of a callback for libshcodecs to call to scale an input frame
+ * for a rendition of a different size. Both frames are NV12, with the
+ * pitch and plane height rounded up to a multiple of 16.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param src_y The Y plane of the input frame
+ * \param src_c The CbCr plane of the input frame
+ * \param src_w The width of the input frame
+ * \param src_h The height of the input frame
+ * \param dst_y The Y plane to write, which is VPU memory
+ * \param dst_c The CbCr plane to write, which is VPU memory
+ * \param dst_w The width of the rendition
+ * \param dst_h The height of the rendition
+ * \param user_data Arbitrary data supplied by user
+ * \retval 0 Success
+ * \retval <0 Error, the rendition is skipped for this frame
+ */
+typedef int (*SHCodecs_Simulcast_Scale) (SHCodecs_Simulcast * simulcast,
+                                         unsigned char * src_y, unsigned char * src_c,
+                                         int src_w, int src_h,
+                                         unsigned char * dst_y, unsigned char * dst_c,
+                                         int dst_w, int dst_h,
+                                         void * user_data);
+
+/**
+ * Statistics of a rendition.
+ */
+typedef struct {
+	long nr_frames;		/**< Frames encoded */
+	long nr_skipped;	/**< Frames skipped to meet the deadline */
+	long nr_late;		/**< Frames completed after the deadline */
+	double mean_encode_ms;	/**< Mean time to scale and encode a frame */
+	double max_encode_ms;	/**< Maximum time to scale and encode a frame */
+	double fps;		/**< Frames encoded per second since the first frame */
+} SHCodecs_Simulcast_Stats;
+
+/**
+ * Create a simulcast encoder.
+ * \param width The input image width
+ * \param height The input image height
+ * \return simulcast The SHCodecs_Simulcast* handle
+ * \retval NULL Failure to open the VPU, or out of memory
+ */
+SHCodecs_Simulcast *
+shcodecs_simulcast_init (int width, int height);
+
+/**
+ * Close a simulcast encoder, including the encoders of its renditions.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ */
+void
+shcodecs_simulcast_close (SHCodecs_Simulcast * simulcast);
+
+/**
+ * Add a rendition. The returned encoder is configured like any other,
+ * except that it must not be closed, run or given input directly.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param width The rendition image width
+ * \param height The rendition image height
+ * \param format SHCodecs_Format_MPEG4 or SHCodecs_Format_H264
+ * \param priority Higher values are encoded first. The frame rate of the
+ * highest priority rendition sets the deadline for each frame.
+ * \return encoder The SHCodecs_Encoder* handle of the rendition
+ * \retval NULL Too many renditions, encoding started, or failure to
+ * create the encoder
+ */
+SHCodecs_Encoder *
+shcodecs_simulcast_add_rendition (SHCodecs_Simulcast * simulcast,
+                                  int width, int height,
+                                  SHCodecs_Format format, int priority);
+
+/**
+ * Set the callback used to scale the input for renditions of a different
+ * size, for example to use a hardware scaler. By default the input is
+ * scaled on the CPU.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param scale_cb The callback function, or NULL for the default
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 \a simulcast invalid
+ */
+int
+shcodecs_simulcast_set_scale_callback (SHCodecs_Simulcast * simulcast,
+                                       SHCodecs_Simulcast_Scale scale_cb,
+                                       void * user_data);
+
+/**
+ * Allocate input buffers in VPU memory, shared by all renditions.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param nr_buffers The number of buffers to allocate
+ * \retval 0 Success
+ * \retval -1 Invalid number of buffers, buffers already allocated, or out of memory
+ */
+int
+shcodecs_simulcast_alloc_input_buffers (SHCodecs_Simulcast * simulcast, int nr_buffers);
+
+/**
+ * Get a free input buffer. The buffer becomes free again once
+ * shcodecs_simulcast_encode_1frame() returns.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param y_input Returns the Y plane of the buffer
+ * \param c_input Returns the CbCr plane of the buffer
+ * \retval 0 Success
+ * \retval -1 No buffer is free
+ */
+int
+shcodecs_simulcast_get_input_buffer (SHCodecs_Simulcast * simulcast,
+                                     unsigned char ** y_input,
+                                     unsigned char ** c_input);
+
+/**
+ * Encode one input frame into each rendition, in order of priority.
+ * Renditions of the input size encode the input directly. The input is
+ * no longer needed when this function returns.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param y_input Pointer to the Y plane of input data
+ * \param c_input Pointer to the CbCr plane of input data
+ * \retval 0 Success
+ * \retval <0 Error encoding a rendition
+ */
+int
+shcodecs_simulcast_encode_1frame (SHCodecs_Simulcast * simulcast,
+                                  unsigned char * y_input,
+                                  unsigned char * c_input);
+
+/**
+ * Finish encoding all renditions.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \retval 0 Success
+ * \retval <0 Error finishing a rendition
+ */
+int
+shcodecs_simulcast_finish (SHCodecs_Simulcast * simulcast);
+
+/**
+ * Get the number of renditions.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \returns The number of renditions
+ * \retval -1 \a simulcast invalid
+ */
+int
+shcodecs_simulcast_get_nr_renditions (SHCodecs_Simulcast * simulcast);
+
+/**
+ * Get the statistics of a rendition.
+ * \param simulcast The SHCodecs_Simulcast* handle
+ * \param index The rendition, in the order they were added
+ * \param stats Returns the statistics
+ * \retval 0 Success
+ * \retval -1 \a simulcast or \a index invalid
+ */
+int
+shcodecs_simulcast_get_stats (SHCodecs_Simulcast * simulcast, int index,
+                              SHCodecs_Simulcast_Stats * stats);
+
+#endif /* __SHCODECS_SIMULCAST_H__ */
@@ -10,6 +10,13 @@ LOCAL_SRC_FILES := \
         m4driverif.c \
         shcodecs_decoder.c \
         shcodecs_encoder.c \
+        encoder_async.c \
+        encoder_roi.c \
+        encoder_analysis.c \
+        encoder_ratecontrol.c \
+        encoder_scene.c \
+        h263_clip.c \
+        shcodecs_simulcast.c \
         encoder_common.c \
         general_accessors.c \
         h264_accessors.c \
@@ -17,6 +24,7 @@ LOCAL_SRC_FILES := \
         property_accessors.c \
         h264_encode.c \
         mpeg4_encode.c \
+        rtp_packetizer.c \
         QuantMatrix.c
 
 LOCAL_SHARED_LIBRARIES := libstdc++ libm4dec libm
@@ -20,10 +20,35 @@
 #ifndef _DECODER_PRIVATE_H_
 #define _DECODER_PRIVATE_H_
 
+#include <time.h>
+
 #define CFRAME_NUM		4
+#define MAX_PIC_PARAMS		256
+
+/* avcbd_get_decoded_frame() mode to output the remaining frames */
+#define DECODED_FRAME_FLUSH	1
+
+/* Number of pending input/picture timestamps */
+#define TS_QUEUE_SIZE		32
 
 typedef TAVCBD_FMEM FrameInfo;
 
+/* Timestamp attached to a position in the input stream */
+struct ts_input {
+	long long	pos;		/* Input stream position in bytes */
+	SHCodecs_Timestamp ts;
+	struct timespec	arrival;	/* When the timestamp was set */
+};
+
+/* Timestamp of a decoded picture awaiting output */
+struct out_picture {
+	long		gop;		/* IDR count, for POC resets */
+	unsigned long	poc;		/* Picture order count */
+	SHCodecs_Timestamp ts;
+	struct timespec	arrival;
+	SHCodecs_Decoder_Metadata meta;	/* SEI of this picture */
+};
+
 struct SHCodecs_Decoder {
 	void	*vpu;
 	int		*context;	/* Pointer to context */
@@ -54,6 +79,28 @@ struct SHCodecs_Decoder {
 	int		frame_count;
 	int		last_cb_ret;
 	int		max_nal_size;
+
+	/* Timestamps */
+	long long	input_offset;	/* Stream position of input_buf */
+	long long	stream_used;	/* Total input bytes consumed */
+	long long	au_pos;		/* Stream position of current picture */
+	struct ts_input	ts_in[TS_QUEUE_SIZE];
+	int		nr_ts_in;
+	struct out_picture out_pics[TS_QUEUE_SIZE];
+	int		nr_out_pics;
+	long		gop_count;
+	SHCodecs_Timestamp frame_ts;	/* Timestamp of frame being output */
+	long		frame_latency;	/* Latency of frame being output (us) */
+
+	/* Metadata */
+	int		vui_valid;	/* Last SPS had VUI parameters */
+	SHCodecs_Decoder_Metadata metadata;	/* Frame being output */
+
+	/* Error resilience */
+	int		error_resilience;
+	int		resync;		/* Skipping to a random access point */
+	int		skipped_count;	/* NAL units skipped while resyncing */
+	int		concealed_count;	/* Pictures with concealed errors */
 };
 
 
@@ -0,0 +1,102 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * CPU analysis of input frames. The luma plane is decimated 2:1 in each
+ * direction, and each 8x8 block is represented by its 16 samples. The
+ * intra cost of a block is the sum of absolute deviations from its mean,
+ * and the inter cost is the sum of absolute differences from the same
+ * samples of the previous frame analysed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoder_private.h"
+
+/* Bytes of decimated luma for a frame of the encoder's size */
+int
+encoder_analysis_size(SHCodecs_Encoder *enc)
+{
+	return (ROUND_UP_16(enc->width) / 2) * (ROUND_UP_16(enc->height) / 2);
+}
+
+/* Analyse the Y plane of an input frame, with the pitch and height rounded
+ * up to a multiple of 16. prev holds the decimated luma of the previous
+ * frame, and is updated; with have_prev clear, the inter cost is the intra
+ * cost. */
+void
+encoder_analyse_frame(SHCodecs_Encoder *enc, const unsigned char *py,
+		      unsigned char *prev, int have_prev,
+		      struct frame_complexity *fc)
+{
+	int pitch = ROUND_UP_16(enc->width);
+	int height = ROUND_UP_16(enc->height);
+	int dpitch = pitch / 2;
+	unsigned char s[16];
+	unsigned char *d;
+	const unsigned char *p;
+	unsigned long intra, inter;
+	int x, y, i, j, mean;
+
+	memset(fc, 0, sizeof(*fc));
+
+	for (y=0; y < height; y += 8) {
+		for (x=0; x < pitch; x += 8) {
+			/* Decimate the block */
+			for (j=0; j<4; j++) {
+				p = py + (y + j*2) * pitch + x;
+				for (i=0; i<4; i++)
+					s[j*4 + i] = p[i*2];
+			}
+
+			mean = 0;
+			for (i=0; i<16; i++)
+				mean += s[i];
+			mean = (mean + 8) / 16;
+
+			intra = 0;
+			for (i=0; i<16; i++)
+				intra += abs(s[i] - mean);
+
+			inter = 0;
+			for (j=0; j<4; j++) {
+				d = prev + (y/2 + j) * dpitch + x/2;
+				for (i=0; i<4; i++) {
+					if (have_prev)
+						inter += abs(s[j*4 + i] - d[i]);
+					d[i] = s[j*4 + i];
+				}
+			}
+			if (!have_prev)
+				inter = intra;
+
+			fc->intra += intra;
+			fc->inter += inter;
+			fc->cost += (inter < intra) ? inter : intra;
+			if (inter > fc->max_inter)
+				fc->max_inter = inter;
+			fc->nr_blocks++;
+		}
+	}
+}
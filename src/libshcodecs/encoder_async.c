@@ -0,0 +1,242 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Asynchronous encoding. A worker thread takes frames from the submit queue
+ * and encodes them, so that the application can prepare the next frames
+ * while the VPU is busy. Encoded frames are placed on the completion queue
+ * for the application to collect.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "encoder_private.h"
+
+static void *
+async_worker(void *data)
+{
+	SHCodecs_Encoder *enc = (SHCodecs_Encoder *)data;
+	struct encoder_async *async = enc->async;
+	struct async_frame frame;
+	int i;
+
+	pthread_mutex_lock(&async->mutex);
+	while (1) {
+		while (async->nr_submitted == 0 && !async->stopping)
+			pthread_cond_wait(&async->cond, &async->mutex);
+
+		if (async->nr_submitted == 0)
+			break;
+
+		frame = async->submitted[async->sub_head];
+		async->sub_head = (async->sub_head + 1) % MAX_ASYNC_FRAMES;
+		async->nr_submitted--;
+		async->nr_encoding++;
+		pthread_mutex_unlock(&async->mutex);
+
+		frame.rc = encoder_encode_1frame(enc, frame.y, frame.c,
+						 frame.user_data, frame.timestamp);
+
+		pthread_mutex_lock(&async->mutex);
+		i = (async->comp_head + async->nr_completed) % MAX_ASYNC_FRAMES;
+		async->completed[i] = frame;
+		async->nr_completed++;
+		async->nr_encoding--;
+		pthread_cond_broadcast(&async->cond);
+	}
+	pthread_mutex_unlock(&async->mutex);
+
+	return NULL;
+}
+
+/**
+ * Start asynchronous encoding.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param depth The maximum number of frames in flight
+ * \retval 0 Success
+ * \retval -1 Invalid depth, already started, or failure to start the worker
+ */
+int
+shcodecs_encoder_start_async(SHCodecs_Encoder * encoder, int depth)
+{
+	struct encoder_async *async;
+
+	if (encoder == NULL) return -1;
+
+	if (depth < 1 || depth > MAX_ASYNC_FRAMES)
+		return -1;
+
+	if (encoder->async)
+		return -1;
+
+	async = calloc(1, sizeof(*async));
+	if (async == NULL)
+		return -1;
+
+	async->depth = depth;
+	pthread_mutex_init(&async->mutex, NULL);
+	pthread_cond_init(&async->cond, NULL);
+
+	encoder->async = async;
+
+	if (pthread_create(&async->thread, NULL, async_worker, encoder) != 0) {
+		encoder->async = NULL;
+		pthread_cond_destroy(&async->cond);
+		pthread_mutex_destroy(&async->mutex);
+		free(async);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Submit a frame for asynchronous encoding.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input Pointer to the Y plane of input data
+ * \param c_input Pointer to the CbCr plane of input data
+ * \param user_data User data returned with the completed frame
+ * \retval 0 Success
+ * \retval -1 Asynchronous encoding not started, or stopped
+ */
+int
+shcodecs_encoder_submit(SHCodecs_Encoder * encoder,
+			void *y_input, void *c_input, void *user_data)
+{
+	struct encoder_async *async;
+	struct async_frame *frame;
+	int i;
+
+	if (encoder == NULL || encoder->async == NULL) return -1;
+	async = encoder->async;
+
+	/* The submit queue is the lookahead of the rate controller */
+	if (encoder->rc)
+		encoder_rc_analyse(encoder, y_input);
+
+	pthread_mutex_lock(&async->mutex);
+
+	/* Wait until the application has collected enough completed frames */
+	while (!async->stopping &&
+	       async->nr_submitted + async->nr_encoding + async->nr_completed >= async->depth)
+		pthread_cond_wait(&async->cond, &async->mutex);
+
+	if (async->stopping) {
+		pthread_mutex_unlock(&async->mutex);
+		return -1;
+	}
+
+	i = (async->sub_head + async->nr_submitted) % MAX_ASYNC_FRAMES;
+	frame = &async->submitted[i];
+	frame->y = y_input;
+	frame->c = c_input;
+	frame->user_data = user_data;
+	frame->timestamp = encoder_take_input_timestamp(encoder);
+	frame->rc = 0;
+	async->nr_submitted++;
+
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+
+	return 0;
+}
+
+/**
+ * Collect the next completed frame, waiting until one is available.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input Returns the Y plane of the completed frame
+ * \param c_input Returns the CbCr plane of the completed frame
+ * \param user_data Returns the user data passed to shcodecs_encoder_submit()
+ * \param rc Returns the result of encoding the frame
+ * \retval 0 Success
+ * \retval -1 No frames are in flight
+ */
+int
+shcodecs_encoder_wait_async(SHCodecs_Encoder * encoder,
+			    void **y_input, void **c_input, void **user_data,
+			    int *rc)
+{
+	struct encoder_async *async;
+	struct async_frame *frame;
+
+	if (encoder == NULL || encoder->async == NULL) return -1;
+	async = encoder->async;
+
+	pthread_mutex_lock(&async->mutex);
+
+	while (async->nr_completed == 0 &&
+	       async->nr_submitted + async->nr_encoding > 0)
+		pthread_cond_wait(&async->cond, &async->mutex);
+
+	if (async->nr_completed == 0) {
+		pthread_mutex_unlock(&async->mutex);
+		return -1;
+	}
+
+	frame = &async->completed[async->comp_head];
+	async->comp_head = (async->comp_head + 1) % MAX_ASYNC_FRAMES;
+	async->nr_completed--;
+
+	if (y_input) *y_input = frame->y;
+	if (c_input) *c_input = frame->c;
+	if (user_data) *user_data = frame->user_data;
+	if (rc) *rc = frame->rc;
+
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+
+	return 0;
+}
+
+/**
+ * Stop asynchronous encoding once all submitted frames have been encoded.
+ * Completed frames that have not been collected are discarded.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \retval 0 Success
+ * \retval -1 Asynchronous encoding not started
+ */
+int
+shcodecs_encoder_stop_async(SHCodecs_Encoder * encoder)
+{
+	struct encoder_async *async;
+
+	if (encoder == NULL || encoder->async == NULL) return -1;
+	async = encoder->async;
+
+	pthread_mutex_lock(&async->mutex);
+	async->stopping = 1;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->mutex);
+
+	pthread_join(async->thread, NULL);
+
+	encoder->async = NULL;
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->mutex);
+	free(async);
+
+	return 0;
+}
@@ -20,6 +20,8 @@
 #ifndef __ENCODER_PRIVATE_H__
 #define __ENCODER_PRIVATE_H__
 
+#include <pthread.h>
+
 #include "shcodecs/shcodecs_encoder.h"
 
 #include "avcbe.h"
@@ -28,11 +30,120 @@
 
 #include "encoder_common.h"
 
-#define MAX_NUM_REF_FRAMES 1
-#define NUM_LDEC_FRAMES (MAX_NUM_REF_FRAMES+1)
+/* The VPU predicts from at most two reference frames: H.264 P pictures
+   may use two, and MPEG-4 B-VOPs refer to the anchor VOPs either side */
+#define MAX_NUM_REF_FRAMES 2
+#define MAX_LDEC_FRAMES (MAX_NUM_REF_FRAMES+1)
+#define MAX_B_VOPS 16
 
 #define ROUND_UP_16(x) ((((x)+15) / 16) * 16)
 
+#define MAX_INPUT_BUFFERS 16
+
+/* Encoder-owned input frame, contiguous and visible to the VPU */
+struct input_buffer {
+	unsigned char *phys;	/* VPU address of the Y plane, CbCr follows */
+	unsigned char *virt;	/* User address of the Y plane, CbCr follows */
+	int in_use;
+};
+
+#define MAX_ASYNC_FRAMES 16
+
+struct async_frame {
+	void *y;
+	void *c;
+	void *user_data;
+	SHCodecs_Timestamp timestamp;
+	int rc;
+};
+
+/* Submit and completion queues for asynchronous encoding (encoder_async.c) */
+struct encoder_async {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;	/* Signalled whenever either queue changes */
+	int stopping;
+	int depth;		/* Maximum frames submitted, encoding or uncollected */
+
+	struct async_frame submitted[MAX_ASYNC_FRAMES];
+	int sub_head;
+	int nr_submitted;
+
+	int nr_encoding;
+
+	struct async_frame completed[MAX_ASYNC_FRAMES];
+	int comp_head;
+	int nr_completed;
+};
+
+/* An MPEG-4 input frame, held until the following anchor VOP has been
+   encoded so that it can be encoded as a B-VOP (mpeg4_encode.c) */
+struct held_frame {
+	void *y;		/* As input, for release, or NULL once released */
+	void *c;
+	unsigned char *phys_y;	/* As read by the VPU */
+	unsigned char *phys_c;
+	void *user_data;
+	SHCodecs_Timestamp timestamp;
+	unsigned long rc_cost;	/* Complexity, for lookahead rate control */
+	long frm;		/* Frame number, in display order */
+	int copy;		/* Index of the encoder's copy of the input, or -1 */
+};
+
+/* Distinct quantizer offsets in a quality map, one per weighted-Q bit */
+#define MAX_ROI_LEVELS 3
+
+/* Complexity of an input frame (encoder_analysis.c) */
+struct frame_complexity {
+	unsigned long intra;	/* Sum of absolute deviations from block means */
+	unsigned long inter;	/* Sum of absolute differences from the previous frame */
+	unsigned long cost;	/* Sum of the lesser of the two for each block */
+	unsigned long max_inter;	/* Largest inter cost of a block */
+	int nr_blocks;
+};
+
+#define RC_MAX_LOOKAHEAD MAX_ASYNC_FRAMES
+
+/* Lookahead rate control state (encoder_ratecontrol.c) */
+struct encoder_rc {
+	/* Complexity of frames analysed but not yet encoded, protected by
+	   change_mutex as are scale and scale_pending */
+	unsigned long lookahead[RC_MAX_LOOKAHEAD];
+	int la_head;
+	int nr_lookahead;
+
+	unsigned char *prev;	/* Decimated luma of the last frame analysed */
+	int have_prev;
+
+	unsigned long cost;	/* Complexity of the frame being encoded */
+	double avg_cost;	/* Moving average complexity of encoded frames */
+	long nr_frames;
+	double target_bits;	/* Average bits per frame */
+	double fullness;	/* Bits output above the target */
+	double scale;		/* Bitrate scale given to the middleware */
+	int scale_pending;
+};
+
+#define SCENE_HIST_BINS 64
+
+/* Scene analysis state (encoder_scene.c) */
+struct encoder_scene {
+	int cut_percent;	/* Histogram change that marks a scene cut */
+	int max_skip;		/* Most static frames skipped in a row */
+
+	unsigned char *ref;	/* Decimated luma of the last frame passed on */
+	unsigned char *cur;	/* Decimated luma of the frame being analysed */
+	int have_ref;
+	unsigned long hist[SCENE_HIST_BINS];	/* Luma histogram of ref */
+	int nr_skipped;		/* Static frames skipped since the last encoded */
+
+	/* Average size and VPU time of inter frames, for the savings */
+	double avg_bits;
+	double avg_vpu_ms;
+
+	SHCodecs_Encoder_Scene_Stats stats;	/* protected by change_mutex */
+};
+
 typedef struct {
 	long weightdQ_enable;
 	TAVCBE_WEIGHTEDQ_CENTER weightedQ_info_center;	/* API´Ø¿ôavcbe_set_weightedQ()¤ËÅÏ¤¹¤¿¤á¤Î¹½Â¤ÂÎ(1) */
@@ -78,31 +189,65 @@ struct SHCodecs_Encoder {
 	void *release_user_data;
 	void *release_user_data_buffer;
 
+	/* Timestamp for the next input frame, from the application's thread */
+	SHCodecs_Timestamp input_timestamp;
+
 	SHCodecs_Encoder_Output output;
 	void *output_user_data;
 
+	/* Application buffers to encode into */
+	SHCodecs_Encoder_Output_Buffer output_buffer;
+	void *output_buffer_user_data;
+
+	/* Slice output (H.264 only) */
+	SHCodecs_Encoder_Slice_Output slice_output;
+	void *slice_output_user_data;
+
+	/* Access unit output (H.264 only) */
+	SHCodecs_Encoder_AU_Output au_output;
+	void *au_output_user_data;
+	struct iovec *au_iov;		/* Segments of the current access unit */
+	int au_nr_segments;
+	int au_max_segments;
+	SHCodecs_Encoder_AU_Info au_info;
+	unsigned long au_stream_offset;	/* Next free byte in stream_buff_info */
+	unsigned long au_sei_offset;	/* Next free byte in sei_buf_info */
+
 	/* Internal encode error tracking */
 	long error_return_code;	/* return_value of the API function when error occurred */
 
 	/* Internal */
 	int initialized; /* Is avcbe_encode_init() done? */
 	int y_bytes; /* Bytes used by Y input plane; CbCr plane uses y_bytes/2 */
+	int alloc_y_bytes; /* y_bytes that frame buffers were allocated for */
 	unsigned char * input_frame;
 	unsigned char * addr_y; /* VPU address to write next Y plane; updated by encoder backends */
 	unsigned char * addr_c; /* VPU address to write next C plane; updated by encoder backends */
-	unsigned char *addr_y_tbl[17], *addr_c_tbl[17];
+
+	/* Input buffer pool (shcodecs_encoder_alloc_input_buffers) */
+	struct input_buffer input_bufs[MAX_INPUT_BUFFERS];
+	int nr_input_bufs;
+	pthread_mutex_t input_bufs_mutex;
+
+	/* Asynchronous encoding, NULL unless started */
+	struct encoder_async *async;
 
 	avcbe_stream_info *stream_info;
 	long frm; /* Current frame */
 	long ldec;	/* Index to current working frame */
 	long ref1;	/* Index to reference frame */
+	long ref2;	/* Index to the second reference frame (H.264) */
+	long fwd_ref;	/* Index to the forward reference of B-VOPs (MPEG-4) */
 	long frame_skip_num; /* Number of frames skipped */
 	long frame_counter; /* The number of encoded frames */
-	long set_intra;	/* Forced intra-mode flag */
+	int context_saved; /* backup_area holds the stream context to restore */
+	long set_intra;	/* Forced intra-mode flag, protected by change_mutex */
+	long frame_bytes; /* Bytes output for the current frame */
 	int frame_num_delta;
 
 	/* Working values */
-	TAVCBE_FMEM local_frames[NUM_LDEC_FRAMES];
+	TAVCBE_FMEM local_frames[MAX_LDEC_FRAMES];
+	int nr_local_frames;
 	TAVCBE_WORKAREA work_area;
 	TAVCBE_WORKAREA backup_area;
 
@@ -121,6 +266,11 @@ struct SHCodecs_Encoder {
 
 	/* MPEG-4 specific internals */
 	avcbe_other_options_mpeg4 other_options_mpeg4;
+	int nr_b_vops;		/* B-VOPs between anchor VOPs */
+	struct held_frame held[MAX_B_VOPS];	/* Inputs awaiting the next anchor */
+	int nr_held;
+	unsigned char *input_copies[MAX_B_VOPS+1];	/* For inputs not visible to the VPU */
+	int copy_in_use[MAX_B_VOPS+1];
 
 	/* H.264 specific internals */
 	TAVCBE_STREAM_BUFF aud_buf_info;
@@ -133,6 +283,37 @@ struct SHCodecs_Encoder {
 	avcbe_other_options_h264 other_options_h264;	/* parameters to control details */
 	long output_filler_enable;	/* enable flag to put Filler Data for CPB Buffer Over */
 	long output_filler_data;	/* for FillerData(CPB  Buffer) */
+	int h264_ref_frames;	/* Reference frames for P pictures */
+
+	/* Runtime parameter changes (shcodecs_encoder_change_*()), applied
+	   before the next frame is encoded */
+	pthread_mutex_t change_mutex;
+	int change_pending;
+
+	SHCodecs_Encoder_Keyframe_Stats keyframe_stats; /* protected by change_mutex */
+
+	/* Lookahead rate control, NULL unless enabled */
+	struct encoder_rc *rc;
+
+	/* Scene analysis, NULL unless enabled */
+	struct encoder_scene *scene;
+
+	/* Region of interest quality map (encoder_roi.c) */
+	char *roi_table;		/* Weighted-Q bit of each macroblock, read by the middleware */
+	char *roi_pending_table;	/* protected by change_mutex, as are the following */
+	long roi_levels[MAX_ROI_LEVELS];
+	int roi_nr_levels;
+	int roi_pending;
+
+	/* Per-frame statistics (shcodecs_encoder_set_frame_stats_callback) */
+	SHCodecs_Encoder_Frame_Stats_Callback frame_stats_cb;
+	void *frame_stats_user_data;
+	SHCodecs_Encoder_Frame_Stats frame_stats;	/* Frame being encoded */
+	long *slice_bits;	/* One entry per macroblock at most */
+	int max_slices;
+	double frame_start_ms;
+	double qp_sum;		/* Quantizer weighted by macroblocks */
+	long qp_mbs;
 
 	/* Bit Rate Control */
 	int bitrate_control_enabled;    /* 1 if bitrate control is enabled */
@@ -144,14 +325,59 @@ struct SHCodecs_Encoder {
 
 /* Internal prototypes of functions using SHCodecs_Encoder */
 
+SHCodecs_Encoder *encoder_init_vpu(int width, int height,
+				   SHCodecs_Format format, void *shared_vpu);
+int encoder_alloc_local_frames(SHCodecs_Encoder *enc, int nrefframe);
+void encoder_skip_frame(SHCodecs_Encoder *enc);
+void encoder_release_input(SHCodecs_Encoder *enc, void *py, void *pc);
+SHCodecs_Timestamp encoder_take_input_timestamp(SHCodecs_Encoder *enc);
+void encoder_get_output_buffer(SHCodecs_Encoder *enc, long offset,
+			       TAVCBE_STREAM_BUFF *buff);
+int encoder_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc,
+			  void *user_data, SHCodecs_Timestamp ts);
+void encoder_middleware_rate(SHCodecs_Encoder *enc, long *bitrate, long *fps_x10);
+long encoder_apply_changes(SHCodecs_Encoder *enc);
+long encoder_get_set_intra(SHCodecs_Encoder *enc);
+long encoder_apply_roi(SHCodecs_Encoder *enc);
+
+int encoder_analysis_size(SHCodecs_Encoder *enc);
+void encoder_analyse_frame(SHCodecs_Encoder *enc, const unsigned char *py,
+			   unsigned char *prev, int have_prev,
+			   struct frame_complexity *fc);
+
+void encoder_rc_close(SHCodecs_Encoder *enc);
+void encoder_rc_analyse(SHCodecs_Encoder *enc, const unsigned char *py);
+unsigned long encoder_rc_frame_cost(SHCodecs_Encoder *enc, const unsigned char *py);
+void encoder_rc_begin_frame(SHCodecs_Encoder *enc, unsigned long cost);
+void encoder_rc_end_frame(SHCodecs_Encoder *enc);
+int encoder_rc_scale(SHCodecs_Encoder *enc, double *scale);
+
+void encoder_scene_close(SHCodecs_Encoder *enc);
+int encoder_scene_begin_frame(SHCodecs_Encoder *enc, const unsigned char *py);
+void encoder_scene_end_frame(SHCodecs_Encoder *enc);
+int encoder_scene_skip(SHCodecs_Encoder *enc, void *py, void *pc);
+void encoder_frame_encoded(SHCodecs_Encoder *enc, int keyframe, long bytes);
+double encoder_now_ms(void);
+void encoder_stats_begin(SHCodecs_Encoder *enc);
+void encoder_stats_lock(SHCodecs_Encoder *enc);
+void encoder_stats_slice(SHCodecs_Encoder *enc, SHCodecs_Picture_Type pic_type,
+			 long bits, long quant, long nr_mbs);
+int encoder_stats_end(SHCodecs_Encoder *enc);
+
 int h264_encode_init  (SHCodecs_Encoder * encoder);
 void h264_encode_close(SHCodecs_Encoder *encoder);
-int h264_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc, void *user_data);
+int h264_encode_defaults(SHCodecs_Encoder *encoder);
+int h264_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc,
+		       void *user_data, SHCodecs_Timestamp ts);
 int h264_encode_finish (SHCodecs_Encoder *enc);
 int h264_encode_run (SHCodecs_Encoder * encoder);
 
 int mpeg4_encode_init (SHCodecs_Encoder * encoder);
-int mpeg4_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc, void *user_data);
+void mpeg4_encode_close(SHCodecs_Encoder *encoder);
+void mpeg4_encode_reset(SHCodecs_Encoder *encoder);
+int mpeg4_nr_b_vops(SHCodecs_Encoder *encoder);
+int mpeg4_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc,
+			void *user_data, SHCodecs_Timestamp ts);
 int mpeg4_encode_finish (SHCodecs_Encoder *enc);
 int mpeg4_encode_run (SHCodecs_Encoder * encoder);
 
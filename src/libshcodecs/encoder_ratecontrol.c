@@ -0,0 +1,245 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Lookahead rate control, layered over the middleware's rate control.
+ * Before each frame is encoded, its complexity is compared with that of
+ * the frames waiting to be encoded and of recent frames, and the bits
+ * output so far are compared with the target. The bitrate given to the
+ * middleware is scaled so that complex frames get more bits and the
+ * output converges on the target within about a second.
+ *
+ * Frames are analysed when they are submitted for asynchronous encoding,
+ * so that the frames in the submit queue form the lookahead; otherwise
+ * each frame is analysed just before it is encoded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "encoder_private.h"
+
+/* Weight of the moving average of past complexity against one frame */
+#define RC_HISTORY_WEIGHT 4
+
+/* Limits of the bits of a frame relative to the average */
+#define RC_MIN_SCALE 0.25
+#define RC_MAX_SCALE 2.0
+
+/* Minimum relative change worth giving to the middleware */
+#define RC_HYSTERESIS 0.03
+
+/**
+ * Enable the lookahead rate controller.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param enable 1 to enable, 0 to disable
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, encoding has started, or out of memory
+ */
+int
+shcodecs_encoder_set_lookahead_rate_control(SHCodecs_Encoder * encoder, int enable)
+{
+	struct encoder_rc *rc;
+
+	if (encoder == NULL || encoder->initialized >= 2) return -1;
+
+	if (!enable) {
+		encoder_rc_close(encoder);
+		return 0;
+	}
+
+	if (encoder->rc)
+		return 0;
+
+	rc = calloc(1, sizeof(*rc));
+	if (rc == NULL)
+		return -1;
+
+	rc->prev = malloc(encoder_analysis_size(encoder));
+	if (rc->prev == NULL) {
+		free(rc);
+		return -1;
+	}
+	rc->scale = 1.0;
+
+	/* The bitrate is changed while encoding */
+	if (encoder->format == SHCodecs_Format_H264)
+		encoder->other_options_h264.avcbe_param_changeable = AVCBE_ON;
+	else
+		encoder->other_options_mpeg4.avcbe_param_changeable = AVCBE_ON;
+
+	encoder->rc = rc;
+
+	return 0;
+}
+
+void
+encoder_rc_close(SHCodecs_Encoder *enc)
+{
+	if (enc->rc) {
+		free(enc->rc->prev);
+		free(enc->rc);
+		enc->rc = NULL;
+	}
+}
+
+static unsigned long
+rc_analyse(SHCodecs_Encoder *enc, const unsigned char *py)
+{
+	struct encoder_rc *rc = enc->rc;
+	struct frame_complexity fc;
+
+	encoder_analyse_frame(enc, py, rc->prev, rc->have_prev, &fc);
+	rc->have_prev = 1;
+
+	return fc.cost;
+}
+
+/* Analyse a frame queued for encoding. Frames must be analysed in the
+ * order in which they are input. */
+void
+encoder_rc_analyse(SHCodecs_Encoder *enc, const unsigned char *py)
+{
+	struct encoder_rc *rc = enc->rc;
+	unsigned long cost;
+	int i;
+
+	cost = rc_analyse(enc, py);
+
+	pthread_mutex_lock(&enc->change_mutex);
+	if (rc->nr_lookahead < RC_MAX_LOOKAHEAD) {
+		i = (rc->la_head + rc->nr_lookahead) % RC_MAX_LOOKAHEAD;
+		rc->lookahead[i] = cost;
+		rc->nr_lookahead++;
+	}
+	pthread_mutex_unlock(&enc->change_mutex);
+}
+
+/* Get the complexity of an input frame, from the lookahead if it was
+ * analysed when submitted. Called for each input in submission order. */
+unsigned long
+encoder_rc_frame_cost(SHCodecs_Encoder *enc, const unsigned char *py)
+{
+	struct encoder_rc *rc = enc->rc;
+	unsigned long cost;
+
+	pthread_mutex_lock(&enc->change_mutex);
+	if (rc->nr_lookahead == 0) {
+		pthread_mutex_unlock(&enc->change_mutex);
+		return rc_analyse(enc, py);
+	}
+
+	cost = rc->lookahead[rc->la_head];
+	rc->la_head = (rc->la_head + 1) % RC_MAX_LOOKAHEAD;
+	rc->nr_lookahead--;
+	pthread_mutex_unlock(&enc->change_mutex);
+
+	return cost;
+}
+
+/* Choose the bitrate scale for the frame about to be encoded, of
+ * complexity cost. MPEG-4 B-VOPs are encoded after the anchor VOP that
+ * follows them, so this is called in encoding order, not input order. */
+void
+encoder_rc_begin_frame(SHCodecs_Encoder *enc, unsigned long cost)
+{
+	struct encoder_rc *rc = enc->rc;
+	double sum, avg, weight, fps, target, scale;
+	int i, n;
+
+	pthread_mutex_lock(&enc->change_mutex);
+	rc->cost = cost;
+
+	/* Average complexity of this frame, the lookahead and the past */
+	sum = rc->cost;
+	n = rc->nr_lookahead;
+	for (i=0; i<n; i++)
+		sum += rc->lookahead[(rc->la_head + i) % RC_MAX_LOOKAHEAD];
+	if (rc->nr_frames > 0)
+		avg = (rc->avg_cost * RC_HISTORY_WEIGHT + sum) / (RC_HISTORY_WEIGHT + 1 + n);
+	else
+		avg = sum / (1 + n);
+
+	/* Bits grow more slowly than complexity at a given quality */
+	weight = 1.0;
+	if (avg > 0)
+		weight = sqrt(rc->cost / avg);
+
+	/* Repay the bits above the target over about a second */
+	fps = enc->actual_fps_x10 / 10.0;
+	rc->target_bits = enc->actual_bitrate / fps;
+	target = rc->target_bits * weight - rc->fullness / fps;
+
+	scale = target / rc->target_bits;
+	if (scale < RC_MIN_SCALE)
+		scale = RC_MIN_SCALE;
+	if (scale > RC_MAX_SCALE)
+		scale = RC_MAX_SCALE;
+
+	if (fabs(scale - rc->scale) > RC_HYSTERESIS * rc->scale) {
+		rc->scale = scale;
+		rc->scale_pending = 1;
+	}
+	pthread_mutex_unlock(&enc->change_mutex);
+}
+
+/* Account for the bits of the frame just encoded */
+void
+encoder_rc_end_frame(SHCodecs_Encoder *enc)
+{
+	struct encoder_rc *rc = enc->rc;
+	double limit = enc->actual_bitrate;
+
+	rc->fullness += enc->frame_stats.bits - rc->target_bits;
+	if (rc->fullness > limit)
+		rc->fullness = limit;
+	if (rc->fullness < -limit)
+		rc->fullness = -limit;
+
+	if (rc->nr_frames == 0)
+		rc->avg_cost = rc->cost;
+	else
+		rc->avg_cost += (rc->cost - rc->avg_cost) / RC_HISTORY_WEIGHT;
+	rc->nr_frames++;
+}
+
+/* Get the bitrate scale for the middleware, with change_mutex held.
+ * Returns 1 if the scale has changed since it was last got, else 0. */
+int
+encoder_rc_scale(SHCodecs_Encoder *enc, double *scale)
+{
+	struct encoder_rc *rc = enc->rc;
+	int pending;
+
+	if (rc == NULL) {
+		*scale = 1.0;
+		return 0;
+	}
+
+	pending = rc->scale_pending;
+	rc->scale_pending = 0;
+	*scale = rc->scale;
+
+	return pending;
+}
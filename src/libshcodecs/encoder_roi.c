@@ -0,0 +1,229 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Region of interest quality maps. A map of quantizer offsets per
+ * macroblock is converted to the middleware's user weighted-Q table, in
+ * which each macroblock selects one of up to three weights by setting the
+ * corresponding bit. New maps are staged under change_mutex and given to
+ * the middleware before the next frame is encoded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoder_private.h"
+
+static int
+roi_nr_mbs(SHCodecs_Encoder *enc)
+{
+	return (ROUND_UP_16(enc->width) / 16) * (ROUND_UP_16(enc->height) / 16);
+}
+
+/* The weighted-Q mode is part of the encoding property, so it can only be
+ * selected before the middleware is initialized */
+static int
+roi_select_mode(SHCodecs_Encoder *enc)
+{
+	if (enc->initialized < 2) {
+		enc->encoding_property.avcbe_weightedQ_mode = AVCBE_WEIGHTEDQ_BY_USER;
+		return 0;
+	}
+
+	if (enc->encoding_property.avcbe_weightedQ_mode != AVCBE_WEIGHTEDQ_BY_USER)
+		return -1;
+
+	return 0;
+}
+
+/* Stage a map of quantizer offsets, one per macroblock */
+static int
+roi_stage(SHCodecs_Encoder *enc, const signed char *map)
+{
+	long levels[MAX_ROI_LEVELS];
+	int nr_levels = 0;
+	int nr_mbs = roi_nr_mbs(enc);
+	int i, j;
+
+	if (roi_select_mode(enc) < 0)
+		return -1;
+
+	if (!enc->roi_pending_table) {
+		enc->roi_table = calloc(nr_mbs, 1);
+		enc->roi_pending_table = calloc(nr_mbs, 1);
+		if (!enc->roi_table || !enc->roi_pending_table) {
+			free(enc->roi_table);
+			free(enc->roi_pending_table);
+			enc->roi_table = NULL;
+			enc->roi_pending_table = NULL;
+			return -1;
+		}
+	}
+
+	/* Find the distinct offsets before touching the pending table */
+	for (i=0; map && i<nr_mbs; i++) {
+		if (map[i] == 0)
+			continue;
+		for (j=0; j<nr_levels; j++) {
+			if (levels[j] == map[i])
+				break;
+		}
+		if (j == nr_levels) {
+			if (nr_levels == MAX_ROI_LEVELS)
+				return -1;
+			levels[nr_levels++] = map[i];
+		}
+	}
+
+	pthread_mutex_lock(&enc->change_mutex);
+	for (i=0; i<nr_mbs; i++) {
+		enc->roi_pending_table[i] = 0;
+		if (!map || map[i] == 0)
+			continue;
+		for (j=0; levels[j] != map[i]; j++);
+		enc->roi_pending_table[i] = 1 << j;
+	}
+	memcpy(enc->roi_levels, levels, sizeof(levels));
+	enc->roi_nr_levels = nr_levels;
+	enc->roi_pending = 1;
+	pthread_mutex_unlock(&enc->change_mutex);
+
+	return 0;
+}
+
+/**
+ * Set a quantizer offset for each macroblock of the following frames.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param map One offset per macroblock in raster order, or NULL to clear
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, too many distinct offsets, the mode
+ * could not be selected, or out of memory
+ */
+int
+shcodecs_encoder_set_qp_offset_map(SHCodecs_Encoder * encoder,
+				   const signed char *map)
+{
+	if (encoder == NULL) return -1;
+
+	return roi_stage(encoder, map);
+}
+
+/**
+ * Set regions of interest for the following frames.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param rois The regions, or NULL to clear
+ * \param nr_rois The number of regions
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, too many distinct offsets, the mode
+ * could not be selected, or out of memory
+ */
+int
+shcodecs_encoder_set_roi(SHCodecs_Encoder * encoder,
+			 const SHCodecs_Encoder_ROI *rois, int nr_rois)
+{
+	signed char *map;
+	int mb_width, mb_height;
+	int left, top, right, bottom;
+	int i, x, y, ret;
+
+	if (encoder == NULL || nr_rois < 0) return -1;
+
+	if (rois == NULL || nr_rois == 0)
+		return roi_stage(encoder, NULL);
+
+	mb_width = ROUND_UP_16(encoder->width) / 16;
+	mb_height = ROUND_UP_16(encoder->height) / 16;
+
+	map = calloc(mb_width * mb_height, 1);
+	if (!map)
+		return -1;
+
+	/* Later regions take precedence where regions overlap */
+	for (i=0; i<nr_rois; i++) {
+		left = rois[i].x / 16;
+		top = rois[i].y / 16;
+		right = (rois[i].x + rois[i].width + 15) / 16;
+		bottom = (rois[i].y + rois[i].height + 15) / 16;
+		if (left < 0) left = 0;
+		if (top < 0) top = 0;
+		if (right > mb_width) right = mb_width;
+		if (bottom > mb_height) bottom = mb_height;
+
+		for (y=top; y<bottom; y++) {
+			for (x=left; x<right; x++)
+				map[y*mb_width + x] = rois[i].qp_offset;
+		}
+	}
+
+	ret = roi_stage(encoder, map);
+	free(map);
+
+	return ret;
+}
+
+/* Give a pending quality map to the middleware. Called by
+ * encoder_apply_changes() with the VPU locked.
+ * Returns 0 on success, or a middleware error code. */
+long
+encoder_apply_roi(SHCodecs_Encoder *enc)
+{
+	TAVCBE_WEIGHTEDQ_USER *user = &enc->other_API_enc_param.weightedQ_info_user;
+	long *modes[MAX_ROI_LEVELS] = {
+		&user->avcbe_mode_for_bit1,
+		&user->avcbe_mode_for_bit2,
+		&user->avcbe_mode_for_bit3
+	};
+	long *weights[MAX_ROI_LEVELS] = {
+		&user->avcbe_Qweight_for_bit1,
+		&user->avcbe_Qweight_for_bit2,
+		&user->avcbe_Qweight_for_bit3
+	};
+	int nr_mbs = roi_nr_mbs(enc);
+	int i;
+
+	pthread_mutex_lock(&enc->change_mutex);
+	if (!enc->roi_pending) {
+		pthread_mutex_unlock(&enc->change_mutex);
+		return 0;
+	}
+	enc->roi_pending = 0;
+
+	memcpy(enc->roi_table, enc->roi_pending_table, nr_mbs);
+
+	memset(user, 0, sizeof(*user));
+	for (i=0; i<enc->roi_nr_levels; i++) {
+		*modes[i] = AVCBE_ON;
+		*weights[i] = enc->roi_levels[i];
+	}
+	user->avcbe_MB_table = enc->roi_table;
+	user->avcbe_num_of_MB_table = nr_mbs;
+
+	if (enc->roi_nr_levels > 0)
+		enc->other_API_enc_param.weightdQ_enable = AVCBE_ON;
+	else
+		enc->other_API_enc_param.weightdQ_enable = AVCBE_OFF;
+	pthread_mutex_unlock(&enc->change_mutex);
+
+	return avcbe_set_weightedQ(enc->stream_info,
+				   enc->other_API_enc_param.weightdQ_enable, user);
+}
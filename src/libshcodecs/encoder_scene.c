@@ -0,0 +1,235 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Scene analysis. Before each frame is encoded, its decimated luma is
+ * compared with that of the last frame passed on to the VPU. A large
+ * change in the luma histogram, where the previous frame also predicts
+ * the new one worse than intra coding would, is taken as a scene cut and
+ * a keyframe is forced. A frame with no block noticeably different from
+ * the last frame passed on is static, and is skipped in the same way as
+ * a frame skipped by the VPU's rate control. As skipped frames are not
+ * compared with each other, a slow change still gets encoded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoder_private.h"
+
+/* A static frame differs from the last frame passed on by at most this
+   much per decimated sample on average, and in any block of 16 samples */
+#define SCENE_STATIC_SAD 2
+#define SCENE_STATIC_BLOCK_SAD 96
+
+/* Weight of the moving averages of inter frames against one frame */
+#define SCENE_HISTORY_WEIGHT 8
+
+/**
+ * Enable scene analysis.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param cut_percent Histogram change for a scene cut, or 0
+ * \param max_static_skip Most static frames to skip in a row, or 0
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, encoding has started, or out of memory
+ */
+int
+shcodecs_encoder_set_scene_analysis(SHCodecs_Encoder * encoder,
+				    int cut_percent, int max_static_skip)
+{
+	struct encoder_scene *sc;
+	int size;
+
+	if (encoder == NULL || encoder->initialized >= 2) return -1;
+	if (cut_percent < 0 || cut_percent > 100 || max_static_skip < 0) return -1;
+
+	if (cut_percent == 0 && max_static_skip == 0) {
+		encoder_scene_close(encoder);
+		return 0;
+	}
+
+	sc = encoder->scene;
+	if (sc == NULL) {
+		sc = calloc(1, sizeof(*sc));
+		if (sc == NULL)
+			return -1;
+
+		size = encoder_analysis_size(encoder);
+		sc->ref = calloc(1, size);
+		sc->cur = calloc(1, size);
+		if (sc->ref == NULL || sc->cur == NULL) {
+			free(sc->ref);
+			free(sc->cur);
+			free(sc);
+			return -1;
+		}
+		encoder->scene = sc;
+	}
+
+	sc->cut_percent = cut_percent;
+	sc->max_skip = max_static_skip;
+
+	return 0;
+}
+
+/**
+ * Get scene analysis statistics.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param stats Returns the statistics
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or scene analysis is not enabled
+ */
+int
+shcodecs_encoder_get_scene_stats(SHCodecs_Encoder * encoder,
+				 SHCodecs_Encoder_Scene_Stats * stats)
+{
+	if (encoder == NULL || stats == NULL || encoder->scene == NULL) return -1;
+
+	pthread_mutex_lock(&encoder->change_mutex);
+	*stats = encoder->scene->stats;
+	pthread_mutex_unlock(&encoder->change_mutex);
+
+	return 0;
+}
+
+void
+encoder_scene_close(SHCodecs_Encoder *enc)
+{
+	if (enc->scene) {
+		free(enc->scene->ref);
+		free(enc->scene->cur);
+		free(enc->scene);
+		enc->scene = NULL;
+	}
+}
+
+/* Analyse the frame about to be encoded, forcing a keyframe at a scene
+ * cut. Returns 1 if the frame is static and should be skipped, else 0. */
+int
+encoder_scene_begin_frame(SHCodecs_Encoder *enc, const unsigned char *py)
+{
+	struct encoder_scene *sc = enc->scene;
+	struct frame_complexity fc;
+	unsigned long hist[SCENE_HIST_BINS];
+	unsigned long change = 0;
+	unsigned char *tmp;
+	int i, size, cut = 0, skip = 0;
+
+	/* The analysis replaces the previous samples with the new ones */
+	size = encoder_analysis_size(enc);
+	memcpy(sc->cur, sc->ref, size);
+	encoder_analyse_frame(enc, py, sc->cur, sc->have_ref, &fc);
+
+	memset(hist, 0, sizeof(hist));
+	for (i=0; i<size; i++)
+		hist[sc->cur[i] * SCENE_HIST_BINS / 256]++;
+
+	if (sc->have_ref) {
+		for (i=0; i<SCENE_HIST_BINS; i++) {
+			if (hist[i] > sc->hist[i])
+				change += hist[i] - sc->hist[i];
+			else
+				change += sc->hist[i] - hist[i];
+		}
+
+		/* Each sample that moves bin changes two bins */
+		if (sc->cut_percent > 0 && fc.inter > fc.intra &&
+		    change * 100 >= (unsigned long)size * 2 * sc->cut_percent) {
+			cut = 1;
+		} else if (sc->nr_skipped < sc->max_skip &&
+			   fc.inter <= (unsigned long)fc.nr_blocks * 16 * SCENE_STATIC_SAD &&
+			   fc.max_inter <= SCENE_STATIC_BLOCK_SAD &&
+			   encoder_get_set_intra(enc) == AVCBE_ANY_VOP) {
+			skip = 1;
+		}
+	}
+
+	pthread_mutex_lock(&enc->change_mutex);
+	sc->stats.nr_frames++;
+	if (skip) {
+		sc->stats.nr_static_skipped++;
+		sc->stats.bits_saved += sc->avg_bits;
+		sc->stats.vpu_ms_saved += sc->avg_vpu_ms;
+	}
+	if (cut) {
+		sc->stats.nr_scene_cuts++;
+		if (enc->format == SHCodecs_Format_H264)
+			enc->set_intra = AVCBE_FORCE_IDR_VOP;
+		else
+			enc->set_intra = AVCBE_FORCE_I_VOP;
+	}
+	pthread_mutex_unlock(&enc->change_mutex);
+
+	if (skip) {
+		sc->nr_skipped++;
+		return 1;
+	}
+
+	/* The frame will be encoded, so later frames are compared with it */
+	tmp = sc->ref;
+	sc->ref = sc->cur;
+	sc->cur = tmp;
+	memcpy(sc->hist, hist, sizeof(hist));
+	sc->have_ref = 1;
+	sc->nr_skipped = 0;
+
+	return 0;
+}
+
+/* Skip a static input frame, as if the VPU had skipped it. Returns the
+ * value returned by the frame statistics callback. */
+int
+encoder_scene_skip(SHCodecs_Encoder *enc, void *py, void *pc)
+{
+	encoder_skip_frame(enc);
+	enc->frame_skip_num++;
+	enc->frame_stats.skipped = 1;
+
+	encoder_release_input(enc, py, pc);
+
+	if (enc->rc)
+		encoder_rc_end_frame(enc);
+
+	return encoder_stats_end(enc);
+}
+
+/* Account for the frame just encoded or skipped, from encoder_stats_end() */
+void
+encoder_scene_end_frame(SHCodecs_Encoder *enc)
+{
+	struct encoder_scene *sc = enc->scene;
+	SHCodecs_Encoder_Frame_Stats *stats = &enc->frame_stats;
+
+	/* A skipped static frame would have been an inter frame */
+	if (stats->skipped || stats->pic_type == SHCodecs_Picture_IDR ||
+	    stats->pic_type == SHCodecs_Picture_I)
+		return;
+
+	if (sc->avg_bits == 0) {
+		sc->avg_bits = stats->bits;
+		sc->avg_vpu_ms = stats->vpu_ms;
+	} else {
+		sc->avg_bits += (stats->bits - sc->avg_bits) / SCENE_HISTORY_WEIGHT;
+		sc->avg_vpu_ms += (stats->vpu_ms - sc->avg_vpu_ms) / SCENE_HISTORY_WEIGHT;
+	}
+}
@@ -0,0 +1,97 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * H.263 reserves the sample values 0 and 255. The SH-4 has no SIMD unit,
+ * so samples are clipped four at a time within 32-bit words: the bytes of
+ * a word that are 0x00 (or, inverted, 0xFF) are found without carries
+ * between bytes, and only those bytes are changed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+
+#include "h263_clip.h"
+
+#define LOW7  0x7F7F7F7FUL
+#define HIGH1 0x80808080UL
+
+/* High bit set in each byte of w that is zero */
+#define ZERO_BYTES(w) (~((((w) & LOW7) + LOW7) | (w)) & HIGH1)
+
+static int
+clip_bytes(unsigned char *dst, const unsigned char *src, unsigned long count)
+{
+	int clipped = 0;
+	unsigned char s;
+
+	while (count--) {
+		s = *src++;
+		if (s < 1) {
+			s = 1;
+			clipped = 1;
+		} else if (s > 254) {
+			s = 254;
+			clipped = 1;
+		}
+		*dst++ = s;
+	}
+
+	return clipped;
+}
+
+int
+h263_clip(unsigned char *dst, const unsigned char *src, unsigned long count)
+{
+	const uint32_t *s;
+	uint32_t *d;
+	uint32_t w, zero, full, any = 0;
+	unsigned long head, n;
+	int clipped = 0;
+
+	/* Word-wide access needs dst and src to be equally aligned */
+	if (((uintptr_t)dst ^ (uintptr_t)src) & 3)
+		return clip_bytes(dst, src, count);
+
+	head = (4 - ((uintptr_t)dst & 3)) & 3;
+	if (head > count)
+		head = count;
+	clipped = clip_bytes(dst, src, head);
+	dst += head;
+	src += head;
+	count -= head;
+
+	s = (const uint32_t *)src;
+	d = (uint32_t *)dst;
+	for (n = count / 4; n > 0; n--) {
+		w = *s++;
+		zero = ZERO_BYTES(w);
+		full = ZERO_BYTES(~w);
+		*d++ = (w | (zero >> 7)) & ~(full >> 7);
+		any |= zero | full;
+	}
+
+	if (any)
+		clipped = 1;
+
+	return clip_bytes((unsigned char *)d, (const unsigned char *)s, count & 3) | clipped;
+}
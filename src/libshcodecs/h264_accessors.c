@@ -1784,3 +1784,48 @@ shcodecs_encoder_set_h264_constrained_intra_pred(SHCodecs_Encoder *
 
 	return old_value;
 }
+
+/**
+* Get the number of reference frames for H.264 P pictures.
+* \param encoder The SHCodecs_Encoder* handle
+* \returns The h264_ref_frames
+* \retval -1 \a encoder invalid
+*/
+unsigned long
+shcodecs_encoder_get_h264_ref_frames(SHCodecs_Encoder * encoder)
+{
+	if (encoder == NULL)
+		return -1;
+
+	return encoder->h264_ref_frames;
+}
+
+/**
+* Set the number of reference frames for H.264 P pictures, before
+* encoding starts.
+* \param encoder The SHCodecs_Encoder* handle
+* \param h264_ref_frames The new value for \a h264_ref_frames, 1 or 2
+* \returns The previous value of \a h264_ref_frames
+* \retval -1 \a encoder invalid, \a h264_ref_frames out of range,
+* or encoding has started
+*/
+unsigned long
+shcodecs_encoder_set_h264_ref_frames(SHCodecs_Encoder * encoder,
+				     unsigned long h264_ref_frames)
+{
+	unsigned long old_value;
+
+	if (encoder == NULL)
+		return -1;
+
+	if (h264_ref_frames < 1 || h264_ref_frames > MAX_NUM_REF_FRAMES)
+		return -1;
+
+	if (encoder->initialized >= 2)
+		return -1;
+
+	old_value = encoder->h264_ref_frames;
+	encoder->h264_ref_frames = h264_ref_frames;
+
+	return old_value;
+}
@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
 #include <sys/time.h>
@@ -93,12 +94,92 @@ static const char*data_name[] =
 	{"SEI", "SPS", "PPS", "AUD", "I", "P", "FILL", "END"};
 #endif
 
+static SHCodecs_Picture_Type
+h264_picture_type(long pic_type)
+{
+	if (pic_type == AVCBE_IDR_PIC)
+		return SHCodecs_Picture_IDR;
+	else if (pic_type == AVCBE_I_PIC)
+		return SHCodecs_Picture_I;
+	else
+		return SHCodecs_Picture_P;
+}
+
+/* Offsets of NAL units kept in the same buffer for access unit output */
+#define AU_ALIGN(x) (((x) + 31) & ~31)
+
+/* Output the current access unit and start a new one */
+static int
+au_output(SHCodecs_Encoder *enc, SHCodecs_Picture_Type pic_type)
+{
+	int cb_ret;
+
+	enc->au_info.pic_type = pic_type;
+	enc->au_info.frame_number = enc->frm;
+	enc->au_info.timestamp = enc->frame_stats.timestamp;
+	enc->au_info.user_data = enc->frame_stats.user_data;
+
+	cb_ret = enc->au_output(enc, enc->au_iov, enc->au_nr_segments,
+				&enc->au_info, enc->au_output_user_data);
+
+	enc->au_nr_segments = 0;
+	memset(&enc->au_info, 0, sizeof(enc->au_info));
+	enc->au_stream_offset = 0;
+	enc->au_sei_offset = 0;
+
+	return cb_ret;
+}
+
+/* Add a NAL unit to the current access unit */
+static int
+au_add_segment(SHCodecs_Encoder *enc, int type, void *buf, long length)
+{
+	struct iovec *iov;
+
+	if (enc->au_nr_segments >= enc->au_max_segments)
+		return -1;
+
+	iov = &enc->au_iov[enc->au_nr_segments++];
+	iov->iov_base = buf;
+	iov->iov_len = length;
+
+	switch (type) {
+	case IDATA:
+	case PDATA:
+		enc->au_info.slice_bytes += length;
+		enc->au_info.nr_slices++;
+		/* Slices in application buffers take no space in our own */
+		if (buf == enc->stream_buff_info.buff_top + enc->au_stream_offset)
+			enc->au_stream_offset += AU_ALIGN(length);
+		break;
+	case SEI:
+		enc->au_info.header_bytes += length;
+		enc->au_sei_offset += AU_ALIGN(length);
+		break;
+	case END:
+		/* The end code is output on its own */
+		enc->au_info.header_bytes += length;
+		return au_output(enc, SHCodecs_Picture_End);
+	default:
+		enc->au_info.header_bytes += length;
+		break;
+	}
+
+	return 0;
+}
+
 static int
 output_data(SHCodecs_Encoder *enc, int type, void *buf, long length)
 {
 #ifdef OUTPUT_STREAM_INFO
 	fprintf (stderr, "output %s (%d bytes)\n", data_name[type], (int)length);
 #endif
+	if (type != END)
+		enc->frame_bytes += length;
+
+	if (enc->au_output)
+		return au_add_segment(enc, type, buf, length);
+
 	if (enc->output) {
 		return enc->output(enc, (unsigned char *)buf, length,
 				   enc->output_user_data);
@@ -108,11 +189,22 @@ output_data(SHCodecs_Encoder *enc, int type, void *buf, long length)
 }
 
 
+/* Output slice data, unless it has already gone to the slice callback */
+static int
+slice_data(SHCodecs_Encoder *enc, int type, void *buf, long length)
+{
+	if (enc->slice_output && !enc->au_output) {
+		enc->frame_bytes += length;
+		return 0;
+	}
+
+	return output_data(enc, type, buf, length);
+}
+
+
 int
 h264_encode_init (SHCodecs_Encoder *enc)
 {
-	long rc;
-
 	enc->error_return_code = 0;
 
 	/* Access Unit Delimiter (AUD) output buffer */
@@ -139,7 +231,19 @@ h264_encode_init (SHCodecs_Encoder *enc)
 	if (!enc->sei_buf_info.buff_top)
 		goto err;
 
-	/* Set default values for the parameters */
+	return 0;
+
+err:
+	h264_encode_close(enc);
+	return -1;
+}
+
+/* Set default values for the parameters of a new stream */
+int
+h264_encode_defaults(SHCodecs_Encoder *enc)
+{
+	long rc;
+
 	m4iph_vpu_lock(enc->vpu);
 	rc = avcbe_set_default_param(AVCBE_H264, AVCBE_RATE_NO_SKIP,
 				    &(enc->encoding_property),
@@ -150,11 +254,20 @@ h264_encode_init (SHCodecs_Encoder *enc)
 	if (rc != 0)
 		return vpu_err(enc, __func__, __LINE__, rc);
 
+	enc->h264_ref_frames = 1;
+
 	return 0;
+}
 
-err:
-	h264_encode_close(enc);
-	return -1;
+/* Allocate the local frames for the references before encoding starts,
+ * outside the VPU lock */
+static int
+h264_alloc_local_frames(SHCodecs_Encoder *enc)
+{
+	if (enc->initialized >= 2)
+		return 0;
+
+	return encoder_alloc_local_frames(enc, enc->h264_ref_frames);
 }
 
 static int
@@ -166,16 +279,9 @@ h264_encode_deferred_init(SHCodecs_Encoder *enc)
 	/* Initialize VPU parameters & local frame memory */
 	options = &enc->other_options_h264;
 
-	enc->encoding_property.avcbe_bitrate = enc->actual_bitrate;
-	enc->encoding_property.avcbe_frame_rate = enc->actual_fps_x10;
-
 	/* Handle framerates > 30fps */
-	if (enc->actual_fps_x10 > 300) {
-		/* Use a framerate that is acceptable to the Middleware & adjust the
-		   bitrate accordingly */
-		enc->encoding_property.avcbe_frame_rate = 300;
-		enc->encoding_property.avcbe_bitrate = enc->actual_bitrate * 300 / enc->actual_fps_x10;
-	}
+	encoder_middleware_rate(enc, &enc->encoding_property.avcbe_bitrate,
+				&enc->encoding_property.avcbe_frame_rate);
 	/* Assume frame rate is same as frame number resolution */
 	enc->encoding_property.avcbe_frame_num_resolution = enc->encoding_property.avcbe_frame_rate / 10;
 
@@ -194,9 +300,13 @@ h264_encode_deferred_init(SHCodecs_Encoder *enc)
 	if (rc < 0)
 		return vpu_err(enc, __func__, __LINE__, rc);
 
+	/* Allocated by h264_alloc_local_frames() before locking the VPU */
+	if (enc->nr_local_frames < enc->h264_ref_frames+1)
+		return -1;
+
 	rc = avcbe_init_memory(enc->stream_info,
-				MAX_NUM_REF_FRAMES,
-				NUM_LDEC_FRAMES, enc->local_frames,
+				enc->h264_ref_frames,
+				enc->h264_ref_frames+1, enc->local_frames,
 				ROUND_UP_16(enc->width), ROUND_UP_16(enc->height));
 	if (rc != 0)
 		return vpu_err(enc, __func__, __LINE__, rc);
@@ -244,6 +354,7 @@ h264_encode_close(SHCodecs_Encoder *enc)
 	free(enc->sps_buf_info.buff_top);
 	free(enc->pps_buf_info.buff_top);
 	free(enc->sei_buf_info.buff_top);
+	free(enc->au_iov);
 }
 
 /* returns 0 on success */
@@ -256,6 +367,7 @@ h264_output_SEI_parameters(SHCodecs_Encoder *enc)
 	int num_sei_msgs;
 	int i;
 	int cb_ret;
+	TAVCBE_STREAM_BUFF sei_buff;
 
 	/* H.264 Spec: The buffer period SEI message is the first SEI NAL unit */
 	char sei_msg[] = {
@@ -286,15 +398,19 @@ h264_output_SEI_parameters(SHCodecs_Encoder *enc)
 	for (i=0; i<num_sei_msgs; i++)
 	{
 		if (sei_msg[i] == AVCBE_ON) {
+			/* Preceding SEI NAL units of an access unit are kept */
+			sei_buff.buff_top = enc->sei_buf_info.buff_top + enc->au_sei_offset;
+			sei_buff.buff_size = enc->sei_buf_info.buff_size - enc->au_sei_offset;
+
 			length = avcbe_put_SEI_parameters(
 						enc->stream_info,
 						sei_arg1[i],
 						sei_arg2[i],
-						&(enc->sei_buf_info));
+						&sei_buff);
 
 			if (length > 0) {
 				cb_ret = output_data(enc, SEI,
-							enc->sei_buf_info.buff_top, length);
+							sei_buff.buff_top, length);
 				if (cb_ret != 0)
 					return cb_ret;
 			} else {
@@ -341,6 +457,8 @@ shcodecs_encoder_get_h264_headers(SHCodecs_Encoder *enc, int *nr_nals, int **nal
 	avcbe_slice_stat slice_stat;
 
 	if (enc->initialized < 3) {
+		if (h264_alloc_local_frames(enc) < 0)
+			return -1;
 		m4iph_vpu_lock(enc->vpu);
 		rc = h264_encode_start(enc);
 		m4iph_vpu_unlock(enc->vpu);
@@ -390,6 +508,94 @@ shcodecs_encoder_get_h264_headers(SHCodecs_Encoder *enc, int *nr_nals, int **nal
 	return 0;
 }
 
+int
+shcodecs_encoder_set_slice_output_callback(SHCodecs_Encoder *enc,
+					   SHCodecs_Encoder_Slice_Output slice_output_cb,
+					   void *user_data)
+{
+	if (enc == NULL || enc->format != SHCodecs_Format_H264)
+		return -1;
+
+	enc->slice_output = slice_output_cb;
+	enc->slice_output_user_data = user_data;
+
+	return 0;
+}
+
+int
+shcodecs_encoder_set_max_slice_bytes(SHCodecs_Encoder *enc, int max_bytes)
+{
+	avcbe_other_options_h264 *options;
+
+	if (enc == NULL || enc->format != SHCodecs_Format_H264 || max_bytes < 0)
+		return -1;
+
+	if (enc->initialized >= 2)
+		return -1;
+
+	options = &enc->other_options_h264;
+
+	if (max_bytes > 0) {
+		options->avcbe_use_slice = AVCBE_ON;
+		options->avcbe_slice_size_mb = 0;
+		options->avcbe_slice_size_bit = max_bytes * 8;
+		/* Return from the middleware after each slice */
+		options->avcbe_call_unit = AVCBE_CALL_PER_NAL;
+	} else {
+		options->avcbe_use_slice = AVCBE_OFF;
+		options->avcbe_slice_size_mb = 0;
+		options->avcbe_slice_size_bit = 0;
+		options->avcbe_call_unit = AVCBE_CALL_PER_PIC;
+	}
+
+	return 0;
+}
+
+int
+shcodecs_encoder_set_au_output_callback(SHCodecs_Encoder *enc,
+					SHCodecs_Encoder_AU_Output au_output_cb,
+					void *user_data)
+{
+	struct iovec *iov;
+	unsigned char *buf;
+	unsigned long size;
+	int max_segments;
+
+	if (enc == NULL)
+		return -1;
+
+	/* MPEG-4 outputs each VOP as it is encoded */
+	if (au_output_cb && !enc->au_iov && enc->format == SHCodecs_Format_H264) {
+		/* A picture has at most one slice per macroblock, plus the AUD,
+		   SEI, SPS, PPS and filler NAL units */
+		max_segments = (ROUND_UP_16(enc->width) / 16) *
+			       (ROUND_UP_16(enc->height) / 16) + 16;
+		iov = calloc(max_segments, sizeof(struct iovec));
+
+		/* All slices of a picture are kept until the access unit is output */
+		size = enc->stream_buff_info.buff_size * 2;
+		buf = memalign(32, size);
+
+		if (!iov || !buf) {
+			free(iov);
+			free(buf);
+			return -1;
+		}
+
+		free(enc->stream_buff_info.buff_top);
+		enc->stream_buff_info.buff_top = buf;
+		enc->stream_buff_info.buff_size = size;
+
+		enc->au_iov = iov;
+		enc->au_max_segments = max_segments;
+	}
+
+	enc->au_output = au_output_cb;
+	enc->au_output_user_data = user_data;
+
+	return 0;
+}
+
 /* Get SPS & PPS data, and output it */
 static long
 h264_encode_sps_pps(SHCodecs_Encoder *enc, avcbe_slice_stat *slice_stat, long frm)
@@ -424,22 +630,33 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 	int start_of_frame;
 	long nal_size;
 	int cb_ret = 0;
+	TAVCBE_STREAM_BUFF stream_buff;
+	long set_intra;
+	SHCodecs_Encoder_Slice_Info slice_info;
+	double vpu_start;
 
 	start_of_frame = 1;
+	memset(&slice_info, 0, sizeof(slice_info));
 
 	input_buf.Y_fmemp = py;
 	input_buf.C_fmemp = pc;
 
-	if (enc->frame_counter != 0) {
-		/* Restore stream context */
+	if (enc->context_saved) {
+		/* Restore stream context, saved when another user took the VPU */
 		rc = avcbe_set_backup(enc->stream_info, &enc->backup_area);
 		if (rc != 0)
 			return vpu_err(enc, __func__, __LINE__, rc);
+		enc->context_saved = 0;
 	}
 
+	/* Apply bitrate and frame rate changes */
+	rc = encoder_apply_changes(enc);
+	if (rc != 0)
+		return vpu_err(enc, __func__, __LINE__, rc);
+
 	/* Specify the input frame address */
 	rc = avcbe_set_image_pointer(enc->stream_info,
-				    &input_buf, enc->ldec, enc->ref1, 0);
+				    &input_buf, enc->ldec, enc->ref1, enc->ref2);
 	if (rc != 0)
 		return vpu_err(enc, __func__, __LINE__, rc);
 
@@ -454,6 +671,9 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 	fprintf(stderr, "\nFrame %ld:\n", enc->frame_counter);
 #endif
 
+	/* Is a keyframe wanted? */
+	set_intra = encoder_get_set_intra(enc);
+
 	/* calculate the next timing need to reset rate control */
 	if (enc->bitrate_control_enabled && !enc->next_reset)
 		enc->next_reset = time(NULL) + enc->reset_interval;
@@ -464,18 +684,24 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 		/* Reset the amount of filler data used */
 		enc->output_filler_data = 0;
 
+		/* Preceding slices of an access unit are kept */
+		encoder_get_output_buffer(enc, enc->au_stream_offset, &stream_buff);
+
 		/* Encode the frame */
+		vpu_start = encoder_now_ms();
 		enc_rc = avcbe_encode_picture(enc->stream_info, enc->frm,
-					 AVCBE_ANY_VOP,
+					 set_intra,
 					 AVCBE_OUTPUT_SLICE,
-					 &enc->stream_buff_info,
+					 &stream_buff,
 					 &enc->aud_buf_info);
+		enc->frame_stats.vpu_ms += encoder_now_ms() - vpu_start;
 		if (enc_rc < 0)
 			return vpu_err(enc, __func__, __LINE__, enc_rc);
 		vpu_info_msg(enc, __func__, __LINE__, enc->frm, enc_rc);
 
 		if (enc_rc == AVCBE_FRAME_SKIPPED) {
 			enc->frame_skip_num++;
+			enc->frame_stats.skipped = 1;
 		}
 
 		if ((enc_rc == AVCBE_SLICE_REMAIN)
@@ -486,6 +712,11 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 			nal_size = (slice_stat.avcbe_encoded_slice_bits + 7) / 8;
 			pic_type = slice_stat.avcbe_encoded_pic_type;
 
+			encoder_stats_slice(enc, h264_picture_type(pic_type),
+					slice_stat.avcbe_encoded_slice_bits,
+					slice_stat.avcbe_quant,
+					slice_stat.avcbe_encoded_MB_num);
+
 			if (start_of_frame) {
 
 				/* output Access Unit Delimiter (AUD) */
@@ -525,16 +756,34 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 			}
 
 			/* Output slice data */
+			if (enc->slice_output) {
+				slice_info.pic_type = h264_picture_type(pic_type);
+				slice_info.frame_number = enc->frm;
+				slice_info.timestamp = enc->frame_stats.timestamp;
+				slice_info.user_data = enc->frame_stats.user_data;
+				slice_info.nr_mbs = slice_stat.avcbe_encoded_MB_num;
+				slice_info.last = (enc_rc == AVCBE_ENCODE_SUCCESS);
+
+				cb_ret = enc->slice_output(enc, stream_buff.buff_top,
+						nal_size, &slice_info,
+						enc->slice_output_user_data);
+				if (cb_ret != 0)
+					return cb_ret;
+
+				slice_info.index++;
+				slice_info.first_mb += slice_info.nr_mbs;
+			}
+
 			if ((pic_type == AVCBE_IDR_PIC)
 			    || (pic_type == AVCBE_I_PIC)) {
-				cb_ret = output_data(enc, IDATA,
-					enc->stream_buff_info.buff_top, nal_size);
+				cb_ret = slice_data(enc, IDATA,
+					stream_buff.buff_top, nal_size);
 				if (cb_ret != 0)
 					return cb_ret;
 				enc->next_idr = enc->idr_interval;
 			} else {
-				cb_ret = output_data(enc, PDATA,
-					enc->stream_buff_info.buff_top, nal_size);
+				cb_ret = slice_data(enc, PDATA,
+					stream_buff.buff_top, nal_size);
 				if (cb_ret != 0)
 					return cb_ret;
 			}
@@ -545,14 +794,18 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 
 		/* End of a frame? */
 		if (enc_rc == AVCBE_ENCODE_SUCCESS) {
-			/* Switch the indexes to the reference and locally decoded frames */
-			if (enc->ldec == 0) {
-				enc->ldec = 1;
-				enc->ref1 = 0;
-			} else {
-				enc->ldec = 0;
-				enc->ref1 = 1;
-			}
+			encoder_frame_encoded(enc, (pic_type == AVCBE_IDR_PIC)
+					|| (pic_type == AVCBE_I_PIC), enc->frame_bytes);
+			enc->frame_bytes = 0;
+
+			if (enc->au_output)
+				cb_ret = au_output(enc, h264_picture_type(pic_type));
+
+			/* The frame just decoded becomes the nearest reference,
+			   and the oldest local frame is decoded into next */
+			enc->ref2 = enc->ref1;
+			enc->ref1 = enc->ldec;
+			enc->ldec = (enc->ldec + 1) % (enc->h264_ref_frames + 1);
 		}
 
 		if ((enc_rc == AVCBE_FRAME_SKIPPED)
@@ -577,12 +830,8 @@ h264_encode_frame(SHCodecs_Encoder *enc, unsigned char *py, unsigned char *pc)
 
 	} /* while */
 
-	/* Save stream context */
-	rc = avcbe_get_backup(enc->stream_info, &enc->backup_area);
-	if (rc != 0)
-		return vpu_err(enc, __func__, __LINE__, rc);
-
-	return 0;
+	/* Access unit output callback return value */
+	return cb_ret;
 }
 
 static long
@@ -606,6 +855,7 @@ h264_encode_start(SHCodecs_Encoder *enc)
 
 	enc->ldec = 0;		/* Index number of the image-work-field area */
 	enc->ref1 = 0;
+	enc->ref2 = 0;
 	enc->frm = 0;		/* Frame number to be encoded */
 
 	enc->frame_counter = 0;
@@ -625,6 +875,10 @@ h264_encode_finish (SHCodecs_Encoder *enc)
 {
 	long rc, length;
 
+	/* The end code belongs to no input frame */
+	enc->frame_stats.timestamp = SHCODECS_TIMESTAMP_NONE;
+	enc->frame_stats.user_data = NULL;
+
 	m4iph_vpu_lock(enc->vpu);
 	length = avcbe_put_end_code(enc->stream_info, &enc->end_code_buff_info, AVCBE_END_OF_STRM);
 	m4iph_vpu_unlock(enc->vpu);
@@ -639,44 +893,66 @@ h264_encode_finish (SHCodecs_Encoder *enc)
 }
 
 int
-h264_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc, void *user_data)
+h264_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc,
+		   void *user_data, SHCodecs_Timestamp ts)
 {
 	void *phys_py = (void *)uiomux_all_virt_to_phys(py);
 	void *phys_pc = (void *)uiomux_all_virt_to_phys(pc);
-	int rc;
+	unsigned char *virt_py;
+	int rc, cb_ret;
+
+	encoder_stats_begin(enc);
+	enc->frame_stats.timestamp = ts;
+	enc->frame_stats.user_data = user_data;
+
+	if (enc->rc)
+		encoder_rc_begin_frame(enc, encoder_rc_frame_cost(enc, py));
 
 	enc->release_user_data_buffer = user_data;
 
+	if (enc->scene && encoder_scene_begin_frame(enc, py))
+		return encoder_scene_skip(enc, py, pc);
+
 	/* Can the buffers passed to us be used by the hardware? */
 	/* If not allocate buffer that we can use and copy the input */
 	if (!phys_py || !phys_pc) {
 		if (!enc->input_frame) {
-			enc->input_frame = m4iph_sdr_malloc(enc->vpu, enc->y_bytes*3/2, 32);
+			enc->input_frame = m4iph_sdr_malloc(enc->vpu, enc->alloc_y_bytes*3/2, 32);
 			if (!enc->input_frame)
 				return -1;
 		}
 		phys_py = enc->input_frame;
 		phys_pc = phys_py + enc->y_bytes;
-		m4iph_vpu_lock(enc->vpu);
-		m4iph_sdr_write(phys_py, py, enc->y_bytes);
-		m4iph_sdr_write(phys_pc, pc, enc->y_bytes/2);
-		m4iph_vpu_unlock(enc->vpu);
+		/* The local input frame is only read by the VPU while this
+		   encoder holds the lock, so it can be filled without it */
+		virt_py = m4iph_addr_to_virt(enc->vpu, phys_py);
+		memcpy(virt_py, py, enc->y_bytes);
+		memcpy(virt_py + enc->y_bytes, pc, enc->y_bytes/2);
 	}
 
 	if (enc->initialized < 3) {
-		m4iph_vpu_lock(enc->vpu);
+		if (h264_alloc_local_frames(enc) < 0)
+			return -1;
+		encoder_stats_lock(enc);
 		rc = h264_encode_start(enc);
 		m4iph_vpu_unlock(enc->vpu);
 		if (rc != 0)
 			return rc;
 	}
 
-	m4iph_vpu_lock(enc->vpu);
+	encoder_stats_lock(enc);
 	rc = h264_encode_frame(enc, phys_py, phys_pc);
 	m4iph_vpu_unlock(enc->vpu);
 
-	if (enc->release)
-		enc->release(enc, py, pc, enc->release_user_data);
+	encoder_release_input(enc, py, pc);
+
+	if (rc >= 0) {
+		if (enc->rc)
+			encoder_rc_end_frame(enc);
+		cb_ret = encoder_stats_end(enc);
+		if (rc == 0)
+			rc = cb_ret;
+	}
 
 	return rc;
 }
@@ -688,6 +964,8 @@ h264_encode_run (SHCodecs_Encoder *enc)
 	int cb_ret;
 
 	if (enc->initialized < 3) {
+		if (h264_alloc_local_frames(enc) < 0)
+			return -1;
 		m4iph_vpu_lock(enc->vpu);
 		rc = h264_encode_start(enc);
 		m4iph_vpu_unlock(enc->vpu);
@@ -709,7 +987,8 @@ h264_encode_run (SHCodecs_Encoder *enc)
 			}
 		}
 
-		rc = h264_encode_1frame(enc, enc->addr_y, enc->addr_c, NULL);
+		rc = h264_encode_1frame(enc, enc->addr_y, enc->addr_c, NULL,
+					encoder_take_input_timestamp(enc));
 		if (rc != 0)
 			return rc;
 	}
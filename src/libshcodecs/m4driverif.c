@@ -55,11 +55,33 @@ typedef struct _SHCodecs_vpu {
 	M4IPH_VPU4_INIT_OPTION params;
 	unsigned long work_buff_size;
 	void *work_buff;
+
+	/* Number of encoder instances sharing this VPU data */
+	int refcount;
 } SHCodecs_vpu;
 
 /* The current instance in use */
 static SHCodecs_vpu *current_vpu = NULL;
 
+/* The owner whose context is loaded in the middleware in this process,
+ * and how to save it before another user of the VPU changes it. Only
+ * accessed with the VPU locked. */
+static void *vpu_owner = NULL;
+static void (*vpu_owner_save)(void *owner);
+static SHCodecs_vpu *vpu_owner_vpu;
+
+static void release_owner(void)
+{
+	SHCodecs_vpu *vpu = current_vpu;
+
+	if (vpu_owner && vpu_owner_save) {
+		current_vpu = vpu_owner_vpu;
+		vpu_owner_save(vpu_owner);
+		current_vpu = vpu;
+	}
+	vpu_owner = NULL;
+}
+
 void *m4iph_vpu_open(int stream_buf_size)
 {
 	SHCodecs_vpu *vpu;
@@ -70,6 +92,7 @@ void *m4iph_vpu_open(int stream_buf_size)
 	vpu = calloc(1, sizeof(*vpu));
 	if (!vpu)
 		return NULL;
+	vpu->refcount = 1;
 
 	vpu->uiomux = uiomux_open_named(blocks);
 	if (!vpu->uiomux)
@@ -133,6 +156,9 @@ void m4iph_vpu_close(void *vpu_data)
 {
 	SHCodecs_vpu *vpu = (SHCodecs_vpu *)vpu_data;
 
+	if (vpu && --vpu->refcount > 0)
+		return;
+
 	if (vpu) {
 		if (vpu->uiomux)
 			uiomux_close(vpu->uiomux);
@@ -140,11 +166,50 @@ void m4iph_vpu_close(void *vpu_data)
 	}
 }
 
+/* Share an open instance; each reference is released with m4iph_vpu_close() */
+void *m4iph_vpu_ref(void *vpu_data)
+{
+	SHCodecs_vpu *vpu = (SHCodecs_vpu *)vpu_data;
+
+	vpu->refcount++;
+	return vpu;
+}
+
 void m4iph_vpu_lock(void *vpu_data)
 {
 	SHCodecs_vpu *vpu = (SHCodecs_vpu *)vpu_data;
 	uiomux_lock (vpu->uiomux, vpu->uiores);
 	current_vpu = vpu;
+
+	/* The middleware context may be changed */
+	release_owner();
+}
+
+/* Lock the VPU for owner. If another owner or any other user has had the
+ * VPU since owner last did, the context of the previous owner is saved
+ * first by calling its save function. */
+void m4iph_vpu_lock_owner(void *vpu_data, void *owner, void (*save)(void *owner))
+{
+	SHCodecs_vpu *vpu = (SHCodecs_vpu *)vpu_data;
+	uiomux_lock (vpu->uiomux, vpu->uiores);
+	current_vpu = vpu;
+
+	if (owner != vpu_owner) {
+		release_owner();
+		vpu_owner = owner;
+		vpu_owner_save = save;
+		vpu_owner_vpu = vpu;
+	}
+}
+
+/* Forget owner without saving its context, before it is freed */
+void m4iph_vpu_disown(void *vpu_data, void *owner)
+{
+	SHCodecs_vpu *vpu = (SHCodecs_vpu *)vpu_data;
+	uiomux_lock (vpu->uiomux, vpu->uiores);
+	if (vpu_owner == owner)
+		vpu_owner = NULL;
+	uiomux_unlock (vpu->uiomux, vpu->uiores);
 }
 
 void m4iph_vpu_unlock(void *vpu_data)
@@ -154,6 +219,13 @@ void m4iph_vpu_unlock(void *vpu_data)
 	uiomux_unlock (vpu->uiomux, vpu->uiores);
 }
 
+/* Make another instance current while the VPU is already locked, so that
+ * several instances can be driven within a single lock period. */
+void m4iph_vpu_switch(void *vpu_data)
+{
+	current_vpu = (SHCodecs_vpu *)vpu_data;
+}
+
 void m4iph_avcbd_perror(char *msg, int error)
 {
 	fprintf(stderr, "%s: ", msg);
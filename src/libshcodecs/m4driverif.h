@@ -38,9 +38,13 @@
 
 void *m4iph_vpu_open(int stream_buf_size);
 void m4iph_vpu_close(void *vpu_data);
+void *m4iph_vpu_ref(void *vpu_data);
 
 void m4iph_vpu_lock(void *vpu_data);
+void m4iph_vpu_lock_owner(void *vpu_data, void *owner, void (*save)(void *owner));
+void m4iph_vpu_disown(void *vpu_data, void *owner);
 void m4iph_vpu_unlock(void *vpu_data);
+void m4iph_vpu_switch(void *vpu_data);
 
 void *m4iph_sdr_malloc(void *vpu_data, unsigned long count, int align);
 void m4iph_sdr_free(void *vpu_data, void *address, unsigned long count);
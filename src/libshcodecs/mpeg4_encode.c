@@ -33,14 +33,12 @@
 
 #include "avcbe_inner.h"
 #include "QuantMatrix.h"
+#include "h263_clip.h"
 
 #include "encoder_private.h"
 
 #define OUTPUT_ERROR_MSGS
 
-/* BVOPs currently unsupported */
-/* #define USE_BVOP */
-
 #ifdef OUTPUT_ERROR_MSGS
 #define MSG_LEN 127
 static long
@@ -64,12 +62,42 @@ static const char*data_name[] =
 	{"SEI", "SPS", "PPS", "AUD", "I", "P", "B", "FILL", "END"};
 #endif
 
+/* Output a VOP, or the end code, as frame number frm in display order */
 static int
-output_data(SHCodecs_Encoder *enc, int type, void *buf, long length)
+output_data(SHCodecs_Encoder *enc, int type, long frm, void *buf, long length)
 {
+	SHCodecs_Encoder_AU_Info *info = &enc->au_info;
+	struct iovec iov;
+
 #ifdef OUTPUT_STREAM_INFO
 	fprintf (stderr, "output %s (%d bytes)\n", data_name[type], (int)length);
 #endif
+	if (enc->au_output) {
+		memset(info, 0, sizeof(*info));
+		if (type == IDATA)
+			info->pic_type = SHCodecs_Picture_I;
+		else if (type == PDATA)
+			info->pic_type = SHCodecs_Picture_P;
+		else if (type == BDATA)
+			info->pic_type = SHCodecs_Picture_B;
+		else
+			info->pic_type = SHCodecs_Picture_End;
+		info->frame_number = frm;
+		if (type == END) {
+			info->timestamp = SHCODECS_TIMESTAMP_NONE;
+			info->header_bytes = length;
+		} else {
+			info->timestamp = enc->frame_stats.timestamp;
+			info->user_data = enc->frame_stats.user_data;
+			info->slice_bytes = length;
+			info->nr_slices = 1;
+		}
+
+		iov.iov_base = buf;
+		iov.iov_len = length;
+		return enc->au_output(enc, &iov, 1, info, enc->au_output_user_data);
+	}
+
 	if (enc->output) {
 		return enc->output(enc,
 				(unsigned char *)buf, length,
@@ -174,22 +202,82 @@ mpeg4_encode_init (SHCodecs_Encoder *enc)
 	return 0;
 }
 
+/* Return any inputs still held for B-VOPs, dropping them from the stream */
+/* Release an input frame, and the encoder's copy of it */
+static void
+mpeg4_release_frame(SHCodecs_Encoder *enc, struct held_frame *frame)
+{
+	if (frame->copy >= 0)
+		enc->copy_in_use[frame->copy] = 0;
+	if (frame->y)
+		encoder_release_input(enc, frame->y, frame->c);
+}
+
+void
+mpeg4_encode_reset(SHCodecs_Encoder *enc)
+{
+	int i;
+
+	for (i=0; i<enc->nr_held; i++)
+		mpeg4_release_frame(enc, &enc->held[i]);
+	enc->nr_held = 0;
+
+	for (i=0; i<=MAX_B_VOPS; i++)
+		enc->copy_in_use[i] = 0;
+}
+
+void
+mpeg4_encode_close(SHCodecs_Encoder *enc)
+{
+	int i;
+
+	mpeg4_encode_reset(enc);
+
+	for (i=0; i<=MAX_B_VOPS; i++) {
+		if (enc->input_copies[i])
+			m4iph_sdr_free(enc->vpu, enc->input_copies[i], (enc->alloc_y_bytes*3)/2);
+	}
+}
+
+/* The number of B-VOPs between anchor VOPs */
+int
+mpeg4_nr_b_vops(SHCodecs_Encoder *enc)
+{
+	unsigned long nr_b_vops = enc->other_options_mpeg4.avcbe_b_vop_num;
+
+	if (enc->encoding_property.avcbe_stream_type == AVCBE_H263)
+		return 0;
+
+	if (nr_b_vops > MAX_B_VOPS)
+		nr_b_vops = MAX_B_VOPS;
+
+	return nr_b_vops;
+}
+
+/* Allocate the local frames for the references before encoding starts,
+ * outside the VPU lock */
+static int
+mpeg4_alloc_local_frames(SHCodecs_Encoder *enc)
+{
+	if (enc->initialized >= 2)
+		return 0;
+
+	return encoder_alloc_local_frames(enc, mpeg4_nr_b_vops(enc) > 0 ? 2 : 1);
+}
+
 static int
 mpeg4_encode_deferred_init(SHCodecs_Encoder *enc)
 {
 	long rc;
 	unsigned long nrefframe = 1;
 
-	enc->encoding_property.avcbe_bitrate = enc->actual_bitrate;
-	enc->encoding_property.avcbe_frame_rate = enc->actual_fps_x10;
+	/* B-VOPs are not part of H.263 */
+	enc->nr_b_vops = mpeg4_nr_b_vops(enc);
+	enc->other_options_mpeg4.avcbe_b_vop_num = enc->nr_b_vops;
 
 	/* Handle framerates > 30fps */
-	if (enc->actual_fps_x10 > 300) {
-		/* Use a framerate that is acceptable to the Middleware & adjust the
-		   bitrate accordingly */
-		enc->encoding_property.avcbe_frame_rate = 300;
-		enc->encoding_property.avcbe_bitrate = enc->actual_bitrate * enc->actual_fps_x10 / 300;
-	}
+	encoder_middleware_rate(enc, &enc->encoding_property.avcbe_bitrate,
+				&enc->encoding_property.avcbe_frame_rate);
 	/* Assume frame rate is same as frame number resolution */
 	enc->encoding_property.avcbe_frame_num_resolution = enc->encoding_property.avcbe_frame_rate / 10;
 
@@ -211,11 +299,12 @@ mpeg4_encode_deferred_init(SHCodecs_Encoder *enc)
 			return vpu_err(enc, __func__, __LINE__, rc);
 	}
 
-#ifdef USE_BVOP
-	if (enc->other_options_mpeg4.avcbe_b_vop_num > 0)
-		nrefframe = enc->other_options_mpeg4.avcbe_b_vop_num;
-//TODO	m4vse_output_local_image_of_b_vop = AVCBE_ON;
-#endif
+	/* B-VOPs refer to the anchor VOPs either side. The local frames are
+	   allocated by mpeg4_alloc_local_frames() before locking the VPU. */
+	if (enc->nr_b_vops > 0)
+		nrefframe = 2;
+	if (enc->nr_local_frames < (int)nrefframe+1)
+		return -1;
 
 	rc = avcbe_init_memory(enc->stream_info,
 				nrefframe,
@@ -229,188 +318,144 @@ mpeg4_encode_deferred_init(SHCodecs_Encoder *enc)
 	return 0;
 }
 
-static int
-clip_image_data_for_H263(SHCodecs_Encoder *enc,
-			 unsigned char *addr_y, unsigned char *addr_c)
+static SHCodecs_Picture_Type
+mpeg4_picture_type(long pic_type)
 {
-	long width, height, index;
-	unsigned char *YCbCr_ptr;
-	int return_value = 0;
-	unsigned char *addr_y_2, *addr_c_2;
-
-	width = enc->width;
-	height = enc->height;
-	addr_y_2 = malloc(width * height);
-	addr_c_2 = malloc(width * height / 2);
-	m4iph_sdr_read(addr_y, addr_y_2, width * height);
-
-	/* Clip Y-data */
-	YCbCr_ptr = addr_y_2;
-	for (index = 0; index < (width * height); index++) {
-		if ((*YCbCr_ptr) < 1) {
-			*YCbCr_ptr = 1;
-			return_value = 1;	/* clipped */
-		} else if ((*YCbCr_ptr) > 254) {
-			*YCbCr_ptr = 254;
-			return_value = 1;	/* clipped */
-		}
-		YCbCr_ptr++;
-	}
-	m4iph_sdr_write(addr_y, addr_y_2, width * height);
-
-	/* Clip Cb-data, Cr-data */
-	m4iph_sdr_read(addr_c, addr_c_2, width * height / 2);
-	YCbCr_ptr = addr_c_2;
-	for (index = 0; index < ((width * height) / 2); index++) {
-		if ((*YCbCr_ptr) < 1) {
-			*YCbCr_ptr = 1;
-			return_value = 1;	/* clipped */
-		} else if ((*YCbCr_ptr) > 254) {
-			*YCbCr_ptr = 254;
-			return_value = 1;	/* clipped */
-		}
-		YCbCr_ptr++;
+	if (pic_type == AVCBE_I_VOP)
+		return SHCodecs_Picture_I;
+	else if (pic_type == AVCBE_P_VOP)
+		return SHCodecs_Picture_P;
+	else
+		return SHCodecs_Picture_B;
+}
+
+/* The local frame to decode the next anchor VOP into, which must not be
+ * either reference */
+static long
+mpeg4_next_ldec(SHCodecs_Encoder *enc)
+{
+	long i;
+
+	for (i=0; i<enc->nr_local_frames; i++) {
+		if (i == enc->ref1)
+			continue;
+		if (enc->nr_local_frames > 2 && i == enc->fwd_ref)
+			continue;
+		break;
 	}
-	m4iph_sdr_write(addr_c, addr_c_2, width * height / 2);
 
-	free(addr_y_2);
-	free(addr_c_2);
-	return (return_value);
+	return i;
 }
 
-/* Encode a whole frame for MPEG-4/H.263 */
+/* Encode a whole frame for MPEG-4/H.263. Anchor VOPs are predicted from
+ * the previous anchor; B-VOPs are also predicted from the anchor encoded
+ * just before them, which follows them in display order. */
 static long
-mpeg4_encode_frame (SHCodecs_Encoder *enc,
-	unsigned char *py, unsigned char *pc)
+mpeg4_encode_frame (SHCodecs_Encoder *enc, struct held_frame *frame,
+	int b_vop, long set_intra)
 {
 	long unit_size;
 	long rc;
 	TAVCBE_FMEM input_buf;
+	TAVCBE_STREAM_BUFF stream_buff;
 	avcbe_frame_stat frame_stat;
 	long pic_type;
 	int cb_ret = 0;
+	double vpu_start;
 
-	input_buf.Y_fmemp = py;
-	input_buf.C_fmemp = pc;
+	input_buf.Y_fmemp = frame->phys_y;
+	input_buf.C_fmemp = frame->phys_c;
 
-	if (enc->stream_type != AVCBE_MPEG4) {
-		//TODO this doesn't modify any data and we don't do anything
-		// with the return value...
-		rc = clip_image_data_for_H263(enc, py, pc);
-	}
-
-	if (enc->frame_counter != 0) {
-		/* Restore stream context */
+	if (enc->context_saved) {
+		/* Restore stream context, saved when another user took the VPU */
 		rc = avcbe_set_backup(enc->stream_info, &enc->backup_area);
 		if (rc != 0)
 			return vpu_err(enc, __func__, __LINE__, rc);
+		enc->context_saved = 0;
 	}
 
+	/* Apply bitrate and frame rate changes */
+	rc = encoder_apply_changes(enc);
+	if (rc != 0)
+		return vpu_err(enc, __func__, __LINE__, rc);
+
 	/* Specify the input frame address */
-	rc = avcbe_set_image_pointer(enc->stream_info,
-				    &input_buf, enc->ldec, enc->ref1, 0);
+	if (b_vop)
+		rc = avcbe_set_image_pointer(enc->stream_info, &input_buf,
+					    enc->ldec, enc->fwd_ref, enc->ref1);
+	else
+		rc = avcbe_set_image_pointer(enc->stream_info, &input_buf,
+					    enc->ldec, enc->ref1, 0);
 	if (rc != 0)
 		return vpu_err(enc, __func__, __LINE__, rc);
 
+	encoder_get_output_buffer(enc, 0, &stream_buff);
+
 	/* Encode the frame */
-	rc = avcbe_encode_picture(enc->stream_info, enc->frm,
-				 AVCBE_ANY_VOP,
+	vpu_start = encoder_now_ms();
+	rc = avcbe_encode_picture(enc->stream_info, frame->frm, set_intra,
 				 AVCBE_OUTPUT_NONE,
-				 &enc->stream_buff_info, NULL);
-	if (rc != 0)
+				 &stream_buff, NULL);
+	enc->frame_stats.vpu_ms += encoder_now_ms() - vpu_start;
+	if (rc < 0)
 		return vpu_err(enc, __func__, __LINE__, rc);
 
 	if (rc == AVCBE_FRAME_SKIPPED) {
 		enc->frame_skip_num++;
+		enc->frame_stats.skipped = 1;
 	}
 
 	if ((rc == AVCBE_ENCODE_SUCCESS)
 	    || (rc == AVCBE_B_VOP_OUTPUTTED)
 	    || (rc == AVCBE_EMPTY_VOP_OUTPUTTED)) {
 
-		if (rc == AVCBE_ENCODE_SUCCESS) {
-			if (enc->ldec == 0) {
-				enc->ldec = 1;
-				enc->ref1 = 0;
-			} else {
-				enc->ldec = 0;
-				enc->ref1 = 1;
-			}
-		}
-
 		avcbe_get_last_frame_stat(enc->stream_info, &frame_stat);
 		unit_size = (frame_stat.avcbe_frame_n_bits + 7) / 8;
 		pic_type = frame_stat.avcbe_frame_type;
 
+		/* The new anchor becomes the backward reference */
+		if (rc == AVCBE_ENCODE_SUCCESS && pic_type != AVCBE_B_VOP) {
+			enc->fwd_ref = enc->ref1;
+			enc->ref1 = enc->ldec;
+			enc->ldec = mpeg4_next_ldec(enc);
+		}
+
+		encoder_stats_slice(enc, mpeg4_picture_type(pic_type),
+				frame_stat.avcbe_frame_n_bits,
+				frame_stat.avcbe_quant,
+				(ROUND_UP_16(enc->width) / 16) *
+				(ROUND_UP_16(enc->height) / 16));
+
 		enc->frame_num_delta++;
 		enc->frame_num_delta += enc->frame_skip_num;
 		enc->frame_skip_num = 0;
 
 		/* Output frame data */
 		if (pic_type == AVCBE_I_VOP) {
-			cb_ret = output_data(enc, IDATA,
-					enc->stream_buff_info.buff_top, unit_size);
+			cb_ret = output_data(enc, IDATA, frame->frm,
+					stream_buff.buff_top, unit_size);
 		} else if (pic_type == AVCBE_P_VOP) {
-			cb_ret = output_data(enc, PDATA,
-					enc->stream_buff_info.buff_top, unit_size);
+			cb_ret = output_data(enc, PDATA, frame->frm,
+					stream_buff.buff_top, unit_size);
 		} else {
-			cb_ret = output_data(enc, BDATA,
-					enc->stream_buff_info.buff_top, unit_size);
+			cb_ret = output_data(enc, BDATA, frame->frm,
+					stream_buff.buff_top, unit_size);
 		}
 
 		enc->frame_num_delta = 0;
+
+		encoder_frame_encoded(enc, (pic_type == AVCBE_I_VOP), unit_size);
 	}
 
-	enc->frm += enc->frame_no_increment;
 	enc->frame_counter++;
 
-	/* Save stream context */
-	rc = avcbe_get_backup(enc->stream_info, &enc->backup_area);
-	if (rc != 0)
-		return vpu_err(enc, __func__, __LINE__, rc);
-
 	return cb_ret;
 }
 
-/* Release all input buffers that aren't in use */
-static int
-mpeg4_release_input_buffers(SHCodecs_Encoder *enc)
-{
-	long rc;
-	unsigned long i;
-
-#ifdef USE_BVOP
-	// TODO this is highly suspect - I guess we should be passing the middleware a list of input buffers
-	AVCBE_FRAME_CHECK frame_check_array[17];
-
-	if (enc->other_options_mpeg4.avcbe_b_vop_num > 0) {
-
-		rc = avcbe_get_buffer_check(enc->stream_info,
-					   &frame_check_array[0]);
-		if (rc < 0) {
-			return vpu_err(enc, __func__, __LINE__, rc);
-		}
-
-		for (i=0; i < (enc->other_options_mpeg4.avcbe_b_vop_num + 1); i++) {
-			if (frame_check_array[i].avcbe_status == AVCBE_UNLOCK) {
-				if (enc->release)
-					enc->release(enc, enc->addr_y_tbl[i], enc->addr_c_tbl[i], enc->release_user_data);
-			}
-		}
-	}
-#else
-	if (enc->release)
-		enc->release(enc, enc->addr_y, enc->addr_c, enc->release_user_data);
-#endif
-	return 0;
-}
-
 static long
 mpeg4_encode_start (SHCodecs_Encoder *enc)
 {
 	long rc;
-	int cb_ret;
-	unsigned long i;
 
 	if (enc->initialized < 2) {
 		rc = mpeg4_encode_deferred_init(enc);
@@ -420,6 +465,7 @@ mpeg4_encode_start (SHCodecs_Encoder *enc)
 
 	enc->ldec = 0;		/* Index number of the image-work-field area */
 	enc->ref1 = 0;
+	enc->fwd_ref = 0;
 	enc->frm = 0;		/* Frame number to be encoded */
 
 	enc->frame_counter = 0;
@@ -430,18 +476,160 @@ mpeg4_encode_start (SHCodecs_Encoder *enc)
 	return 0;
 }
 
+/* Copy an input frame into a buffer of the encoder's own, which the VPU
+ * reads instead. H.263 frames are clipped while copying. */
+static int
+mpeg4_copy_input(SHCodecs_Encoder *enc, struct held_frame *frame)
+{
+	int h263 = (enc->encoding_property.avcbe_stream_type == AVCBE_H263);
+	unsigned char *virt_py;
+	int i;
+
+	/* Each held frame and the frame being encoded needs a copy */
+	for (i=0; i<enc->nr_b_vops; i++) {
+		if (!enc->copy_in_use[i])
+			break;
+	}
+	if (!enc->input_copies[i]) {
+		enc->input_copies[i] = m4iph_sdr_malloc(enc->vpu, (enc->alloc_y_bytes*3)/2, 32);
+		if (!enc->input_copies[i])
+			return -1;
+	}
+	enc->copy_in_use[i] = 1;
+	frame->copy = i;
+
+	frame->phys_y = enc->input_copies[i];
+	frame->phys_c = frame->phys_y + enc->y_bytes;
+	/* The copy is only read by the VPU while this encoder holds
+	   the lock, so it can be filled without it */
+	virt_py = m4iph_addr_to_virt(enc->vpu, frame->phys_y);
+	if (h263) {
+		/* Clip while copying */
+		h263_clip(virt_py, frame->y, enc->y_bytes);
+		h263_clip(virt_py + enc->y_bytes, frame->c, enc->y_bytes/2);
+	} else {
+		memcpy(virt_py, frame->y, enc->y_bytes);
+		memcpy(virt_py + enc->y_bytes, frame->c, enc->y_bytes/2);
+	}
+
+	return 0;
+}
+
+/* Get the addresses of an input frame for the VPU. Frames that the VPU
+ * cannot read are copied; H.263 frames are clipped. */
+static int
+mpeg4_prepare_input(SHCodecs_Encoder *enc, struct held_frame *frame)
+{
+	int h263 = (enc->encoding_property.avcbe_stream_type == AVCBE_H263);
+
+	frame->phys_y = (unsigned char *)uiomux_all_virt_to_phys(frame->y);
+	frame->phys_c = (unsigned char *)uiomux_all_virt_to_phys(frame->c);
+	frame->copy = -1;
+
+	/* Can the buffers passed to us be used by the hardware? */
+	/* If not allocate buffer that we can use and copy the input */
+	if (!frame->phys_y || !frame->phys_c) {
+		if (mpeg4_copy_input(enc, frame) != 0)
+			return -1;
+	} else if (h263) {
+		/* H.263 does not allow samples of 0 or 255 */
+		h263_clip(frame->y, frame->y, enc->y_bytes);
+		h263_clip(frame->c, frame->c, enc->y_bytes/2);
+	}
+
+	return 0;
+}
+
+/* Encode an input frame and release it */
+static int
+mpeg4_encode_input(SHCodecs_Encoder *enc, struct held_frame *frame,
+		   int b_vop, long set_intra)
+{
+	int rc, cb_ret;
+
+	enc->release_user_data_buffer = frame->user_data;
+	enc->frame_stats.timestamp = frame->timestamp;
+	enc->frame_stats.user_data = frame->user_data;
+
+	if (enc->rc)
+		encoder_rc_begin_frame(enc, frame->rc_cost);
+
+	encoder_stats_lock(enc);
+	rc = mpeg4_encode_frame(enc, frame, b_vop, set_intra);
+	m4iph_vpu_unlock(enc->vpu);
+
+	mpeg4_release_frame(enc, frame);
+
+	if (rc >= 0) {
+		if (enc->rc)
+			encoder_rc_end_frame(enc);
+		cb_ret = encoder_stats_end(enc);
+		if (rc == 0)
+			rc = cb_ret;
+	}
+
+	return rc;
+}
+
+/* Encode the B-VOPs held for the anchor VOP just encoded */
+static int
+mpeg4_encode_held(SHCodecs_Encoder *enc)
+{
+	int i, rc, ret = 0;
+
+	for (i=0; i<enc->nr_held; i++) {
+		encoder_stats_begin(enc);
+		enc->frame_stats.frame_number = enc->held[i].frm;
+
+		rc = mpeg4_encode_input(enc, &enc->held[i], 1, AVCBE_ANY_VOP);
+		if (rc < 0) {
+			/* Return the frames that will not be encoded */
+			for (i++; i<enc->nr_held; i++) {
+				mpeg4_release_frame(enc, &enc->held[i]);
+			}
+			enc->nr_held = 0;
+			return rc;
+		}
+		if (ret == 0)
+			ret = rc;
+	}
+	enc->nr_held = 0;
+
+	return ret;
+}
+
 int
 mpeg4_encode_finish (SHCodecs_Encoder *enc)
 {
+	struct held_frame last;
 	long rc, length;
 
+	/* The last frame held is encoded as an I-VOP, so that the others
+	   can be encoded as B-VOPs */
+	if (enc->nr_held > 0) {
+		last = enc->held[--enc->nr_held];
+
+		encoder_stats_begin(enc);
+		enc->frame_stats.frame_number = last.frm;
+
+		rc = mpeg4_encode_input(enc, &last, 0, AVCBE_FORCE_I_VOP);
+		if (rc >= 0)
+			rc = mpeg4_encode_held(enc);
+		if (rc < 0)
+			return rc;
+	}
+
+	/* The end code belongs to no input frame */
+	enc->frame_stats.timestamp = SHCODECS_TIMESTAMP_NONE;
+	enc->frame_stats.user_data = NULL;
+
 	m4iph_vpu_lock(enc->vpu);
 	length = avcbe_put_end_code(enc->stream_info, &enc->end_code_buff_info, AVCBE_VOSE);
 	m4iph_vpu_unlock(enc->vpu);
 	if (length <= 0)
 		return vpu_err(enc, __func__, __LINE__, length);
 
-	rc = output_data(enc, END, enc->end_code_buff_info.buff_top, length);
+	rc = output_data(enc, END, enc->frm, enc->end_code_buff_info.buff_top, length);
 	if (rc != 0)
 		return rc;
 
@@ -449,45 +637,76 @@ mpeg4_encode_finish (SHCodecs_Encoder *enc)
 }
 
 int
-mpeg4_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc, void *user_data)
+mpeg4_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc,
+		    void *user_data, SHCodecs_Timestamp ts)
 {
-	void *phys_py = (void *)uiomux_all_virt_to_phys(py);
-	void *phys_pc = (void *)uiomux_all_virt_to_phys(pc);
-	int rc;
+	struct held_frame frame;
+	int rc, b_ret;
+
+	encoder_stats_begin(enc);
+	enc->frame_stats.timestamp = ts;
+	enc->frame_stats.user_data = user_data;
+
+	/* The rate is chosen when the frame is encoded, which for a B-VOP
+	   is after the anchor VOP that follows it */
+	frame.rc_cost = 0;
+	if (enc->rc)
+		frame.rc_cost = encoder_rc_frame_cost(enc, py);
 
 	enc->release_user_data_buffer = user_data;
 
-	/* Can the buffers passed to us be used by the hardware? */
-	/* If not allocate buffer that we can use and copy the input */
-	if (!phys_py || !phys_pc) {
-		if (!enc->input_frame) {
-			enc->input_frame = m4iph_sdr_malloc(enc->vpu, (enc->y_bytes*3)/2, 32);
-			if (!enc->input_frame)
-				return -1;
-		}
-		phys_py = enc->input_frame;
-		phys_pc = phys_py + enc->y_bytes;
-		m4iph_vpu_lock(enc->vpu);
-		m4iph_sdr_write(phys_py, py, enc->y_bytes);
-		m4iph_sdr_write(phys_pc, pc, enc->y_bytes/2);
-		m4iph_vpu_unlock(enc->vpu);
+	if (enc->scene && encoder_scene_begin_frame(enc, py)) {
+		if (enc->rc)
+			encoder_rc_begin_frame(enc, frame.rc_cost);
+		return encoder_scene_skip(enc, py, pc);
 	}
 
 	if (enc->initialized < 3) {
-		m4iph_vpu_lock(enc->vpu);
+		if (mpeg4_alloc_local_frames(enc) < 0)
+			return -1;
+		encoder_stats_lock(enc);
 		rc = mpeg4_encode_start(enc);
 		m4iph_vpu_unlock(enc->vpu);
 		if (rc != 0)
 			return rc;
 	}
 
-	m4iph_vpu_lock(enc->vpu);
-	rc = mpeg4_encode_frame(enc, phys_py, phys_pc);
-	m4iph_vpu_unlock(enc->vpu);
+	frame.y = py;
+	frame.c = pc;
+	frame.user_data = user_data;
+	frame.timestamp = ts;
+	frame.frm = enc->frm;
+	rc = mpeg4_prepare_input(enc, &frame);
+	if (rc != 0)
+		return rc;
+
+	enc->frm += enc->frame_no_increment;
+
+	/* Hold the frames between anchor VOPs until the next anchor has
+	   been encoded. A frame to be forced intra is encoded as an anchor
+	   straight away. */
+	if (enc->frame_counter > 0 && enc->nr_held < enc->nr_b_vops &&
+	    encoder_get_set_intra(enc) == AVCBE_ANY_VOP) {
+		/* An asynchronous frame is completed when this returns, so
+		   the input is copied and released now rather than later */
+		if (enc->async) {
+			if (frame.copy < 0 && mpeg4_copy_input(enc, &frame) != 0)
+				return -1;
+			encoder_release_input(enc, frame.y, frame.c);
+			frame.y = NULL;
+			frame.c = NULL;
+		}
+		enc->held[enc->nr_held++] = frame;
+		return 0;
+	}
+
+	rc = mpeg4_encode_input(enc, &frame, 0, encoder_get_set_intra(enc));
+	if (rc < 0)
+		return rc;
 
-	// TODO can't just release this buffer when using BVOPs...
-	if (enc->release)
-		enc->release(enc, py, pc, enc->release_user_data);
+	b_ret = mpeg4_encode_held(enc);
+	if (b_ret < 0 || rc == 0)
+		rc = b_ret;
 
 	return rc;
 }
@@ -499,6 +718,8 @@ mpeg4_encode_run (SHCodecs_Encoder *enc)
 	int cb_ret;
 
 	if (enc->initialized < 3) {
+		if (mpeg4_alloc_local_frames(enc) < 0)
+			return -1;
 		m4iph_vpu_lock(enc->vpu);
 		rc = mpeg4_encode_start(enc);
 		m4iph_vpu_unlock(enc->vpu);
@@ -518,7 +739,8 @@ mpeg4_encode_run (SHCodecs_Encoder *enc)
 		}
 
 		/* Encode the frame */
-		rc = mpeg4_encode_1frame(enc, enc->addr_y, enc->addr_c, NULL);
+		rc = mpeg4_encode_1frame(enc, enc->addr_y, enc->addr_c, NULL,
+					 encoder_take_input_timestamp(enc));
 		if (rc != 0)
 			return rc;
 	}
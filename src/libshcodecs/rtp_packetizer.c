@@ -0,0 +1,368 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * RFC 6184 packetization of H.264 encoder output. Only the RTP header,
+ * FU-A header and STAP-A sizes are written here; payloads are referenced
+ * in place.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shcodecs/shcodecs_rtp.h"
+
+#define RTP_HEADER_SIZE 12
+#define RTP_CLOCK 90000
+
+#define NAL_TYPE_STAP_A 24
+#define NAL_TYPE_FU_A 28
+
+/* Maximum NAL units aggregated into one STAP-A packet */
+#define MAX_STAP_NALS 16
+
+/* A random value for the initial RTP state, which must differ between
+ * processes, so the unseeded random() will not do */
+static unsigned long
+rtp_random(void)
+{
+	static unsigned int seed;
+	unsigned long value;
+	struct timespec ts;
+	FILE *f;
+
+	f = fopen("/dev/urandom", "rb");
+	if (f) {
+		if (fread(&value, sizeof(value), 1, f) == 1) {
+			fclose(f);
+			return value & 0xffffffff;
+		}
+		fclose(f);
+	}
+
+	/* No entropy source, so make do with the time and process */
+	if (seed == 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		seed = ts.tv_sec ^ ts.tv_nsec ^ ((unsigned int)getpid() << 16);
+	}
+	value = rand_r(&seed);
+	value = (value << 16) ^ rand_r(&seed);
+
+	return value & 0xffffffff;
+}
+
+struct SHCodecs_RTP_Packetizer {
+	SHCodecs_Encoder *encoder;
+	int mtu;
+	int payload_type;
+	unsigned long ssrc;
+	unsigned short seq;
+	unsigned long timestamp_base;
+
+	SHCodecs_RTP_Output output;
+	void *user_data;
+
+	long nr_packets;
+
+	/* Packet under construction */
+	unsigned char header[RTP_HEADER_SIZE];
+	unsigned char fu[2];
+	unsigned char stap[1 + 2*MAX_STAP_NALS];	/* STAP-A header, NAL sizes */
+	struct iovec iov[2 + 2*MAX_STAP_NALS];
+
+	/* NAL units waiting to be aggregated */
+	unsigned char *pending[MAX_STAP_NALS];
+	int pending_len[MAX_STAP_NALS];
+	int nr_pending;
+	int stap_bytes;
+};
+
+SHCodecs_RTP_Packetizer *
+shcodecs_rtp_packetizer_init(SHCodecs_Encoder *encoder, int mtu,
+			     int payload_type, unsigned long ssrc,
+			     SHCodecs_RTP_Output output_cb, void *user_data)
+{
+	SHCodecs_RTP_Packetizer *rtp;
+
+	/* Room for at least the RTP and FU-A headers and one byte */
+	if (encoder == NULL || output_cb == NULL || mtu < RTP_HEADER_SIZE + 3)
+		return NULL;
+
+	rtp = calloc(1, sizeof(*rtp));
+	if (rtp == NULL)
+		return NULL;
+
+	rtp->encoder = encoder;
+	rtp->mtu = mtu;
+	rtp->payload_type = payload_type & 0x7f;
+	rtp->ssrc = ssrc;
+	rtp->output = output_cb;
+	rtp->user_data = user_data;
+
+	/* RFC 3550: initial sequence number and timestamp should be random */
+	rtp->seq = rtp_random() & 0xffff;
+	rtp->timestamp_base = rtp_random();
+
+	return rtp;
+}
+
+void
+shcodecs_rtp_packetizer_close(SHCodecs_RTP_Packetizer *rtp)
+{
+	free(rtp);
+}
+
+unsigned long
+shcodecs_rtp_timestamp(SHCodecs_RTP_Packetizer *rtp, long frame_number)
+{
+	long increment, fps_x10;
+	long long frames;
+
+	increment = shcodecs_encoder_get_frame_no_increment(rtp->encoder);
+	fps_x10 = shcodecs_encoder_get_frame_rate(rtp->encoder);
+	if (increment <= 0)
+		increment = 1;
+	if (fps_x10 <= 0)
+		fps_x10 = 300;
+
+	frames = frame_number / increment;
+
+	return (rtp->timestamp_base + frames * RTP_CLOCK * 10 / fps_x10) & 0xffffffff;
+}
+
+long
+shcodecs_rtp_get_packet_count(SHCodecs_RTP_Packetizer *rtp)
+{
+	if (rtp == NULL) return -1;
+
+	return rtp->nr_packets;
+}
+
+/* Add the RTP header in iov[0] and output the packet */
+static int
+send_packet(SHCodecs_RTP_Packetizer *rtp, int iovcnt, int marker,
+	    unsigned long timestamp)
+{
+	unsigned char *h = rtp->header;
+	int i, length = 0;
+
+	h[0] = 0x80;	/* Version 2 */
+	h[1] = (marker ? 0x80 : 0) | rtp->payload_type;
+	h[2] = rtp->seq >> 8;
+	h[3] = rtp->seq & 0xff;
+	h[4] = (timestamp >> 24) & 0xff;
+	h[5] = (timestamp >> 16) & 0xff;
+	h[6] = (timestamp >> 8) & 0xff;
+	h[7] = timestamp & 0xff;
+	h[8] = (rtp->ssrc >> 24) & 0xff;
+	h[9] = (rtp->ssrc >> 16) & 0xff;
+	h[10] = (rtp->ssrc >> 8) & 0xff;
+	h[11] = rtp->ssrc & 0xff;
+
+	rtp->iov[0].iov_base = h;
+	rtp->iov[0].iov_len = RTP_HEADER_SIZE;
+
+	for (i=0; i<iovcnt; i++)
+		length += rtp->iov[i].iov_len;
+
+	rtp->seq++;
+	rtp->nr_packets++;
+
+	return rtp->output(rtp, rtp->iov, iovcnt, length, rtp->user_data);
+}
+
+/* Skip an Annex B start code, if present */
+static unsigned char *
+strip_start_code(unsigned char *data, int *length)
+{
+	int i = 0;
+
+	while (i < *length - 1 && data[i] == 0)
+		i++;
+
+	if (i >= 2 && data[i] == 1) {
+		i++;
+		*length -= i;
+		return data + i;
+	}
+
+	return data;
+}
+
+/* Single NAL unit packet, or FU-A fragments */
+static int
+packetize_nal(SHCodecs_RTP_Packetizer *rtp, unsigned char *nal, int length,
+	      unsigned long timestamp, int last)
+{
+	int max_payload = rtp->mtu - RTP_HEADER_SIZE;
+	unsigned char nal_header;
+	int n, start, end, ret;
+
+	if (length <= max_payload) {
+		rtp->iov[1].iov_base = nal;
+		rtp->iov[1].iov_len = length;
+		return send_packet(rtp, 2, last, timestamp);
+	}
+
+	/* The NAL header is replaced by the FU indicator and FU header */
+	nal_header = nal[0];
+	nal++;
+	length--;
+
+	rtp->fu[0] = (nal_header & 0xe0) | NAL_TYPE_FU_A;
+
+	for (start = 1; length > 0; start = 0) {
+		n = length;
+		if (n > max_payload - 2)
+			n = max_payload - 2;
+		end = (n == length);
+
+		rtp->fu[1] = (start ? 0x80 : 0) | (end ? 0x40 : 0) | (nal_header & 0x1f);
+
+		rtp->iov[1].iov_base = rtp->fu;
+		rtp->iov[1].iov_len = 2;
+		rtp->iov[2].iov_base = nal;
+		rtp->iov[2].iov_len = n;
+
+		ret = send_packet(rtp, 3, last && end, timestamp);
+		if (ret < 0)
+			return ret;
+
+		nal += n;
+		length -= n;
+	}
+
+	return 0;
+}
+
+/* Output the NAL units waiting to be aggregated */
+static int
+flush_pending(SHCodecs_RTP_Packetizer *rtp, unsigned long timestamp, int last)
+{
+	unsigned char f_nri = 0;
+	int i, ret;
+
+	if (rtp->nr_pending == 0)
+		return 0;
+
+	if (rtp->nr_pending == 1) {
+		ret = packetize_nal(rtp, rtp->pending[0], rtp->pending_len[0],
+				    timestamp, last);
+	} else {
+		/* STAP-A: F is the OR, and NRI the maximum, of the NAL units */
+		for (i=0; i<rtp->nr_pending; i++) {
+			f_nri |= rtp->pending[i][0] & 0x80;
+			if ((rtp->pending[i][0] & 0x60) > (f_nri & 0x60))
+				f_nri = (f_nri & 0x80) | (rtp->pending[i][0] & 0x60);
+		}
+		rtp->stap[0] = f_nri | NAL_TYPE_STAP_A;
+		rtp->iov[1].iov_base = rtp->stap;
+		rtp->iov[1].iov_len = 1;
+
+		for (i=0; i<rtp->nr_pending; i++) {
+			rtp->stap[1 + 2*i] = rtp->pending_len[i] >> 8;
+			rtp->stap[2 + 2*i] = rtp->pending_len[i] & 0xff;
+			rtp->iov[2 + 2*i].iov_base = &rtp->stap[1 + 2*i];
+			rtp->iov[2 + 2*i].iov_len = 2;
+			rtp->iov[3 + 2*i].iov_base = rtp->pending[i];
+			rtp->iov[3 + 2*i].iov_len = rtp->pending_len[i];
+		}
+
+		ret = send_packet(rtp, 2 + 2*rtp->nr_pending, last, timestamp);
+	}
+
+	rtp->nr_pending = 0;
+	rtp->stap_bytes = 1;
+
+	return ret;
+}
+
+int
+shcodecs_rtp_packetize_au(SHCodecs_RTP_Packetizer *rtp,
+			  const struct iovec *iov, int iovcnt,
+			  const SHCodecs_Encoder_AU_Info *info)
+{
+	int max_payload = rtp->mtu - RTP_HEADER_SIZE;
+	unsigned long timestamp;
+	unsigned char *nal;
+	int i, length, last, ret;
+
+	if (info->pic_type == SHCodecs_Picture_End)
+		return 0;
+
+	timestamp = shcodecs_rtp_timestamp(rtp, info->frame_number);
+
+	rtp->nr_pending = 0;
+	rtp->stap_bytes = 1;
+
+	for (i=0; i<iovcnt; i++) {
+		length = iov[i].iov_len;
+		nal = strip_start_code(iov[i].iov_base, &length);
+		if (length <= 0)
+			continue;
+
+		last = (i == iovcnt-1);
+
+		/* Aggregate NAL units that fit in a STAP-A packet */
+		if (1 + 2 + length <= max_payload) {
+			if (rtp->nr_pending == MAX_STAP_NALS ||
+			    rtp->stap_bytes + 2 + length > max_payload) {
+				ret = flush_pending(rtp, timestamp, 0);
+				if (ret < 0)
+					return ret;
+			}
+			rtp->pending[rtp->nr_pending] = nal;
+			rtp->pending_len[rtp->nr_pending] = length;
+			rtp->nr_pending++;
+			rtp->stap_bytes += 2 + length;
+			continue;
+		}
+
+		ret = flush_pending(rtp, timestamp, 0);
+		if (ret < 0)
+			return ret;
+
+		ret = packetize_nal(rtp, nal, length, timestamp, last);
+		if (ret < 0)
+			return ret;
+	}
+
+	return flush_pending(rtp, timestamp, 1);
+}
+
+int
+shcodecs_rtp_packetize_nal(SHCodecs_RTP_Packetizer *rtp,
+			   unsigned char *data, int length,
+			   unsigned long timestamp, int last)
+{
+	unsigned char *nal;
+
+	nal = strip_start_code(data, &length);
+	if (length <= 0)
+		return 0;
+
+	return packetize_nal(rtp, nal, length, timestamp, last);
+}
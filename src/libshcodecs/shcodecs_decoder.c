@@ -27,6 +27,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/param.h>
+#include <time.h>
 #include "shcodecs/shcodecs_decoder.h"
 #include "avcbd.h"
 #include "avcbd_optionaldata.h"
@@ -67,10 +68,15 @@ static void debug_printf(const char *fmt, ...)
 static int decode_frame(SHCodecs_Decoder * decoder);
 static int extract_frame(SHCodecs_Decoder * decoder, long frame_index);
 static int get_input(SHCodecs_Decoder * decoder, void *dst);
+static void picture_decoded(SHCodecs_Decoder * decoder, unsigned long poc, unsigned long detect);
+static void picture_metadata(SHCodecs_Decoder * decoder, SHCodecs_Decoder_Metadata *meta);
+static int skip_nal(SHCodecs_Decoder * decoder);
 
 static int stream_init(SHCodecs_Decoder * decoder);
+static int sequence_init(SHCodecs_Decoder * decoder);
 static int decoder_init(SHCodecs_Decoder * decoder);
 static int decoder_start(SHCodecs_Decoder * decoder);
+static void input_reset(SHCodecs_Decoder * decoder);
 
 /***********************************************************/
 
@@ -94,6 +100,10 @@ SHCodecs_Decoder *shcodecs_decoder_init(int width, int height, SHCodecs_Format f
 	decoder->frame_count = 0;
 	decoder->last_cb_ret = 0;
 
+	decoder->au_pos = -1;
+	decoder->frame_ts = SHCODECS_TIMESTAMP_NONE;
+	decoder->frame_latency = -1;
+
 	/* H.264 spec: Max NAL size is the size of an uncompressed image divided
 	   by the "Minimum Compression Ratio", MinCR. This is 2 for most levels
 	   but is 4 for levels 3.1 to 4. Since we don't know the level, we use
@@ -207,10 +217,12 @@ shcodecs_decode(SHCodecs_Decoder * decoder, unsigned char *data, int len)
 	int nused=0, total_used=0;
 
 	decoder->input_buf = data;
+	decoder->input_offset = decoder->stream_used;
 	decoder->last_cb_ret = 0;
 
 	while (len > 0) {
 		decoder->input_buf += nused;
+		decoder->input_offset += nused;
 		decoder->input_pos = 0;
 		decoder->input_len = MIN (decoder->max_nal_size, len);
 		decoder->input_size = decoder->input_len;
@@ -225,15 +237,185 @@ shcodecs_decode(SHCodecs_Decoder * decoder, unsigned char *data, int len)
 			break;
 	}
 
+	decoder->stream_used += total_used;
+
 	return total_used;
 }
 
+/*
+ * Decode the last data of a stream, without holding any back to find
+ * the end of the final picture. Returns number of bytes used.
+ */
 int
-shcodecs_decoder_finalize (SHCodecs_Decoder * decoder)
+shcodecs_decode_final(SHCodecs_Decoder * decoder, unsigned char *data, int len)
 {
+	int total_used;
+
+	if (decoder == NULL) return -1;
+
 	decoder->needs_finalization = 1;
+	total_used = shcodecs_decode(decoder, data, len);
+	decoder->needs_finalization = 0;
+
+	return total_used;
+}
+
+/*
+ * Decode several streams, one picture from each stream per VPU lock.
+ * Returns the number of frames decoded.
+ */
+int
+shcodecs_decode_multi(SHCodecs_Decoder ** decoders, unsigned char ** data,
+		      int * len, int * used, int nr_decoders)
+{
+	SHCodecs_Decoder *decoder;
+	int *status, *ret;
+	int i, nr_active = 0, nr_frames = 0;
+
+	if (!decoders || !data || !len || !used || nr_decoders <= 0)
+		return -1;
+
+	/* Per-stream state (1 = active, 0 = done) and last decode result */
+	if ((status = calloc(nr_decoders * 2, sizeof(*status))) == NULL)
+		return -1;
+	ret = status + nr_decoders;
+
+	for (i = 0; i < nr_decoders; i++) {
+		decoder = decoders[i];
+		used[i] = 0;
+		decoder->last_cb_ret = 0;
+		if (len[i] <= 0)
+			continue;
+
+		decoder->input_buf = data[i];
+		decoder->input_offset = decoder->stream_used;
+		decoder->input_pos = 0;
+		decoder->input_len = MIN (decoder->max_nal_size, len[i]);
+		decoder->input_size = decoder->input_len;
+		status[i] = 1;
+		nr_active++;
+	}
+
+	while (nr_active > 0) {
+		void *locked_vpu = NULL;
+
+		/* Decode one picture from each active stream in a single
+		 * lock period. The decoded callbacks are run afterwards so
+		 * that the VPU is not held while the application works. */
+		for (i = 0; i < nr_decoders; i++) {
+			if (!status[i])
+				continue;
+			decoder = decoders[i];
+
+			if (!locked_vpu) {
+				locked_vpu = decoder->vpu;
+				m4iph_vpu_lock(locked_vpu);
+			} else {
+				m4iph_vpu_switch(decoder->vpu);
+			}
+
+			ret[i] = decode_frame(decoder);
+		}
+		m4iph_vpu_switch(locked_vpu);
+		m4iph_vpu_unlock(locked_vpu);
+
+		for (i = 0; i < nr_decoders; i++) {
+			if (!status[i])
+				continue;
+			decoder = decoders[i];
+
+			if (ret[i] == 0) {
+				long index = avcbd_get_decoded_frame(decoder->context, 0);
+
+				if (index >= 0) {
+					decoder->last_cb_ret = extract_frame(decoder, index);
+					nr_frames++;
+				}
+				if (decoder->last_cb_ret == 0)
+					continue;
+
+				/* Paused by the application */
+				used[i] += decoder->input_pos;
+				status[i] = 0;
+				nr_active--;
+				continue;
+			}
+
+			/* End of this chunk of input (more data wanted or error) */
+			used[i] += decoder->input_pos;
+			if (decoder->input_pos <= 0 || used[i] >= len[i]) {
+				status[i] = 0;
+				nr_active--;
+				continue;
+			}
+
+			decoder->input_buf = data[i] + used[i];
+			decoder->input_offset = decoder->stream_used + used[i];
+			decoder->input_pos = 0;
+			decoder->input_len = MIN (decoder->max_nal_size, len[i] - used[i]);
+			decoder->input_size = decoder->input_len;
+		}
+	}
+
+	for (i = 0; i < nr_decoders; i++)
+		decoders[i]->stream_used += used[i];
+
+	free(status);
+
+	return nr_frames;
+}
+
+int
+shcodecs_decoder_finalize (SHCodecs_Decoder * decoder)
+{
+	return shcodecs_decoder_flush (decoder);
+}
+
+/*
+ * Output every picture still held by the decoder, and clear the input
+ * state. Returns the number of frames output.
+ */
+int
+shcodecs_decoder_flush (SHCodecs_Decoder * decoder)
+{
+	int frame_count, i;
+	long index;
 
-	return decoder_start (decoder);
+	if (decoder == NULL) return -1;
+
+	frame_count = decoder->frame_count;
+
+	/* Bump all pictures out of the DPB, in display order */
+	for (i = 0; i < decoder->num_frames; i++) {
+		index = avcbd_get_decoded_frame(decoder->context, DECODED_FRAME_FLUSH);
+		if (index < 0)
+			break;
+		extract_frame(decoder, index);
+	}
+
+	input_reset (decoder);
+
+	return decoder->frame_count - frame_count;
+}
+
+/*
+ * Discard all input and pending pictures, and restart the decoder with
+ * the existing allocations.
+ */
+int
+shcodecs_decoder_reset (SHCodecs_Decoder * decoder)
+{
+	if (decoder == NULL) return -1;
+
+	input_reset (decoder);
+
+	/* Don't decode anything that references pictures from before */
+	decoder->resync = decoder->error_resilience;
+
+	if (sequence_init (decoder))
+		return -1;
+
+	return decoder_init (decoder);
 }
 
 int
@@ -244,6 +426,86 @@ shcodecs_decoder_get_frame_count (SHCodecs_Decoder * decoder)
 	return decoder->frame_count;
 }
 
+int
+shcodecs_decoder_set_input_timestamp (SHCodecs_Decoder * decoder,
+				      int offset, SHCodecs_Timestamp ts)
+{
+	struct ts_input *entry;
+
+	if (decoder == NULL || offset < 0) return -1;
+
+	/* Drop the oldest entry if the application never consumes them */
+	if (decoder->nr_ts_in == TS_QUEUE_SIZE) {
+		memmove(&decoder->ts_in[0], &decoder->ts_in[1],
+			(TS_QUEUE_SIZE - 1) * sizeof(struct ts_input));
+		decoder->nr_ts_in--;
+	}
+
+	entry = &decoder->ts_in[decoder->nr_ts_in++];
+	entry->pos = decoder->stream_used + offset;
+	entry->ts = ts;
+	clock_gettime(CLOCK_MONOTONIC, &entry->arrival);
+
+	return 0;
+}
+
+SHCodecs_Timestamp
+shcodecs_decoder_get_frame_timestamp (SHCodecs_Decoder * decoder)
+{
+	if (decoder == NULL) return SHCODECS_TIMESTAMP_NONE;
+
+	return decoder->frame_ts;
+}
+
+long
+shcodecs_decoder_get_frame_latency (SHCodecs_Decoder * decoder)
+{
+	if (decoder == NULL) return -1;
+
+	return decoder->frame_latency;
+}
+
+const SHCodecs_Decoder_Metadata *
+shcodecs_decoder_get_metadata (SHCodecs_Decoder * decoder)
+{
+	if (decoder == NULL) return NULL;
+
+	return &decoder->metadata;
+}
+
+int
+shcodecs_decoder_set_error_resilience (SHCodecs_Decoder * decoder, int enable)
+{
+	if (decoder == NULL) return -1;
+
+	if (decoder->format != SHCodecs_Format_H264)
+		return -1;
+
+	decoder->error_resilience = enable ? 1 : 0;
+	decoder->resync = 0;
+
+	avcbd_set_resume_err (decoder->context, decoder->error_resilience,
+			      AVCBD_CNCL_REF_TYPE1);
+
+	return 0;
+}
+
+int
+shcodecs_decoder_get_skipped_count (SHCodecs_Decoder * decoder)
+{
+	if (decoder == NULL) return -1;
+
+	return decoder->skipped_count;
+}
+
+int
+shcodecs_decoder_get_concealed_count (SHCodecs_Decoder * decoder)
+{
+	if (decoder == NULL) return -1;
+
+	return decoder->concealed_count;
+}
+
 /***********************************************************/
 
 /*
@@ -254,11 +516,8 @@ static int stream_init(SHCodecs_Decoder * decoder)
 {
 	int i;
 	int size_of_Y;
-	void *pv_wk_buff;
 	long stream_mode;
 	unsigned char *pBuf;
-	long rc;
-	const long max_pic_params = 256;
 
 	stream_mode = (decoder->format == SHCodecs_Format_H264) ? AVCBD_TYPE_AVC : AVCBD_TYPE_MPEG4;
 
@@ -312,7 +571,7 @@ static int stream_init(SHCodecs_Decoder * decoder)
 	decoder->context_size = avcbd_get_workarea_size(stream_mode,
 								decoder->si_max_fx,
 								decoder->si_max_fy,
-								max_pic_params);
+								MAX_PIC_PARAMS);
 	if (decoder->context_size < 0)
 		return vpu_err(decoder, __func__, __LINE__, decoder->context_size);
 
@@ -321,13 +580,32 @@ static int stream_init(SHCodecs_Decoder * decoder)
 	if (!decoder->context)
 		goto err;
 
+	return sequence_init(decoder);
+
+err:
+	return -1;
+}
+
+/*
+ * sequence_init
+ *
+ * (Re)initialize the decoding sequence in the allocated context.
+ */
+static int sequence_init(SHCodecs_Decoder * decoder)
+{
+	void *pv_wk_buff;
+	long stream_mode;
+	long rc;
+
+	stream_mode = (decoder->format == SHCodecs_Format_H264) ? AVCBD_TYPE_AVC : AVCBD_TYPE_MPEG4;
+
 	m4iph_vpu_lock(decoder->vpu);
 
 	rc = avcbd_init_sequence(
 			decoder->context, decoder->context_size,
 			decoder->num_frames, decoder->frames,
 			decoder->si_max_fx, decoder->si_max_fy,
-			max_pic_params,
+			MAX_PIC_PARAMS,
 			decoder->vpuwork1,
 			decoder->vpuwork2, stream_mode,
 			&pv_wk_buff);
@@ -338,13 +616,11 @@ static int stream_init(SHCodecs_Decoder * decoder)
 		return vpu_err(decoder, __func__, __LINE__, rc);
 
 	if (decoder->format == SHCodecs_Format_H264) {
-		avcbd_set_resume_err (decoder->context, 0, AVCBD_CNCL_REF_TYPE1);
+		avcbd_set_resume_err (decoder->context, decoder->error_resilience,
+				      AVCBD_CNCL_REF_TYPE1);
 	}
 
 	return 0;
-
-err:
-	return -1;
 }
 
 /*
@@ -425,6 +701,25 @@ static int decoder_start(SHCodecs_Decoder * decoder)
 	return decoder->input_pos;
 }
 
+/*
+ * input_reset
+ *
+ * Forget any buffered input and pending timestamps.
+ */
+static void input_reset(SHCodecs_Decoder * decoder)
+{
+	decoder->needs_finalization = 0;
+	decoder->input_buf = NULL;
+	decoder->input_pos = 0;
+	decoder->input_len = 0;
+	decoder->input_size = 0;
+	decoder->last_cb_ret = 0;
+
+	decoder->au_pos = -1;
+	decoder->nr_ts_in = 0;
+	decoder->nr_out_pics = 0;
+}
+
 /*
  * increment_input()
  *
@@ -461,7 +756,9 @@ static int decode_frame(SHCodecs_Decoder * decoder)
 	static long counter = 0;
 	int input_len;
 	TAVCBD_LAST_FRAME_STATUS status;
+	unsigned long detect = 0;
 
+	memset(&status, 0, sizeof(status));
 	max_mb = decoder->si_mbnum;
 	do {
 		int curr_len = 0;
@@ -472,6 +769,19 @@ static int decode_frame(SHCodecs_Decoder * decoder)
 			return 1;
 		}
 
+		/* After an error, don't spend VPU time on slices that
+		 * reference lost data */
+		if (decoder->resync && skip_nal(decoder)) {
+			decoder->skipped_count++;
+			if (increment_input(decoder, decoder->input_len) < 0)
+				return 1;
+			continue;
+		}
+
+		/* Remember where this picture starts, for timestamping */
+		if (decoder->au_pos < 0)
+			decoder->au_pos = decoder->input_offset + decoder->input_pos;
+
 		if (decoder->format == SHCodecs_Format_H264) {
 			unsigned char *input = decoder->nal_buf;
 			long len = decoder->input_len;
@@ -566,6 +876,16 @@ static int decode_frame(SHCodecs_Decoder * decoder)
 #ifdef DEBUG
 			m4iph_avcbd_perror("avcbd_decode_picture()", status.error_num);
 #endif
+			if (decoder->error_resilience) {
+				/* The middleware conceals the rest of this
+				 * picture; output it and resync at the next
+				 * random access point. */
+				increment_input(decoder, curr_len);
+				decoder->concealed_count++;
+				decoder->resync = 1;
+				err = 0;
+				break;
+			}
 #if 1
 			switch (status.error_num) {
 			case AVCBD_MB_OVERRUN:
@@ -592,6 +912,11 @@ static int decode_frame(SHCodecs_Decoder * decoder)
 		     status.last_macroblock_pos,
 		     max_mb);
 
+		detect |= status.detect_param;
+
+		if (status.detect_param & AVCBD_RECOVERY_POINT_SEI)
+			decoder->resync = 0;
+
 		if (status.detect_param & AVCBD_SPS) {
 			avcbd_get_frame_size(decoder->context, &frame_size);
 			decoder->si_fx = frame_size.width;
@@ -606,12 +931,215 @@ static int decode_frame(SHCodecs_Decoder * decoder)
 	       || (status.last_macroblock_pos < max_mb));
 
 	if (!err) {
+		picture_decoded(decoder, status.poc_top, detect);
 		return 0;
 	} else {
+		decoder->au_pos = -1;
 		return -1;
 	}
 }
 
+/*
+ * picture_decoded()
+ *
+ * Attach the input timestamp and SEI data to a newly decoded picture, to
+ * be picked up when the picture is output.
+ */
+static void picture_decoded(SHCodecs_Decoder * decoder, unsigned long poc, unsigned long detect)
+{
+	struct out_picture *pic;
+	SHCodecs_Decoder_Metadata *meta;
+	int i, n = 0;
+
+	if (detect & AVCBD_IDR)
+		decoder->gop_count++;
+
+	if (decoder->nr_out_pics == TS_QUEUE_SIZE) {
+		memmove(&decoder->out_pics[0], &decoder->out_pics[1],
+			(TS_QUEUE_SIZE - 1) * sizeof(struct out_picture));
+		decoder->nr_out_pics--;
+	}
+
+	pic = &decoder->out_pics[decoder->nr_out_pics++];
+	pic->gop = decoder->gop_count;
+	pic->poc = (decoder->format == SHCodecs_Format_H264) ? poc : 0;
+	pic->ts = SHCODECS_TIMESTAMP_NONE;
+	memset(&pic->arrival, 0, sizeof(pic->arrival));
+
+	meta = &pic->meta;
+	memset(meta, 0, sizeof(*meta));
+	if (decoder->format == SHCodecs_Format_H264) {
+		TAVCBD_SEI *sei = decoder->sei_data;
+
+		if (detect & AVCBD_SPS)
+			decoder->vui_valid = (detect & AVCBD_VUI) != 0;
+
+		if (detect & AVCBD_PIC_TIMING_SEI) {
+			meta->present |= SHCODECS_METADATA_PIC_TIMING;
+			meta->cpb_removal_delay = sei->pic_timing.cpb_removal_delay;
+			meta->dpb_output_delay = sei->pic_timing.dpb_output_delay;
+			meta->pic_struct = sei->pic_timing.pic_struct;
+		}
+		if (detect & AVCBD_RECOVERY_POINT_SEI) {
+			meta->present |= SHCODECS_METADATA_RECOVERY_POINT;
+			meta->recovery_frame_cnt = sei->recovery_point.recovery_frame_cnt;
+			meta->exact_match = sei->recovery_point.exact_match_flag;
+			meta->broken_link = sei->recovery_point.broken_link_flag;
+		}
+	}
+
+	/* The timestamp applying to this picture is the last one set at or
+	 * before the start of its data. Older entries are consumed. */
+	for (i = 0; i < decoder->nr_ts_in; i++) {
+		if (decoder->ts_in[i].pos > decoder->au_pos)
+			break;
+		n = i + 1;
+	}
+	if (n > 0) {
+		pic->ts = decoder->ts_in[n-1].ts;
+		pic->arrival = decoder->ts_in[n-1].arrival;
+		decoder->nr_ts_in -= n;
+		memmove(&decoder->ts_in[0], &decoder->ts_in[n],
+			decoder->nr_ts_in * sizeof(struct ts_input));
+	}
+
+	decoder->au_pos = -1;
+}
+
+/*
+ * picture_metadata()
+ *
+ * Set the metadata of the frame being output from its SEI data and the
+ * current VUI parameters, and flag what changed since the previous frame.
+ */
+static void picture_metadata(SHCodecs_Decoder * decoder, SHCodecs_Decoder_Metadata *meta)
+{
+	SHCodecs_Decoder_Metadata *prev = &decoder->metadata;
+	TAVCBD_VUI_PARAMETERS *vui = decoder->vui_data;
+	int changed = 0;
+
+	if (vui && decoder->vui_valid) {
+		if (vui->timing_info_present_flag) {
+			meta->present |= SHCODECS_METADATA_TIMING;
+			meta->num_units_in_tick = vui->num_units_in_tick;
+			meta->time_scale = vui->time_scale;
+			meta->fixed_frame_rate = vui->fixed_frame_rate_flag;
+		}
+		if (vui->bitstream_restriction_flag) {
+			meta->present |= SHCODECS_METADATA_BUFFERING;
+			meta->num_reorder_frames = vui->num_reorder_frames;
+			meta->max_dec_frame_buffering = vui->max_dec_frame_buffering;
+		}
+	}
+
+	changed = meta->present ^ prev->present;
+
+	if (meta->num_units_in_tick != prev->num_units_in_tick ||
+	    meta->time_scale != prev->time_scale ||
+	    meta->fixed_frame_rate != prev->fixed_frame_rate)
+		changed |= SHCODECS_METADATA_TIMING;
+
+	if (meta->num_reorder_frames != prev->num_reorder_frames ||
+	    meta->max_dec_frame_buffering != prev->max_dec_frame_buffering)
+		changed |= SHCODECS_METADATA_BUFFERING;
+
+	if (meta->cpb_removal_delay != prev->cpb_removal_delay ||
+	    meta->dpb_output_delay != prev->dpb_output_delay ||
+	    meta->pic_struct != prev->pic_struct)
+		changed |= SHCODECS_METADATA_PIC_TIMING;
+
+	if (meta->recovery_frame_cnt != prev->recovery_frame_cnt ||
+	    meta->exact_match != prev->exact_match ||
+	    meta->broken_link != prev->broken_link)
+		changed |= SHCODECS_METADATA_RECOVERY_POINT;
+
+	meta->changed = changed;
+	*prev = *meta;
+}
+
+/*
+ * picture_output()
+ *
+ * Find the timestamp of the next picture in output order and compute its
+ * latency. Pictures are output in picture order count order, and the
+ * POC is reset at each IDR.
+ */
+static void picture_output(SHCodecs_Decoder * decoder)
+{
+	struct out_picture *pic;
+	struct timespec now;
+	int i, best = 0;
+
+	decoder->frame_ts = SHCODECS_TIMESTAMP_NONE;
+	decoder->frame_latency = -1;
+
+	if (decoder->nr_out_pics == 0) {
+		decoder->metadata.changed = 0;
+		return;
+	}
+
+	for (i = 1; i < decoder->nr_out_pics; i++) {
+		struct out_picture *a = &decoder->out_pics[i];
+		struct out_picture *b = &decoder->out_pics[best];
+
+		if (a->gop < b->gop ||
+		    (a->gop == b->gop && a->poc < b->poc))
+			best = i;
+	}
+
+	pic = &decoder->out_pics[best];
+	decoder->frame_ts = pic->ts;
+	if (pic->arrival.tv_sec || pic->arrival.tv_nsec) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		decoder->frame_latency = (now.tv_sec - pic->arrival.tv_sec) * 1000000 +
+			(now.tv_nsec - pic->arrival.tv_nsec) / 1000;
+	}
+
+	picture_metadata(decoder, &pic->meta);
+
+	decoder->nr_out_pics--;
+	memmove(pic, pic + 1, (decoder->nr_out_pics - best) * sizeof(struct out_picture));
+}
+
+/*
+ * skip_nal()
+ *
+ * Check whether the NAL unit in nal_buf should be skipped while waiting
+ * for a random access point. Parameter sets and SEI are always decoded,
+ * so that a recovery point SEI can end the resync.
+ */
+static int skip_nal(SHCodecs_Decoder * decoder)
+{
+	unsigned char *nal = decoder->nal_buf;
+	long len = decoder->input_len;
+	int nal_type;
+
+	/* Skip the start code */
+	while (len > 1 && *nal == 0) {
+		nal++;
+		len--;
+	}
+	nal++;
+	len--;
+	if (len <= 0)
+		return 0;
+
+	nal_type = *nal & 0x1f;
+
+	switch (nal_type) {
+	case AVCBD_NAL_IDR_PIC:
+		decoder->resync = 0;
+		return 0;
+	case AVCBD_NAL_NON_IDR_PIC:
+	case AVCBD_NAL_SLICE_DP_A:
+	case AVCBD_NAL_SLICE_DP_B:
+	case AVCBD_NAL_SLICE_DP_C:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 /*
  * extract_frame: extract a decoded frame from the VPU
  *
@@ -625,6 +1153,8 @@ static int extract_frame(SHCodecs_Decoder * decoder, long frame_index)
 
 	debug_printf("%s: output frame %d, frame_index=%d\n", __func__, decoder->frame_count, frame_index);
 
+	picture_output(decoder);
+
 	/* Call user's output callback */
 	if (decoder->decoded_cb) {
 		yf = m4iph_addr_to_virt(decoder->vpu, frame->Y_fmemp);
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <time.h>
 
 #include "m4driverif.h"
 #include "encoder_private.h"
@@ -36,6 +37,10 @@
 /* TODO min size has not been verified, just taken from sample code */
 #define MIN_STREAM_BUFF_SIZE (160000*4)
 
+/* The VPU ends a slice after the macroblock that reaches the size limit,
+   so a slice can overrun it by up to a macroblock */
+#define SLICE_OVERRUN_BYTES 512
+
 
 static unsigned long
 work_area_size (SHCodecs_Encoder * encoder)
@@ -115,38 +120,75 @@ void shcodecs_encoder_close(SHCodecs_Encoder * encoder)
 
 	if (encoder == NULL) return;
 
-	width_height = ROUND_UP_16(encoder->width) * ROUND_UP_16(encoder->height);
-	width_height += (width_height / 2);
+	shcodecs_encoder_stop_async(encoder);
+
+	if (encoder->format == SHCodecs_Format_H264) {
+		h264_encode_close(encoder);
+	} else {
+		mpeg4_encode_close(encoder);
+	}
+
+	width_height = encoder->alloc_y_bytes + encoder->alloc_y_bytes/2;
 
 	/* Local input frame */
 	if (encoder->input_frame) {
 		m4iph_sdr_free(encoder->vpu, encoder->input_frame, width_height);
 	}
 
+	/* Input buffer pool */
+	for (i=0; i<encoder->nr_input_bufs; i++) {
+		m4iph_sdr_free(encoder->vpu, encoder->input_bufs[i].phys, width_height);
+	}
+	pthread_mutex_destroy(&encoder->input_bufs_mutex);
+	pthread_mutex_destroy(&encoder->change_mutex);
+
 	/* Local decode images */
-	for (i=0; i<NUM_LDEC_FRAMES; i++) {
+	for (i=0; i<MAX_LDEC_FRAMES; i++) {
 		if (encoder->local_frames[i].Y_fmemp)
 			m4iph_sdr_free(encoder->vpu, encoder->local_frames[i].Y_fmemp, width_height);
 	}
 
-	if (encoder->format == SHCodecs_Format_H264) {
-		h264_encode_close(encoder);
-	}
-
 	free(encoder->backup_area.area_top);
 	free(encoder->work_area.area_top);
 	free(encoder->stream_buff_info.buff_top);
 	free(encoder->end_code_buff_info.buff_top);
-
+	free(encoder->slice_bits);
+	free(encoder->roi_table);
+	free(encoder->roi_pending_table);
+	encoder_rc_close(encoder);
+	encoder_scene_close(encoder);
+
+	if (encoder->vpu)
+		m4iph_vpu_disown(encoder->vpu, encoder);
 	m4iph_vpu_close(encoder->vpu);
 
 	free(encoder);
 }
 
+/* Set the parameters of a new stream to their defaults */
 static int
-shcodecs_encoder_global_init (SHCodecs_Encoder *encoder)
+encoder_set_defaults (SHCodecs_Encoder *encoder)
 {
-	if ((encoder->vpu = m4iph_vpu_open(dimension_stream_buff_size (encoder->width, encoder->height))) == NULL)
+	encoder->frame_no_increment = 1;
+	encoder->input_timestamp = SHCODECS_TIMESTAMP_NONE;
+
+	init_other_API_enc_param(&encoder->other_API_enc_param);
+
+	if (encoder->format == SHCodecs_Format_H264) {
+		encoder->stream_type = AVCBE_H264;
+		return h264_encode_defaults (encoder);
+	} else {
+		encoder->stream_type = AVCBE_MPEG4;
+		return mpeg4_encode_init (encoder);
+	}
+}
+
+static int
+shcodecs_encoder_global_init (SHCodecs_Encoder *encoder, void *shared_vpu)
+{
+	if (shared_vpu)
+		encoder->vpu = m4iph_vpu_ref(shared_vpu);
+	else if ((encoder->vpu = m4iph_vpu_open(dimension_stream_buff_size (encoder->width, encoder->height))) == NULL)
 		return -1;
 
 	m4iph_vpu_lock(encoder->vpu);
@@ -156,22 +198,14 @@ shcodecs_encoder_global_init (SHCodecs_Encoder *encoder)
 	return 0;
 }
 
-/**
- * Initialize the VPU4 for encoding a given video format.
- * \param width The video image width
- * \param height The video image height
- * \param format SHCodecs_Format_MPEG4 or SHCODECS_Format_H264
- * \return encoder The SHCodecs_Encoder* handle
- */
-SHCodecs_Encoder *shcodecs_encoder_init(int width, int height,
-					SHCodecs_Format format)
+/* Create an encoder, sharing the VPU data of another instance if
+ * shared_vpu is not NULL */
+SHCodecs_Encoder *encoder_init_vpu(int width, int height,
+				   SHCodecs_Format format, void *shared_vpu)
 {
 	SHCodecs_Encoder *encoder;
 	long return_code;
-	long width_height;
 	unsigned long buf_size;
-	unsigned char *pY;
-	int i;
 
 	encoder = calloc(1, sizeof(SHCodecs_Encoder));
 	if (encoder == NULL)
@@ -196,22 +230,14 @@ SHCodecs_Encoder *shcodecs_encoder_init(int width, int height,
 	encoder->output_filler_enable = 0;
 	encoder->output_filler_data = 0;
 
-	if (shcodecs_encoder_global_init (encoder) < 0)
-		goto err;
+	pthread_mutex_init(&encoder->input_bufs_mutex, NULL);
+	pthread_mutex_init(&encoder->change_mutex, NULL);
 
-	width_height = ROUND_UP_16(encoder->width) * ROUND_UP_16(encoder->height);
-	width_height += (width_height / 2);
+	if (shcodecs_encoder_global_init (encoder, shared_vpu) < 0)
+		goto err;
 
 	encoder->y_bytes = (((encoder->width + 15) / 16) * 16) * (((encoder->height + 15) / 16) * 16);
-
-	/* Local decode images. This is the number of reference frames plus one
-	   for the locally decoded output */
-	for (i=0; i<NUM_LDEC_FRAMES; i++) {
-		pY = m4iph_sdr_malloc(encoder->vpu, width_height, 32);
-		if (!pY) goto err;
-		encoder->local_frames[i].Y_fmemp = pY;
-		encoder->local_frames[i].C_fmemp = pY + encoder->y_bytes;
-	}
+	encoder->alloc_y_bytes = encoder->y_bytes;
 
 	buf_size = work_area_size(encoder);
 	encoder->work_area.area_size = buf_size;
@@ -236,15 +262,13 @@ SHCodecs_Encoder *shcodecs_encoder_init(int width, int height,
 	if (!encoder->end_code_buff_info.buff_top)
 		goto err;
 
-	init_other_API_enc_param(&encoder->other_API_enc_param);
-
 	if (encoder->format == SHCodecs_Format_H264) {
-		encoder->stream_type = AVCBE_H264;
 		return_code = h264_encode_init (encoder);
-	} else {
-		encoder->stream_type = AVCBE_MPEG4;
-		return_code = mpeg4_encode_init (encoder);
+		if (return_code < 0)
+			goto err;
 	}
+
+	return_code = encoder_set_defaults (encoder);
 	if (return_code < 0)
 		goto err;
 
@@ -257,6 +281,159 @@ err:
 	return NULL;
 }
 
+/**
+ * Initialize the VPU4 for encoding a given video format.
+ * \param width The video image width
+ * \param height The video image height
+ * \param format SHCodecs_Format_MPEG4 or SHCODECS_Format_H264
+ * \return encoder The SHCodecs_Encoder* handle
+ */
+SHCodecs_Encoder *shcodecs_encoder_init(int width, int height,
+					SHCodecs_Format format)
+{
+	return encoder_init_vpu(width, height, format, NULL);
+}
+
+/**
+ * Reset an encoder to the state of a new encoder of the given size,
+ * keeping its buffers and callbacks.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param width The new video image width
+ * \param height The new video image height
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, asynchronous encoding is running, the new
+ * size does not fit the buffers, or out of memory
+ */
+int
+shcodecs_encoder_reset(SHCodecs_Encoder * encoder, int width, int height)
+{
+	SHCodecs_Encoder *old;
+	unsigned long stream_size;
+	int y_bytes, i;
+
+	if (encoder == NULL || width <= 0 || height <= 0) return -1;
+
+	if (encoder->async)
+		return -1;
+
+	y_bytes = ROUND_UP_16(width) * ROUND_UP_16(height);
+	stream_size = dimension_stream_buff_size(width, height);
+	if (encoder->au_iov)
+		stream_size *= 2;
+	if (y_bytes > encoder->alloc_y_bytes ||
+	    stream_size > encoder->stream_buff_info.buff_size)
+		return -1;
+
+	old = malloc(sizeof(*old));
+	if (old == NULL)
+		return -1;
+
+	/* Drop the current stream */
+	if (encoder->format != SHCodecs_Format_H264)
+		mpeg4_encode_reset(encoder);
+	if (encoder->vpu)
+		m4iph_vpu_disown(encoder->vpu, encoder);
+
+	free(encoder->roi_table);
+	free(encoder->roi_pending_table);
+	encoder_rc_close(encoder);
+	encoder_scene_close(encoder);
+	pthread_mutex_destroy(&encoder->input_bufs_mutex);
+	pthread_mutex_destroy(&encoder->change_mutex);
+
+	*old = *encoder;
+	memset(encoder, 0, sizeof(*encoder));
+
+	encoder->vpu = old->vpu;
+	encoder->width = width;
+	encoder->height = height;
+	encoder->format = old->format;
+	encoder->y_bytes = y_bytes;
+	encoder->alloc_y_bytes = old->alloc_y_bytes;
+
+	/* Callbacks */
+	encoder->input = old->input;
+	encoder->input_user_data = old->input_user_data;
+	encoder->release = old->release;
+	encoder->release_user_data = old->release_user_data;
+	encoder->output = old->output;
+	encoder->output_user_data = old->output_user_data;
+	encoder->output_buffer = old->output_buffer;
+	encoder->output_buffer_user_data = old->output_buffer_user_data;
+	encoder->slice_output = old->slice_output;
+	encoder->slice_output_user_data = old->slice_output_user_data;
+	encoder->au_output = old->au_output;
+	encoder->au_output_user_data = old->au_output_user_data;
+	encoder->frame_stats_cb = old->frame_stats_cb;
+	encoder->frame_stats_user_data = old->frame_stats_user_data;
+
+	/* Buffers */
+	encoder->input_frame = old->input_frame;
+	memcpy(encoder->input_bufs, old->input_bufs, sizeof(encoder->input_bufs));
+	encoder->nr_input_bufs = old->nr_input_bufs;
+	memcpy(encoder->input_copies, old->input_copies, sizeof(encoder->input_copies));
+	encoder->nr_local_frames = old->nr_local_frames;
+	for (i=0; i<old->nr_local_frames; i++) {
+		encoder->local_frames[i].Y_fmemp = old->local_frames[i].Y_fmemp;
+		encoder->local_frames[i].C_fmemp = old->local_frames[i].Y_fmemp + y_bytes;
+	}
+	encoder->work_area = old->work_area;
+	encoder->backup_area = old->backup_area;
+	encoder->stream_buff_info = old->stream_buff_info;
+	encoder->end_code_buff_info = old->end_code_buff_info;
+	encoder->aud_buf_info = old->aud_buf_info;
+	encoder->sps_buf_info = old->sps_buf_info;
+	encoder->pps_buf_info = old->pps_buf_info;
+	encoder->sei_buf_info = old->sei_buf_info;
+	encoder->au_iov = old->au_iov;
+	encoder->au_max_segments = old->au_max_segments;
+	encoder->slice_bits = old->slice_bits;
+	encoder->max_slices = old->max_slices;
+
+	free(old);
+
+	pthread_mutex_init(&encoder->input_bufs_mutex, NULL);
+	pthread_mutex_init(&encoder->change_mutex, NULL);
+
+	if (encoder_set_defaults(encoder) < 0)
+		return -1;
+
+	encoder->initialized = 1;
+
+	return 0;
+}
+
+/* Allocate local decode images for nrefframe reference frames plus one
+ * for the locally decoded output. Images already allocated are kept.
+ * This must be done outside the VPU lock, as UIOMux malloc also locks it. */
+int
+encoder_alloc_local_frames(SHCodecs_Encoder *enc, int nrefframe)
+{
+	unsigned char *pY;
+	int i;
+
+	while (enc->nr_local_frames < nrefframe+1) {
+		i = enc->nr_local_frames;
+		pY = m4iph_sdr_malloc(enc->vpu, (enc->alloc_y_bytes*3)/2, 32);
+		if (!pY)
+			return -1;
+		enc->local_frames[i].Y_fmemp = pY;
+		enc->local_frames[i].C_fmemp = pY + enc->y_bytes;
+		enc->nr_local_frames++;
+	}
+
+	return 0;
+}
+
+/* Account for an input frame that was not encoded, so that the frame
+ * numbers seen by the VPU keep pace with the input */
+void
+encoder_skip_frame(SHCodecs_Encoder *enc)
+{
+	if (enc->initialized >= 3)
+		enc->frm += enc->frame_no_increment;
+}
+
 /**
  * Set the callback for libshcodecs to call when raw YUV data is required.
  * \param encoder The SHCodecs_Encoder* handle
@@ -298,6 +475,118 @@ shcodecs_encoder_get_input_user_data(SHCodecs_Encoder *encoder)
 	return encoder->release_user_data_buffer;
 }
 
+/**
+ * Allocate input buffers owned by the encoder.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param nr_buffers The number of buffers to allocate
+ * \retval 0 Success
+ * \retval -1 Invalid number of buffers, buffers already allocated, or out of memory
+ */
+int
+shcodecs_encoder_alloc_input_buffers(SHCodecs_Encoder * encoder, int nr_buffers)
+{
+	unsigned long size;
+	unsigned char *pY;
+	int i;
+
+	if (encoder == NULL) return -1;
+
+	if (nr_buffers < 1 || nr_buffers > MAX_INPUT_BUFFERS)
+		return -1;
+
+	if (encoder->nr_input_bufs > 0)
+		return -1;
+
+	size = encoder->alloc_y_bytes + encoder->alloc_y_bytes/2;
+
+	for (i=0; i<nr_buffers; i++) {
+		pY = m4iph_sdr_malloc(encoder->vpu, size, 32);
+		if (!pY)
+			return -1;
+		encoder->input_bufs[i].phys = pY;
+		encoder->input_bufs[i].virt = m4iph_addr_to_virt(encoder->vpu, pY);
+		encoder->input_bufs[i].in_use = 0;
+		encoder->nr_input_bufs++;
+	}
+
+	return 0;
+}
+
+/**
+ * Get a free input buffer from those allocated by
+ * shcodecs_encoder_alloc_input_buffers().
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input Returns the Y plane of the buffer
+ * \param c_input Returns the CbCr plane of the buffer
+ * \retval 0 Success
+ * \retval -1 No buffer is free
+ */
+int
+shcodecs_encoder_get_input_buffer(SHCodecs_Encoder * encoder,
+				  unsigned char **y_input,
+				  unsigned char **c_input)
+{
+	int i, ret = -1;
+
+	if (encoder == NULL) return -1;
+
+	pthread_mutex_lock(&encoder->input_bufs_mutex);
+	for (i=0; i<encoder->nr_input_bufs; i++) {
+		if (!encoder->input_bufs[i].in_use) {
+			encoder->input_bufs[i].in_use = 1;
+			*y_input = encoder->input_bufs[i].virt;
+			*c_input = encoder->input_bufs[i].virt + encoder->y_bytes;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&encoder->input_bufs_mutex);
+
+	return ret;
+}
+
+/**
+ * Return an input buffer to the pool without encoding it.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param y_input The Y plane of the buffer, as returned by
+ * shcodecs_encoder_get_input_buffer()
+ * \retval 0 Success
+ * \retval -1 Not an encoder input buffer
+ */
+int
+shcodecs_encoder_put_input_buffer(SHCodecs_Encoder * encoder,
+				  unsigned char *y_input)
+{
+	int i, ret = -1;
+
+	if (encoder == NULL) return -1;
+
+	pthread_mutex_lock(&encoder->input_bufs_mutex);
+	for (i=0; i<encoder->nr_input_bufs; i++) {
+		if (encoder->input_bufs[i].virt == y_input) {
+			encoder->input_bufs[i].in_use = 0;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&encoder->input_bufs_mutex);
+
+	return ret;
+}
+
+/* Called by the encoder backends once the VPU has finished with an input
+ * frame. Buffers from the pool become free again after the user's release
+ * callback has been run. */
+void
+encoder_release_input(SHCodecs_Encoder *enc, void *py, void *pc)
+{
+	if (enc->release)
+		enc->release(enc, py, pc, enc->release_user_data);
+
+	if (enc->nr_input_bufs > 0)
+		shcodecs_encoder_put_input_buffer(enc, py);
+}
+
 /**
  * Set the callback for libshcodecs to call when encoded data is available.
  * \param encoder The SHCodecs_Encoder* handle
@@ -315,6 +604,64 @@ shcodecs_encoder_set_output_callback(SHCodecs_Encoder * encoder,
 	return 0;
 }
 
+/**
+ * Set the callback for libshcodecs to call for a buffer to encode each
+ * picture or slice into.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param output_buffer_cb The callback function, or NULL
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_set_output_buffer_callback(SHCodecs_Encoder * encoder,
+					    SHCodecs_Encoder_Output_Buffer output_buffer_cb,
+					    void *user_data)
+{
+	if (encoder == NULL) return -1;
+
+	encoder->output_buffer = output_buffer_cb;
+	encoder->output_buffer_user_data = user_data;
+
+	return 0;
+}
+
+/* Get the buffer to encode the next picture, or H.264 slice, into. The
+ * application's buffer is used if it can hold the largest unit the VPU may
+ * output, otherwise the unit is encoded into the encoder's own buffer at
+ * offset, and the application is asked again for the next unit. */
+void
+encoder_get_output_buffer(SHCodecs_Encoder *enc, long offset,
+			  TAVCBE_STREAM_BUFF *buff)
+{
+	avcbe_other_options_h264 *options = &enc->other_options_h264;
+	unsigned char *buf = NULL;
+	long max_bytes, slice_max;
+	int size = 0;
+
+	if (enc->output_buffer) {
+		max_bytes = encoder_stream_buff_size(enc);
+		if (enc->format == SHCodecs_Format_H264 &&
+		    options->avcbe_use_slice == AVCBE_ON &&
+		    options->avcbe_slice_size_bit > 0) {
+			slice_max = (long)(options->avcbe_slice_size_bit / 8) + SLICE_OVERRUN_BYTES;
+			if (slice_max < max_bytes)
+				max_bytes = slice_max;
+		}
+
+		buf = enc->output_buffer(enc, max_bytes, &size,
+					 enc->output_buffer_user_data);
+		if (buf && size >= max_bytes) {
+			buff->buff_top = buf;
+			buff->buff_size = size;
+			return;
+		}
+	}
+
+	buff->buff_top = enc->stream_buff_info.buff_top + offset;
+	buff->buff_size = enc->stream_buff_info.buff_size - offset;
+}
+
 /**
  * Run the encoder.
  * \param encoder The SHCodecs_Encoder* handle
@@ -332,6 +679,17 @@ int shcodecs_encoder_run(SHCodecs_Encoder * encoder)
 	}
 }
 
+/* Encode a frame with the timestamp it was submitted with */
+int
+encoder_encode_1frame(SHCodecs_Encoder *enc, void *py, void *pc,
+		      void *user_data, SHCodecs_Timestamp ts)
+{
+	if (enc->format == SHCodecs_Format_H264)
+		return h264_encode_1frame (enc, py, pc, user_data, ts);
+	else
+		return mpeg4_encode_1frame (enc, py, pc, user_data, ts);
+}
+
 int
 shcodecs_encoder_encode_1frame(SHCodecs_Encoder * encoder,
 	void *y_input,
@@ -341,10 +699,62 @@ shcodecs_encoder_encode_1frame(SHCodecs_Encoder * encoder,
 	if (encoder == NULL)
 		return -1;
 
-	if (encoder->format == SHCodecs_Format_H264)
-		return h264_encode_1frame (encoder, y_input, c_input, user_data);
-	else
-		return mpeg4_encode_1frame (encoder, y_input, c_input, user_data);
+	return encoder_encode_1frame (encoder, y_input, c_input, user_data,
+				      encoder_take_input_timestamp (encoder));
+}
+
+/* Get the timestamp set for the next input frame, which is used up */
+SHCodecs_Timestamp
+encoder_take_input_timestamp(SHCodecs_Encoder *enc)
+{
+	SHCodecs_Timestamp ts = enc->input_timestamp;
+
+	enc->input_timestamp = SHCODECS_TIMESTAMP_NONE;
+	return ts;
+}
+
+/**
+ * Set the timestamp of the next input frame.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param ts The timestamp
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_set_input_timestamp(SHCodecs_Encoder * encoder,
+				     SHCodecs_Timestamp ts)
+{
+	if (encoder == NULL) return -1;
+
+	encoder->input_timestamp = ts;
+
+	return 0;
+}
+
+/**
+ * Get the timestamp of the frame currently being output.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \returns The timestamp, or SHCODECS_TIMESTAMP_NONE
+ */
+SHCodecs_Timestamp
+shcodecs_encoder_get_output_timestamp(SHCodecs_Encoder * encoder)
+{
+	if (encoder == NULL) return SHCODECS_TIMESTAMP_NONE;
+
+	return encoder->frame_stats.timestamp;
+}
+
+/**
+ * Get the user data of the frame currently being output.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \returns The user data passed with the input frame, or NULL
+ */
+void *
+shcodecs_encoder_get_output_user_data(SHCodecs_Encoder * encoder)
+{
+	if (encoder == NULL) return NULL;
+
+	return encoder->frame_stats.user_data;
 }
 
 int
@@ -372,6 +782,405 @@ shcodecs_encoder_input_provide (SHCodecs_Encoder * encoder,
 	return 0;
 }
 
+/* The middleware accepts frame rates up to 30fps. Above that, give it 30fps
+ * and scale the bitrate so that the bits per frame are unchanged. */
+void
+encoder_middleware_rate(SHCodecs_Encoder *enc, long *bitrate, long *fps_x10)
+{
+	*bitrate = enc->actual_bitrate;
+	*fps_x10 = enc->actual_fps_x10;
+
+	if (enc->actual_fps_x10 > 300) {
+		*fps_x10 = 300;
+		*bitrate = enc->actual_bitrate * 300 / enc->actual_fps_x10;
+	}
+}
+
+static unsigned long
+param_changeable(SHCodecs_Encoder *enc, unsigned long *max_bitrate)
+{
+	if (enc->format == SHCodecs_Format_H264) {
+		*max_bitrate = enc->other_options_h264.avcbe_changeable_max_bitrate;
+		return enc->other_options_h264.avcbe_param_changeable;
+	} else {
+		*max_bitrate = enc->other_options_mpeg4.avcbe_changeable_max_bitrate;
+		return enc->other_options_mpeg4.avcbe_param_changeable;
+	}
+}
+
+/* Check that a parameter may be changed now. Before encoding starts,
+ * anything goes as the parameters have not been given to the middleware. */
+static int
+change_allowed(SHCodecs_Encoder *enc, long bitrate)
+{
+	unsigned long max_bitrate;
+
+	if (enc->initialized < 2)
+		return 1;
+
+	if (param_changeable(enc, &max_bitrate) != AVCBE_ON)
+		return 0;
+
+	if (max_bitrate > 0 && bitrate > (long)max_bitrate)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Change the target bitrate while encoding.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param bitrate The new bitrate in bits per second
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or the change is not allowed
+ */
+int
+shcodecs_encoder_change_bitrate(SHCodecs_Encoder * encoder, long bitrate)
+{
+	int ret = -1;
+
+	if (encoder == NULL || bitrate <= 0) return -1;
+
+	pthread_mutex_lock(&encoder->change_mutex);
+	if (change_allowed(encoder, bitrate)) {
+		encoder->actual_bitrate = bitrate;
+		encoder->change_pending = (encoder->initialized >= 2);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&encoder->change_mutex);
+
+	return ret;
+}
+
+/**
+ * Change the frame rate while encoding.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param frame_rate The new frame rate x10 (i.e. 300=30fps)
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or the change is not allowed
+ */
+int
+shcodecs_encoder_change_frame_rate(SHCodecs_Encoder * encoder, long frame_rate)
+{
+	int ret = -1;
+
+	if (encoder == NULL || frame_rate <= 0) return -1;
+
+	pthread_mutex_lock(&encoder->change_mutex);
+	if (change_allowed(encoder, encoder->actual_bitrate)) {
+		encoder->actual_fps_x10 = frame_rate;
+		encoder->change_pending = (encoder->initialized >= 2);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&encoder->change_mutex);
+
+	return ret;
+}
+
+/**
+ * Change the I-frame interval while encoding.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param I_vop_interval The new interval in frames
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or the change is not allowed
+ */
+int
+shcodecs_encoder_change_I_vop_interval(SHCodecs_Encoder * encoder, long I_vop_interval)
+{
+	int ret = -1;
+
+	if (encoder == NULL || I_vop_interval < 0) return -1;
+
+	pthread_mutex_lock(&encoder->change_mutex);
+	if (change_allowed(encoder, encoder->actual_bitrate)) {
+		encoder->encoding_property.avcbe_I_vop_interval = I_vop_interval;
+		encoder->change_pending = (encoder->initialized >= 2);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&encoder->change_mutex);
+
+	return ret;
+}
+
+/* Give pending parameter changes to the middleware. Called by the encoder
+ * backends with the VPU locked and the stream context restored.
+ * Returns 0 on success, or a middleware error code. */
+long
+encoder_apply_changes(SHCodecs_Encoder *enc)
+{
+	avcbe_property_after_change change;
+	unsigned long max_bitrate;
+	double scale;
+	int rescale;
+	long rc;
+
+	rc = encoder_apply_roi(enc);
+	if (rc != 0)
+		return rc;
+
+	pthread_mutex_lock(&enc->change_mutex);
+	rescale = encoder_rc_scale(enc, &scale);
+	if (!enc->change_pending && !rescale) {
+		pthread_mutex_unlock(&enc->change_mutex);
+		return 0;
+	}
+	enc->change_pending = 0;
+
+	encoder_middleware_rate(enc, &change.avcbe_bitrate, &change.avcbe_frame_rate);
+
+	/* Lookahead rate control scales the bitrate of each frame */
+	if (enc->rc) {
+		change.avcbe_bitrate = change.avcbe_bitrate * scale;
+		param_changeable(enc, &max_bitrate);
+		if (max_bitrate > 0 && change.avcbe_bitrate > (long)max_bitrate)
+			change.avcbe_bitrate = max_bitrate;
+	}
+	change.avcbe_I_vop_interval = enc->encoding_property.avcbe_I_vop_interval;
+
+	/* The periodic rate control reset depends on the bitrate */
+	if (enc->bitrate_control_enabled) {
+		enc->idr_interval = change.avcbe_I_vop_interval;
+		enc->reset_interval = (240000000 / enc->actual_bitrate) * 60;
+	}
+	pthread_mutex_unlock(&enc->change_mutex);
+
+	rc = avcbe_change_enc_param(enc->stream_info,
+				    AVCBE_CHANGE_ENCODING_PROPERTY, &change);
+	if (rc != 0)
+		return rc;
+
+	enc->encoding_property.avcbe_bitrate = change.avcbe_bitrate;
+	enc->encoding_property.avcbe_frame_rate = change.avcbe_frame_rate;
+
+	return 0;
+}
+
+/**
+ * Force the next frame to be encoded as a keyframe.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_force_keyframe(SHCodecs_Encoder * encoder)
+{
+	if (encoder == NULL) return -1;
+
+	pthread_mutex_lock(&encoder->change_mutex);
+	if (encoder->format == SHCodecs_Format_H264)
+		encoder->set_intra = AVCBE_FORCE_IDR_VOP;
+	else
+		encoder->set_intra = AVCBE_FORCE_I_VOP;
+	pthread_mutex_unlock(&encoder->change_mutex);
+
+	return 0;
+}
+
+/**
+ * Use gradual intra refresh instead of periodic keyframes.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param cycle The intra refresh cycle in frames, or 0 to disable
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or encoding has started
+ */
+int
+shcodecs_encoder_set_intra_refresh(SHCodecs_Encoder * encoder, long cycle)
+{
+	if (encoder == NULL || cycle < 0) return -1;
+
+	if (encoder->initialized >= 2)
+		return -1;
+
+	encoder->encoding_property.avcbe_intra_macroblock_refresh_cycle = cycle;
+	if (cycle > 0)
+		encoder->encoding_property.avcbe_I_vop_interval = 0;
+
+	return 0;
+}
+
+/**
+ * Get keyframe statistics.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param stats Returns the statistics
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid
+ */
+int
+shcodecs_encoder_get_keyframe_stats(SHCodecs_Encoder * encoder,
+				    SHCodecs_Encoder_Keyframe_Stats * stats)
+{
+	if (encoder == NULL || stats == NULL) return -1;
+
+	pthread_mutex_lock(&encoder->change_mutex);
+	*stats = encoder->keyframe_stats;
+	pthread_mutex_unlock(&encoder->change_mutex);
+
+	return 0;
+}
+
+/* Get the set_intra argument for the next frame */
+long
+encoder_get_set_intra(SHCodecs_Encoder *enc)
+{
+	long set_intra;
+
+	pthread_mutex_lock(&enc->change_mutex);
+	set_intra = enc->set_intra;
+	pthread_mutex_unlock(&enc->change_mutex);
+
+	return set_intra;
+}
+
+/* Called by the encoder backends for each frame that was not skipped.
+ * A keyframe satisfies any pending request for one. */
+void
+encoder_frame_encoded(SHCodecs_Encoder *enc, int keyframe, long bytes)
+{
+	SHCodecs_Encoder_Keyframe_Stats *stats = &enc->keyframe_stats;
+
+	pthread_mutex_lock(&enc->change_mutex);
+
+	stats->nr_frames++;
+
+	if (keyframe) {
+		if (enc->set_intra != AVCBE_ANY_VOP) {
+			stats->nr_forced++;
+			enc->set_intra = AVCBE_ANY_VOP;
+		}
+		stats->nr_keyframes++;
+		stats->last_keyframe_bytes = bytes;
+		if (bytes > stats->max_keyframe_bytes)
+			stats->max_keyframe_bytes = bytes;
+		stats->keyframe_bytes += bytes;
+		stats->last_interval = stats->frames_since_keyframe;
+		stats->frames_since_keyframe = 0;
+	}
+
+	stats->frames_since_keyframe++;
+
+	pthread_mutex_unlock(&enc->change_mutex);
+}
+
+/**
+ * Set the callback for libshcodecs to call with the statistics of each
+ * input frame.
+ * \param encoder The SHCodecs_Encoder* handle
+ * \param frame_stats_cb The callback function, or NULL
+ * \param user_data Additional data to pass to the callback function
+ * \retval 0 Success
+ * \retval -1 \a encoder invalid, or out of memory
+ */
+int
+shcodecs_encoder_set_frame_stats_callback(SHCodecs_Encoder * encoder,
+					  SHCodecs_Encoder_Frame_Stats_Callback frame_stats_cb,
+					  void * user_data)
+{
+	int nr_mbs;
+
+	if (encoder == NULL) return -1;
+
+	/* A slice holds at least one macroblock */
+	if (frame_stats_cb && !encoder->slice_bits) {
+		nr_mbs = (ROUND_UP_16(encoder->width) / 16) *
+			 (ROUND_UP_16(encoder->height) / 16);
+		encoder->slice_bits = calloc(nr_mbs, sizeof(long));
+		if (!encoder->slice_bits)
+			return -1;
+		encoder->max_slices = nr_mbs;
+	}
+
+	encoder->frame_stats_cb = frame_stats_cb;
+	encoder->frame_stats_user_data = user_data;
+
+	return 0;
+}
+
+double
+encoder_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Start the statistics of an input frame, on entry to encode_1frame */
+void
+encoder_stats_begin(SHCodecs_Encoder *enc)
+{
+	memset(&enc->frame_stats, 0, sizeof(enc->frame_stats));
+	enc->frame_stats.frame_number = enc->frm;
+	enc->frame_stats.timestamp = SHCODECS_TIMESTAMP_NONE;
+	enc->frame_stats.slice_bits = enc->slice_bits;
+	enc->qp_sum = 0;
+	enc->qp_mbs = 0;
+	enc->frame_start_ms = encoder_now_ms();
+}
+
+/* Save the stream context, when another user of the VPU takes over from
+ * this encoder */
+static void
+encoder_save_context(void *owner)
+{
+	SHCodecs_Encoder *enc = (SHCodecs_Encoder *)owner;
+
+	if (enc->frame_counter == 0)
+		return;
+
+	if (avcbe_get_backup(enc->stream_info, &enc->backup_area) == 0)
+		enc->context_saved = 1;
+}
+
+/* Lock the VPU, accounting for the time spent waiting. The stream context
+ * needs to be restored if it was saved since the encoder last had the VPU. */
+void
+encoder_stats_lock(SHCodecs_Encoder *enc)
+{
+	double start = encoder_now_ms();
+
+	m4iph_vpu_lock_owner(enc->vpu, enc, encoder_save_context);
+	enc->frame_stats.lock_wait_ms += encoder_now_ms() - start;
+}
+
+/* Called by the encoder backends for each encoded slice (MPEG-4: picture) */
+void
+encoder_stats_slice(SHCodecs_Encoder *enc, SHCodecs_Picture_Type pic_type,
+		    long bits, long quant, long nr_mbs)
+{
+	SHCodecs_Encoder_Frame_Stats *stats = &enc->frame_stats;
+
+	stats->pic_type = pic_type;
+	stats->bits += bits;
+	if (stats->nr_slices < enc->max_slices)
+		enc->slice_bits[stats->nr_slices] = bits;
+	stats->nr_slices++;
+
+	enc->qp_sum += (double)quant * nr_mbs;
+	enc->qp_mbs += nr_mbs;
+}
+
+/* Complete the statistics of an input frame, once the VPU is unlocked.
+ * Returns the value returned by the frame statistics callback */
+int
+encoder_stats_end(SHCodecs_Encoder *enc)
+{
+	SHCodecs_Encoder_Frame_Stats *stats = &enc->frame_stats;
+
+	if (enc->scene)
+		encoder_scene_end_frame(enc);
+
+	if (!enc->frame_stats_cb)
+		return 0;
+
+	if (stats->nr_slices > enc->max_slices)
+		stats->nr_slices = enc->max_slices;
+	if (enc->qp_mbs > 0)
+		stats->average_qp = enc->qp_sum / enc->qp_mbs;
+	stats->wall_ms = encoder_now_ms() - enc->frame_start_ms;
+
+	return enc->frame_stats_cb(enc, stats, enc->frame_stats_user_data);
+}
+
 int
 shcodecs_encoder_get_width (SHCodecs_Encoder * encoder)
 {
@@ -404,7 +1213,7 @@ shcodecs_encoder_get_min_input_frames(SHCodecs_Encoder *encoder)
 	if (encoder->format == SHCodecs_Format_H264) {
 		return 1;
 	} else {
-		// TODO BVOPs will need several frames
-		return 1;
+		/* B-VOP inputs are held until the following anchor VOP */
+		return mpeg4_nr_b_vops(encoder) + 1;
 	}
 }
@@ -0,0 +1,409 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Simulcast encoding. The renditions are ordinary encoders that share one
+ * set of VPU data. Each input frame is encoded by the renditions in order
+ * of priority; a lower priority rendition is skipped for a frame if its
+ * recent encode time would take it past the deadline of that frame, which
+ * is one frame interval of the highest priority rendition.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "shcodecs/shcodecs_simulcast.h"
+#include "encoder_private.h"
+#include "m4driverif.h"
+
+#define MAX_RENDITIONS 8
+
+struct rendition {
+	SHCodecs_Encoder *encoder;
+	int priority;
+	int scaled;		/* Size differs from the input */
+
+	long nr_frames;
+	long nr_skipped;
+	long nr_late;
+	double total_ms;
+	double max_ms;
+	double estimate_ms;	/* Recent time to scale and encode a frame */
+	double last_ms;		/* Completion time of the last frame */
+};
+
+struct SHCodecs_Simulcast {
+	int width;
+	int height;
+	unsigned long y_bytes;
+
+	/* Shared by the renditions, taken from the first one */
+	void *vpu;
+
+	struct rendition renditions[MAX_RENDITIONS];
+	int nr_renditions;
+	int order[MAX_RENDITIONS];	/* Rendition indices, highest priority first */
+
+	SHCodecs_Simulcast_Scale scale;
+	void *scale_user_data;
+
+	struct input_buffer input_bufs[MAX_INPUT_BUFFERS];
+	int nr_input_bufs;
+
+	int started;
+	double start_ms;
+};
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Nearest neighbour scaling of NV12 */
+static int
+scale_nv12(SHCodecs_Simulcast *sim,
+	   unsigned char *src_y, unsigned char *src_c, int src_w, int src_h,
+	   unsigned char *dst_y, unsigned char *dst_c, int dst_w, int dst_h,
+	   void *user_data)
+{
+	int src_pitch = ROUND_UP_16(src_w);
+	int dst_pitch = ROUND_UP_16(dst_w);
+	unsigned long step, step_c;
+	unsigned char *s, *d;
+	int x, y, sx;
+
+	step = ((unsigned long)src_w << 16) / dst_w;
+	step_c = ((unsigned long)(src_w/2) << 16) / (dst_w/2);
+
+	for (y=0; y<dst_h; y++) {
+		s = src_y + (y * src_h / dst_h) * src_pitch;
+		d = dst_y + y * dst_pitch;
+		for (x=0; x<dst_w; x++)
+			d[x] = s[(x * step) >> 16];
+	}
+
+	for (y=0; y<dst_h/2; y++) {
+		s = src_c + (y * src_h / dst_h) * src_pitch;
+		d = dst_c + y * dst_pitch;
+		for (x=0; x<dst_w/2; x++) {
+			sx = (x * step_c) >> 16;
+			d[2*x] = s[2*sx];
+			d[2*x+1] = s[2*sx+1];
+		}
+	}
+
+	return 0;
+}
+
+SHCodecs_Simulcast *
+shcodecs_simulcast_init(int width, int height)
+{
+	SHCodecs_Simulcast *sim;
+
+	if (width <= 0 || height <= 0)
+		return NULL;
+
+	sim = calloc(1, sizeof(*sim));
+	if (sim == NULL)
+		return NULL;
+
+	sim->width = width;
+	sim->height = height;
+	sim->y_bytes = ROUND_UP_16(width) * ROUND_UP_16(height);
+	sim->scale = scale_nv12;
+
+	return sim;
+}
+
+void
+shcodecs_simulcast_close(SHCodecs_Simulcast *sim)
+{
+	int i;
+
+	if (sim == NULL)
+		return;
+
+	for (i=0; i<sim->nr_input_bufs; i++)
+		m4iph_sdr_free(sim->vpu, sim->input_bufs[i].phys,
+			       sim->y_bytes + sim->y_bytes/2);
+
+	for (i=0; i<sim->nr_renditions; i++)
+		shcodecs_encoder_close(sim->renditions[i].encoder);
+
+	if (sim->vpu)
+		m4iph_vpu_close(sim->vpu);
+
+	free(sim);
+}
+
+SHCodecs_Encoder *
+shcodecs_simulcast_add_rendition(SHCodecs_Simulcast *sim, int width, int height,
+				 SHCodecs_Format format, int priority)
+{
+	SHCodecs_Encoder *enc;
+	struct rendition *r;
+	int i, n;
+
+	if (sim == NULL || sim->started || sim->nr_renditions == MAX_RENDITIONS)
+		return NULL;
+
+	enc = encoder_init_vpu(width, height, format, sim->vpu);
+	if (enc == NULL)
+		return NULL;
+
+	n = sim->nr_renditions;
+	r = &sim->renditions[n];
+	memset(r, 0, sizeof(*r));
+	r->encoder = enc;
+	r->priority = priority;
+	r->scaled = (width != sim->width || height != sim->height);
+
+	/* A rendition of another size encodes from its own scaled copy */
+	if (r->scaled && shcodecs_encoder_alloc_input_buffers(enc, 1) < 0) {
+		shcodecs_encoder_close(enc);
+		return NULL;
+	}
+
+	if (sim->vpu == NULL)
+		sim->vpu = m4iph_vpu_ref(enc->vpu);
+
+	/* Insert into the priority order, after renditions of equal priority */
+	for (i=n; i>0 && sim->renditions[sim->order[i-1]].priority < priority; i--)
+		sim->order[i] = sim->order[i-1];
+	sim->order[i] = n;
+
+	sim->nr_renditions++;
+
+	return enc;
+}
+
+int
+shcodecs_simulcast_set_scale_callback(SHCodecs_Simulcast *sim,
+				      SHCodecs_Simulcast_Scale scale_cb,
+				      void *user_data)
+{
+	if (sim == NULL) return -1;
+
+	sim->scale = scale_cb ? scale_cb : scale_nv12;
+	sim->scale_user_data = user_data;
+
+	return 0;
+}
+
+int
+shcodecs_simulcast_alloc_input_buffers(SHCodecs_Simulcast *sim, int nr_buffers)
+{
+	unsigned char *pY;
+	int i;
+
+	if (sim == NULL || sim->vpu == NULL) return -1;
+
+	if (nr_buffers < 1 || nr_buffers > MAX_INPUT_BUFFERS)
+		return -1;
+
+	if (sim->nr_input_bufs > 0)
+		return -1;
+
+	for (i=0; i<nr_buffers; i++) {
+		pY = m4iph_sdr_malloc(sim->vpu, sim->y_bytes + sim->y_bytes/2, 32);
+		if (!pY)
+			return -1;
+		sim->input_bufs[i].phys = pY;
+		sim->input_bufs[i].virt = m4iph_addr_to_virt(sim->vpu, pY);
+		sim->input_bufs[i].in_use = 0;
+		sim->nr_input_bufs++;
+	}
+
+	return 0;
+}
+
+int
+shcodecs_simulcast_get_input_buffer(SHCodecs_Simulcast *sim,
+				    unsigned char **y_input,
+				    unsigned char **c_input)
+{
+	int i;
+
+	if (sim == NULL) return -1;
+
+	for (i=0; i<sim->nr_input_bufs; i++) {
+		if (!sim->input_bufs[i].in_use) {
+			sim->input_bufs[i].in_use = 1;
+			*y_input = sim->input_bufs[i].virt;
+			*c_input = sim->input_bufs[i].virt + sim->y_bytes;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Scale the input if needed, and encode it. Sets *skipped if the input
+   could not be scaled. */
+static int
+encode_rendition(SHCodecs_Simulcast *sim, struct rendition *r,
+		 unsigned char *y_input, unsigned char *c_input, int *skipped)
+{
+	SHCodecs_Encoder *enc = r->encoder;
+	unsigned char *py, *pc;
+
+	*skipped = 0;
+
+	if (!r->scaled)
+		return shcodecs_encoder_encode_1frame(enc, y_input, c_input, NULL);
+
+	if (shcodecs_encoder_get_input_buffer(enc, &py, &pc) < 0)
+		return -1;
+
+	if (sim->scale(sim, y_input, c_input, sim->width, sim->height,
+		       py, pc, enc->width, enc->height, sim->scale_user_data) < 0) {
+		shcodecs_encoder_put_input_buffer(enc, py);
+		*skipped = 1;
+		return 0;
+	}
+
+	/* The encoder returns the buffer to its pool */
+	return shcodecs_encoder_encode_1frame(enc, py, pc, NULL);
+}
+
+int
+shcodecs_simulcast_encode_1frame(SHCodecs_Simulcast *sim,
+				 unsigned char *y_input, unsigned char *c_input)
+{
+	struct rendition *r;
+	double start, deadline, t0, t1, elapsed;
+	long fps_x10;
+	int i, rc, skipped, ret = 0;
+
+	if (sim == NULL || sim->nr_renditions == 0)
+		return -1;
+
+	start = now_ms();
+	if (!sim->started) {
+		sim->started = 1;
+		sim->start_ms = start;
+	}
+
+	fps_x10 = shcodecs_encoder_get_frame_rate(sim->renditions[sim->order[0]].encoder);
+	if (fps_x10 <= 0)
+		fps_x10 = 300;
+	deadline = start + 10000.0 / fps_x10;
+
+	for (i=0; i<sim->nr_renditions; i++) {
+		r = &sim->renditions[sim->order[i]];
+
+		/* The highest priority rendition is always encoded */
+		t0 = now_ms();
+		if (i > 0 && t0 + r->estimate_ms > deadline) {
+			r->nr_skipped++;
+			encoder_skip_frame(r->encoder);
+			continue;
+		}
+
+		rc = encode_rendition(sim, r, y_input, c_input, &skipped);
+
+		t1 = now_ms();
+		if (skipped) {
+			r->nr_skipped++;
+			encoder_skip_frame(r->encoder);
+			continue;
+		}
+		if (rc != 0 && ret == 0)
+			ret = rc;
+
+		elapsed = t1 - t0;
+		r->nr_frames++;
+		r->total_ms += elapsed;
+		if (elapsed > r->max_ms)
+			r->max_ms = elapsed;
+		if (r->estimate_ms == 0)
+			r->estimate_ms = elapsed;
+		else
+			r->estimate_ms = (7 * r->estimate_ms + elapsed) / 8;
+		if (t1 > deadline)
+			r->nr_late++;
+		r->last_ms = t1;
+	}
+
+	/* The input buffer is free once all renditions have encoded it */
+	for (i=0; i<sim->nr_input_bufs; i++) {
+		if (sim->input_bufs[i].virt == y_input)
+			sim->input_bufs[i].in_use = 0;
+	}
+
+	return ret;
+}
+
+int
+shcodecs_simulcast_finish(SHCodecs_Simulcast *sim)
+{
+	int i, rc, ret = 0;
+
+	if (sim == NULL) return -1;
+
+	for (i=0; i<sim->nr_renditions; i++) {
+		rc = shcodecs_encoder_finish(sim->renditions[i].encoder);
+		if (rc < 0 && ret == 0)
+			ret = rc;
+	}
+
+	return ret;
+}
+
+int
+shcodecs_simulcast_get_nr_renditions(SHCodecs_Simulcast *sim)
+{
+	if (sim == NULL) return -1;
+
+	return sim->nr_renditions;
+}
+
+int
+shcodecs_simulcast_get_stats(SHCodecs_Simulcast *sim, int index,
+			     SHCodecs_Simulcast_Stats *stats)
+{
+	struct rendition *r;
+	double elapsed;
+
+	if (sim == NULL || index < 0 || index >= sim->nr_renditions || stats == NULL)
+		return -1;
+
+	r = &sim->renditions[index];
+
+	stats->nr_frames = r->nr_frames;
+	stats->nr_skipped = r->nr_skipped;
+	stats->nr_late = r->nr_late;
+	stats->mean_encode_ms = r->nr_frames ? r->total_ms / r->nr_frames : 0.0;
+	stats->max_encode_ms = r->max_ms;
+
+	elapsed = r->last_ms - sim->start_ms;
+	stats->fps = elapsed > 0 ? r->nr_frames * 1000.0 / elapsed : 0.0;
+
+	return 0;
+}
@@ -194,6 +194,7 @@ static const struct enc_uoptions_t h264_options[] = {
 	{ "level_value", &shcodecs_encoder_set_h264_level_value },
 	{ "out_vui_parameters", &shcodecs_encoder_set_h264_out_vui_parameters },
 	{ "constrained_intra_pred", &shcodecs_encoder_set_h264_constrained_intra_pred },
+	{ "ref_frames", &shcodecs_encoder_set_h264_ref_frames },
 };
 
 static const struct enc_options_t h264_options2[] = {
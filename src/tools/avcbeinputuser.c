@@ -76,6 +76,18 @@ void close_input_file(APPLI_INFO * appli_info)
 		fclose(fp);
 }
 
+/* Give back a frame buffer that was not passed to the encoder */
+static void release_1frame(SHCodecs_Encoder * encoder, int pooled,
+			   unsigned char *pY, unsigned char *pC)
+{
+	if (pooled) {
+		shcodecs_encoder_put_input_buffer(encoder, pY);
+	} else {
+		free(pY);
+		free(pC);
+	}
+}
+
 /* copy yuv data to the image-capture-field area each frame */
 int load_1frame_from_image_file(SHCodecs_Encoder * encoder,
                                 APPLI_INFO * appli_info)
@@ -86,6 +98,7 @@ int load_1frame_from_image_file(SHCodecs_Encoder * encoder,
 	unsigned char *w_addr_yuv;
 	unsigned long wnum;
 	unsigned char *CbCr_ptr, *Cb_buf_ptr, *Cr_buf_ptr, *ptr;
+	int pooled;
 
 	if (appli_info->frame_counter_of_input == appli_info->frames_to_encode) {
 		return (1);
@@ -98,23 +111,26 @@ int load_1frame_from_image_file(SHCodecs_Encoder * encoder,
 	if (input_yuv_fp == NULL) {
 		return (-1);
 	}
-	/* Input file data to user memory */
-	w_addr_yuv = malloc(hsiz * ysiz * 2);
-	if (w_addr_yuv == NULL) {
-		fprintf(stderr, "load_1frame_from_image_file: malloc error.\n");
-		exit(-1);
+	/* Read straight into an encoder input buffer if one is available,
+	   otherwise into user memory which the encoder must copy */
+	pooled = (shcodecs_encoder_get_input_buffer(encoder, &w_addr_yuv, &CbCr_ptr) == 0);
+	if (!pooled) {
+		w_addr_yuv = malloc(hsiz * ysiz * 2);
+		CbCr_ptr = malloc(hsiz * ysiz / 2);
+		if (w_addr_yuv == NULL || CbCr_ptr == NULL) {
+			fprintf(stderr, "load_1frame_from_image_file: malloc error.\n");
+			exit(-1);
+		}
 	}
 	memset(w_addr_yuv, 0, hsiz * ysiz);
 	read_size = fread(w_addr_yuv, 1, hsiz * ysiz, input_yuv_fp);
 	if (read_size <= 1) {
-		free(w_addr_yuv);
+		release_1frame(encoder, pooled, w_addr_yuv, CbCr_ptr);
 		return (1);
 	}
 
 	/* write memory data size offset make to multiples of 16 */
 	wnum = (((hsiz + 15) / 16) * 16) * (((ysiz + 15) / 16) * 16);
-	/* Input file data to user memory */
-	CbCr_ptr = malloc(hsiz * ysiz / 2);
 	Cb_buf_ptr = malloc(hsiz * ysiz / 2);
 	Cr_buf_ptr = malloc(hsiz * ysiz / 2);
 	if (Cb_buf_ptr == NULL || Cr_buf_ptr == NULL) {
@@ -136,6 +152,9 @@ int load_1frame_from_image_file(SHCodecs_Encoder * encoder,
 		    fread(CbCr_ptr, 1, ((hsiz * ysiz / 4) * 2),
 			  input_yuv_fp);
 		if (read_size <= 1) {
+			free(Cb_buf_ptr);
+			free(Cr_buf_ptr);
+			release_1frame(encoder, pooled, w_addr_yuv, CbCr_ptr);
 			return (-1);
 		}
 	} else if (appli_info->yuv_CbCr_format == 3) {	/* 3:Cb1C,Cr1C,... */
@@ -157,6 +176,9 @@ int load_1frame_from_image_file(SHCodecs_Encoder * encoder,
 		    fread(CbCr_ptr, 1, ((hsiz * ysiz / 4) * 2),
 			  input_yuv_fp);
 		if (read_size <= 1) {
+			free(Cb_buf_ptr);
+			free(Cr_buf_ptr);
+			release_1frame(encoder, pooled, w_addr_yuv, CbCr_ptr);
 			return (-1);
 		}
 	}
@@ -164,10 +186,13 @@ int load_1frame_from_image_file(SHCodecs_Encoder * encoder,
 	/* Write image data to kernel memory for VPU */
 	shcodecs_encoder_encode_1frame(encoder, w_addr_yuv, CbCr_ptr, NULL);
 
-	free(w_addr_yuv);
+	/* Encoder input buffers are returned to the pool by the encoder */
+	if (!pooled) {
+		free(w_addr_yuv);
+		free(CbCr_ptr);
+	}
 	free(Cb_buf_ptr);
 	free(Cr_buf_ptr);
-	free(CbCr_ptr);
 
 	return (0);
 }
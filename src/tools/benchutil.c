@@ -0,0 +1,102 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Helpers shared by the encoder benchmarks
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "benchutil.h"
+
+double bench_now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void stream_sum_init (struct stream_sum * sum)
+{
+	sum->hash = 2166136261UL;
+	sum->bytes = 0;
+}
+
+void stream_sum_update (struct stream_sum * sum, unsigned char * data, int length)
+{
+	int i;
+
+	for (i=0; i < length; i++) {
+		sum->hash ^= data[i];
+		sum->hash *= 16777619UL;
+	}
+	sum->bytes += length;
+}
+
+int stream_sum_output (SHCodecs_Encoder * encoder,
+		       unsigned char * data, int length, void * user_data)
+{
+	stream_sum_update ((struct stream_sum *)user_data, data, length);
+	return 0;
+}
+
+/* The input buffers have a pitch of the width rounded up to a whole
+ * macroblock */
+void synth_frame (unsigned char * pY, unsigned char * pC,
+		  int width, int height, long frame)
+{
+	int pitch = (width + 15) / 16 * 16;
+	int x, y;
+
+	for (y=0; y < height; y++) {
+		for (x=0; x < width; x++)
+			pY[y*pitch + x] = 16 + (((x + frame * 3) ^ (y + frame)) & 0x7f);
+	}
+	for (y=0; y < height / 2; y++) {
+		for (x=0; x < width; x++)
+			pC[y*pitch + x] = 128 + ((x + y + frame) & 0x1f) - 16;
+	}
+}
+
+SHCodecs_Encoder * bench_open_encoder (int width, int height, long stream_type,
+				       struct stream_sum * sum)
+{
+	SHCodecs_Encoder * encoder;
+
+	encoder = shcodecs_encoder_init (width, height, stream_type);
+	if (encoder == NULL)
+		return NULL;
+
+	shcodecs_encoder_set_output_callback (encoder, stream_sum_output, sum);
+
+	if (shcodecs_encoder_alloc_input_buffers (encoder,
+			shcodecs_encoder_get_min_input_frames (encoder)) < 0) {
+		shcodecs_encoder_close (encoder);
+		return NULL;
+	}
+
+	return encoder;
+}
@@ -0,0 +1,53 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+#ifndef __BENCHUTIL_H__
+#define __BENCHUTIL_H__
+
+#include <shcodecs/shcodecs_encoder.h>
+
+struct stream_sum {
+	unsigned long hash;	/* FNV-1a of the stream */
+	long bytes;
+};
+
+/* Monotonic time in microseconds */
+double bench_now_us (void);
+
+/* Start a new stream sum */
+void stream_sum_init (struct stream_sum * sum);
+
+/* Add data to a stream sum */
+void stream_sum_update (struct stream_sum * sum, unsigned char * data, int length);
+
+/* SHCodecs_Encoder_Output callback, summing the stream into the
+ * struct stream_sum passed as user_data */
+int stream_sum_output (SHCodecs_Encoder * encoder,
+		       unsigned char * data, int length, void * user_data);
+
+/* Fill an encoder input buffer with a moving pattern, depending only on
+ * the frame number */
+void synth_frame (unsigned char * pY, unsigned char * pC,
+		  int width, int height, long frame);
+
+/* Create an encoder which sums its output, with the minimum number of
+ * input buffers. The encoding parameters are left to the caller. */
+SHCodecs_Encoder * bench_open_encoder (int width, int height, long stream_type,
+				       struct stream_sum * sum);
+
+#endif /* __BENCHUTIL_H__ */
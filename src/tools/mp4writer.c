@@ -0,0 +1,758 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Fragmented MP4 (ISO/IEC 14496-12, CMAF style) output for H.264.
+ *
+ * The initialization segment (ftyp, moov) carries the SPS and PPS in an
+ * avcC box, and each fragment is a moof followed by an mdat. Annex B start
+ * codes are replaced by 4 byte lengths. A fragment is written with a single
+ * writev(), so the output can be served as it is produced.
+ *
+ * The encoder reuses its stream buffer once an access unit has been output,
+ * so a GOP fragment keeps a copy of its samples, with the lengths written
+ * in place as the NAL units are copied. Per frame fragments are written
+ * directly from the encoder's buffers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "mp4writer.h"
+
+#define TIMESCALE 90000
+#define TRACK_ID 1
+
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+#define NAL_TYPE_FILLER 12
+
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct mp4buf {
+	unsigned char *data;
+	unsigned long len;
+	unsigned long size;
+	int error;
+};
+
+struct mp4_sample {
+	long long dts;
+	unsigned long size;
+	int sync;
+};
+
+struct mp4writer {
+	int fd;
+	SHCodecs_Encoder *encoder;
+	int per_frame;
+	unsigned long sequence;
+	long long first_dts;
+	int started;
+
+	/* Samples of the fragment being built */
+	struct mp4_sample *samples;
+	int nr_samples;
+	int max_samples;
+	struct mp4buf mdat;
+
+	/* moof of the fragment being written */
+	struct mp4buf moof;
+
+	/* Per frame fragments: NAL lengths and payload segments */
+	unsigned char *lengths;
+	struct iovec *iov;
+	int max_iov;
+};
+
+static void
+buf_reserve(struct mp4buf *b, unsigned long n)
+{
+	unsigned long size;
+	unsigned char *data;
+
+	if (b->len + n <= b->size)
+		return;
+
+	size = b->size ? b->size : 4096;
+	while (size < b->len + n)
+		size *= 2;
+
+	data = realloc(b->data, size);
+	if (data == NULL) {
+		b->error = 1;
+		return;
+	}
+	b->data = data;
+	b->size = size;
+}
+
+static void
+put_bytes(struct mp4buf *b, const void *data, unsigned long n)
+{
+	buf_reserve(b, n);
+	if (b->error)
+		return;
+	if (data)
+		memcpy(b->data + b->len, data, n);
+	else
+		memset(b->data + b->len, 0, n);
+	b->len += n;
+}
+
+static void
+put_u8(struct mp4buf *b, unsigned int v)
+{
+	unsigned char c = v;
+	put_bytes(b, &c, 1);
+}
+
+static void
+put_u16(struct mp4buf *b, unsigned int v)
+{
+	unsigned char c[2];
+
+	c[0] = (v >> 8) & 0xff;
+	c[1] = v & 0xff;
+	put_bytes(b, c, 2);
+}
+
+static void
+put_u32(struct mp4buf *b, unsigned long v)
+{
+	unsigned char c[4];
+
+	c[0] = (v >> 24) & 0xff;
+	c[1] = (v >> 16) & 0xff;
+	c[2] = (v >> 8) & 0xff;
+	c[3] = v & 0xff;
+	put_bytes(b, c, 4);
+}
+
+static void
+put_u64(struct mp4buf *b, unsigned long long v)
+{
+	put_u32(b, v >> 32);
+	put_u32(b, v & 0xffffffff);
+}
+
+static void
+set_u32(unsigned char *p, unsigned long v)
+{
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+/* Start a box, returning its offset for box_end() */
+static unsigned long
+box_start(struct mp4buf *b, const char *type)
+{
+	unsigned long offset = b->len;
+
+	put_u32(b, 0);
+	put_bytes(b, type, 4);
+
+	return offset;
+}
+
+static unsigned long
+full_box_start(struct mp4buf *b, const char *type, int version, unsigned long flags)
+{
+	unsigned long offset = box_start(b, type);
+
+	put_u32(b, (version << 24) | (flags & 0xffffff));
+
+	return offset;
+}
+
+static void
+box_end(struct mp4buf *b, unsigned long offset)
+{
+	if (!b->error)
+		set_u32(b->data + offset, b->len - offset);
+}
+
+static void
+put_matrix(struct mp4buf *b)
+{
+	put_u32(b, 0x00010000); put_u32(b, 0); put_u32(b, 0);
+	put_u32(b, 0); put_u32(b, 0x00010000); put_u32(b, 0);
+	put_u32(b, 0); put_u32(b, 0); put_u32(b, 0x40000000);
+}
+
+/* Write all segments, allowing for partial writes */
+static int
+writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+	int cnt;
+
+	while (iovcnt > 0) {
+		cnt = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+		n = writev(fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (n > 0) {
+			iov->iov_base = (unsigned char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* Skip an Annex B start code, if present */
+static unsigned char *
+strip_start_code(unsigned char *data, int *length)
+{
+	int i = 0;
+
+	while (i < *length - 1 && data[i] == 0)
+		i++;
+
+	if (i >= 2 && data[i] == 1) {
+		i++;
+		*length -= i;
+		return data + i;
+	}
+
+	return data;
+}
+
+/* Parameter sets are in the avcC box, and AUD and filler are not needed */
+static int
+keep_nal(unsigned char *nal)
+{
+	int type = nal[0] & 0x1f;
+
+	return !(type == NAL_TYPE_SPS || type == NAL_TYPE_PPS ||
+		 type == NAL_TYPE_AUD || type == NAL_TYPE_FILLER);
+}
+
+static long long
+frame_dts(struct mp4writer *mp4, long frame_number)
+{
+	long increment, fps_x10;
+
+	increment = shcodecs_encoder_get_frame_no_increment(mp4->encoder);
+	fps_x10 = shcodecs_encoder_get_frame_rate(mp4->encoder);
+	if (increment <= 0)
+		increment = 1;
+	if (fps_x10 <= 0)
+		fps_x10 = 300;
+
+	return (long long)(frame_number / increment) * TIMESCALE * 10 / fps_x10;
+}
+
+static unsigned long
+frame_duration(struct mp4writer *mp4)
+{
+	long fps_x10 = shcodecs_encoder_get_frame_rate(mp4->encoder);
+
+	if (fps_x10 <= 0)
+		fps_x10 = 300;
+
+	return (unsigned long)TIMESCALE * 10 / fps_x10;
+}
+
+static void
+put_avcC(struct mp4buf *b, unsigned char *sps, int sps_len,
+	 unsigned char *pps, int pps_len)
+{
+	unsigned long box = box_start(b, "avcC");
+
+	put_u8(b, 1);		/* configurationVersion */
+	put_u8(b, sps[1]);	/* AVCProfileIndication */
+	put_u8(b, sps[2]);	/* profile_compatibility */
+	put_u8(b, sps[3]);	/* AVCLevelIndication */
+	put_u8(b, 0xfc | 3);	/* lengthSizeMinusOne */
+	put_u8(b, 0xe0 | 1);	/* numOfSequenceParameterSets */
+	put_u16(b, sps_len);
+	put_bytes(b, sps, sps_len);
+	put_u8(b, 1);		/* numOfPictureParameterSets */
+	put_u16(b, pps_len);
+	put_bytes(b, pps, pps_len);
+
+	box_end(b, box);
+}
+
+static int
+write_init_segment(struct mp4writer *mp4)
+{
+	struct mp4buf b;
+	struct iovec iov;
+	unsigned long moov, trak, mdia, minf, dinf, dref, stbl, stsd, avc1, mvex, box;
+	int width, height;
+	int nr_nals, *nal_sizes, sps_len, pps_len;
+	unsigned char **nals, *sps, *pps;
+	int ret;
+
+	if (shcodecs_encoder_get_h264_headers(mp4->encoder, &nr_nals, &nal_sizes, &nals) != 0 ||
+	    nr_nals < 2)
+		return -1;
+
+	sps_len = nal_sizes[0];
+	sps = strip_start_code(nals[0], &sps_len);
+	pps_len = nal_sizes[1];
+	pps = strip_start_code(nals[1], &pps_len);
+	if (sps_len < 4 || pps_len < 1)
+		return -1;
+
+	width = shcodecs_encoder_get_width(mp4->encoder);
+	height = shcodecs_encoder_get_height(mp4->encoder);
+
+	memset(&b, 0, sizeof(b));
+
+	box = box_start(&b, "ftyp");
+	put_bytes(&b, "iso6", 4);
+	put_u32(&b, 0);
+	put_bytes(&b, "iso6", 4);
+	put_bytes(&b, "avc1", 4);
+	/* CMAF fragments start with a sync sample */
+	if (!mp4->per_frame)
+		put_bytes(&b, "cmfc", 4);
+	box_end(&b, box);
+
+	moov = box_start(&b, "moov");
+
+	box = full_box_start(&b, "mvhd", 0, 0);
+	put_u32(&b, 0);			/* creation_time */
+	put_u32(&b, 0);			/* modification_time */
+	put_u32(&b, TIMESCALE);
+	put_u32(&b, 0);			/* duration */
+	put_u32(&b, 0x00010000);	/* rate */
+	put_u16(&b, 0x0100);		/* volume */
+	put_bytes(&b, NULL, 10);
+	put_matrix(&b);
+	put_bytes(&b, NULL, 24);
+	put_u32(&b, TRACK_ID + 1);	/* next_track_ID */
+	box_end(&b, box);
+
+	trak = box_start(&b, "trak");
+
+	/* Track enabled, in movie */
+	box = full_box_start(&b, "tkhd", 0, 0x000003);
+	put_u32(&b, 0);
+	put_u32(&b, 0);
+	put_u32(&b, TRACK_ID);
+	put_u32(&b, 0);
+	put_u32(&b, 0);			/* duration */
+	put_bytes(&b, NULL, 8);
+	put_u16(&b, 0);			/* layer */
+	put_u16(&b, 0);			/* alternate_group */
+	put_u16(&b, 0);			/* volume */
+	put_u16(&b, 0);
+	put_matrix(&b);
+	put_u32(&b, width << 16);
+	put_u32(&b, height << 16);
+	box_end(&b, box);
+
+	mdia = box_start(&b, "mdia");
+
+	box = full_box_start(&b, "mdhd", 0, 0);
+	put_u32(&b, 0);
+	put_u32(&b, 0);
+	put_u32(&b, TIMESCALE);
+	put_u32(&b, 0);
+	put_u16(&b, 0x55c4);		/* "und" */
+	put_u16(&b, 0);
+	box_end(&b, box);
+
+	box = full_box_start(&b, "hdlr", 0, 0);
+	put_u32(&b, 0);
+	put_bytes(&b, "vide", 4);
+	put_bytes(&b, NULL, 12);
+	put_bytes(&b, "VideoHandler", 13);
+	box_end(&b, box);
+
+	minf = box_start(&b, "minf");
+
+	box = full_box_start(&b, "vmhd", 0, 1);
+	put_bytes(&b, NULL, 8);
+	box_end(&b, box);
+
+	dinf = box_start(&b, "dinf");
+	dref = full_box_start(&b, "dref", 0, 0);
+	put_u32(&b, 1);
+	box = full_box_start(&b, "url ", 0, 1);	/* Media in the same file */
+	box_end(&b, box);
+	box_end(&b, dref);
+	box_end(&b, dinf);
+
+	stbl = box_start(&b, "stbl");
+
+	stsd = full_box_start(&b, "stsd", 0, 0);
+	put_u32(&b, 1);
+	avc1 = box_start(&b, "avc1");
+	put_bytes(&b, NULL, 6);
+	put_u16(&b, 1);			/* data_reference_index */
+	put_bytes(&b, NULL, 16);
+	put_u16(&b, width);
+	put_u16(&b, height);
+	put_u32(&b, 0x00480000);	/* 72 dpi */
+	put_u32(&b, 0x00480000);
+	put_u32(&b, 0);
+	put_u16(&b, 1);			/* frame_count */
+	put_bytes(&b, NULL, 32);	/* compressorname */
+	put_u16(&b, 0x0018);		/* depth */
+	put_u16(&b, 0xffff);
+	put_avcC(&b, sps, sps_len, pps, pps_len);
+	box_end(&b, avc1);
+	box_end(&b, stsd);
+
+	/* Samples are described in the fragments */
+	box = full_box_start(&b, "stts", 0, 0);
+	put_u32(&b, 0);
+	box_end(&b, box);
+	box = full_box_start(&b, "stsc", 0, 0);
+	put_u32(&b, 0);
+	box_end(&b, box);
+	box = full_box_start(&b, "stsz", 0, 0);
+	put_u32(&b, 0);
+	put_u32(&b, 0);
+	box_end(&b, box);
+	box = full_box_start(&b, "stco", 0, 0);
+	put_u32(&b, 0);
+	box_end(&b, box);
+
+	box_end(&b, stbl);
+	box_end(&b, minf);
+	box_end(&b, mdia);
+	box_end(&b, trak);
+
+	mvex = box_start(&b, "mvex");
+	box = full_box_start(&b, "trex", 0, 0);
+	put_u32(&b, TRACK_ID);
+	put_u32(&b, 1);			/* default_sample_description_index */
+	put_u32(&b, frame_duration(mp4));
+	put_u32(&b, 0);
+	put_u32(&b, SAMPLE_FLAGS_NON_SYNC);
+	box_end(&b, box);
+	box_end(&b, mvex);
+
+	box_end(&b, moov);
+
+	if (b.error) {
+		free(b.data);
+		return -1;
+	}
+
+	iov.iov_base = b.data;
+	iov.iov_len = b.len;
+	ret = writev_all(mp4->fd, &iov, 1);
+
+	free(b.data);
+
+	return ret;
+}
+
+/* Build the moof for the current samples. The duration of the last sample
+   is next_dts minus its decode time. */
+static int
+build_moof(struct mp4writer *mp4, long long next_dts)
+{
+	struct mp4buf *b = &mp4->moof;
+	struct mp4_sample *s;
+	unsigned long moof, traf, box, data_offset;
+	long long duration;
+	int i;
+
+	b->len = 0;
+
+	moof = box_start(b, "moof");
+
+	box = full_box_start(b, "mfhd", 0, 0);
+	put_u32(b, ++mp4->sequence);
+	box_end(b, box);
+
+	traf = box_start(b, "traf");
+
+	/* default-base-is-moof */
+	box = full_box_start(b, "tfhd", 0, 0x020000);
+	put_u32(b, TRACK_ID);
+	box_end(b, box);
+
+	box = full_box_start(b, "tfdt", 1, 0);
+	put_u64(b, mp4->samples[0].dts - mp4->first_dts);
+	box_end(b, box);
+
+	/* data-offset, sample-duration, sample-size, sample-flags */
+	box = full_box_start(b, "trun", 0, 0x000701);
+	put_u32(b, mp4->nr_samples);
+	data_offset = b->len;
+	put_u32(b, 0);
+	for (i=0; i<mp4->nr_samples; i++) {
+		s = &mp4->samples[i];
+		if (i+1 < mp4->nr_samples)
+			duration = s[1].dts - s->dts;
+		else
+			duration = next_dts - s->dts;
+		if (duration <= 0)
+			duration = frame_duration(mp4);
+
+		put_u32(b, duration);
+		put_u32(b, s->size);
+		put_u32(b, s->sync ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+	}
+	box_end(b, box);
+
+	box_end(b, traf);
+	box_end(b, moof);
+
+	if (b->error)
+		return -1;
+
+	/* Sample data starts after the moof and the mdat header */
+	set_u32(b->data + data_offset, b->len + 8);
+
+	return 0;
+}
+
+static int
+add_sample(struct mp4writer *mp4, long long dts, unsigned long size, int sync)
+{
+	struct mp4_sample *samples;
+	int max;
+
+	if (mp4->nr_samples == mp4->max_samples) {
+		max = mp4->max_samples ? mp4->max_samples * 2 : 64;
+		samples = realloc(mp4->samples, max * sizeof(*samples));
+		if (samples == NULL)
+			return -1;
+		mp4->samples = samples;
+		mp4->max_samples = max;
+	}
+
+	mp4->samples[mp4->nr_samples].dts = dts;
+	mp4->samples[mp4->nr_samples].size = size;
+	mp4->samples[mp4->nr_samples].sync = sync;
+	mp4->nr_samples++;
+
+	return 0;
+}
+
+/* Write the buffered GOP as one fragment */
+static int
+flush_fragment(struct mp4writer *mp4, long long next_dts)
+{
+	unsigned char mdat_header[8];
+	struct iovec iov[3];
+	int ret;
+
+	if (mp4->nr_samples == 0)
+		return 0;
+
+	if (build_moof(mp4, next_dts) < 0)
+		return -1;
+
+	set_u32(mdat_header, 8 + mp4->mdat.len);
+	memcpy(mdat_header + 4, "mdat", 4);
+
+	iov[0].iov_base = mp4->moof.data;
+	iov[0].iov_len = mp4->moof.len;
+	iov[1].iov_base = mdat_header;
+	iov[1].iov_len = 8;
+	iov[2].iov_base = mp4->mdat.data;
+	iov[2].iov_len = mp4->mdat.len;
+
+	ret = writev_all(mp4->fd, iov, 3);
+
+	mp4->nr_samples = 0;
+	mp4->mdat.len = 0;
+
+	return ret;
+}
+
+/* Write one access unit as a fragment, straight from the encoder's buffers */
+static int
+write_frame_fragment(struct mp4writer *mp4, const struct iovec *iov, int iovcnt,
+		     long long dts, int sync)
+{
+	unsigned char mdat_header[8];
+	unsigned char *nal;
+	unsigned long size = 0;
+	int i, n, length;
+
+	if (iovcnt > mp4->max_iov) {
+		free(mp4->lengths);
+		free(mp4->iov);
+		mp4->lengths = malloc(iovcnt * 4);
+		mp4->iov = malloc((2 + 2*iovcnt) * sizeof(struct iovec));
+		if (!mp4->lengths || !mp4->iov) {
+			mp4->max_iov = 0;
+			return -1;
+		}
+		mp4->max_iov = iovcnt;
+	}
+
+	n = 2;
+	for (i=0; i<iovcnt; i++) {
+		length = iov[i].iov_len;
+		nal = strip_start_code(iov[i].iov_base, &length);
+		if (length <= 0 || !keep_nal(nal))
+			continue;
+
+		set_u32(&mp4->lengths[4*i], length);
+		mp4->iov[n].iov_base = &mp4->lengths[4*i];
+		mp4->iov[n].iov_len = 4;
+		mp4->iov[n+1].iov_base = nal;
+		mp4->iov[n+1].iov_len = length;
+		n += 2;
+		size += 4 + length;
+	}
+
+	if (add_sample(mp4, dts, size, sync) < 0)
+		return -1;
+	if (build_moof(mp4, dts + frame_duration(mp4)) < 0)
+		return -1;
+	mp4->nr_samples = 0;
+
+	set_u32(mdat_header, 8 + size);
+	memcpy(mdat_header + 4, "mdat", 4);
+
+	mp4->iov[0].iov_base = mp4->moof.data;
+	mp4->iov[0].iov_len = mp4->moof.len;
+	mp4->iov[1].iov_base = mdat_header;
+	mp4->iov[1].iov_len = 8;
+
+	return writev_all(mp4->fd, mp4->iov, n);
+}
+
+int
+mp4writer_write_au(struct mp4writer *mp4, const struct iovec *iov, int iovcnt,
+		   const SHCodecs_Encoder_AU_Info *info)
+{
+	unsigned char *nal;
+	unsigned long size;
+	long long dts;
+	int i, length, sync;
+
+	if (info->pic_type == SHCodecs_Picture_End)
+		return 0;
+
+	dts = frame_dts(mp4, info->frame_number);
+	if (!mp4->started) {
+		mp4->first_dts = dts;
+		mp4->started = 1;
+	}
+
+	sync = (info->pic_type == SHCodecs_Picture_IDR);
+
+	if (mp4->per_frame)
+		return write_frame_fragment(mp4, iov, iovcnt, dts, sync);
+
+	/* Each GOP starts a new fragment */
+	if (sync && flush_fragment(mp4, dts) < 0)
+		return -1;
+
+	size = mp4->mdat.len;
+	for (i=0; i<iovcnt; i++) {
+		length = iov[i].iov_len;
+		nal = strip_start_code(iov[i].iov_base, &length);
+		if (length <= 0 || !keep_nal(nal))
+			continue;
+
+		put_u32(&mp4->mdat, length);
+		put_bytes(&mp4->mdat, nal, length);
+	}
+	if (mp4->mdat.error)
+		return -1;
+
+	return add_sample(mp4, dts, mp4->mdat.len - size, sync);
+}
+
+struct mp4writer *
+mp4writer_new(int fd, SHCodecs_Encoder *encoder, int per_frame)
+{
+	struct mp4writer *mp4;
+
+	mp4 = calloc(1, sizeof(*mp4));
+	if (mp4 == NULL)
+		return NULL;
+
+	mp4->fd = fd;
+	mp4->encoder = encoder;
+	mp4->per_frame = per_frame;
+
+	if (write_init_segment(mp4) < 0) {
+		free(mp4);
+		return NULL;
+	}
+
+	return mp4;
+}
+
+int
+mp4writer_close(struct mp4writer *mp4)
+{
+	long long next_dts;
+	int ret = 0;
+
+	if (mp4 == NULL)
+		return 0;
+
+	if (mp4->nr_samples > 0) {
+		next_dts = mp4->samples[mp4->nr_samples-1].dts + frame_duration(mp4);
+		ret = flush_fragment(mp4, next_dts);
+	}
+
+	free(mp4->samples);
+	free(mp4->mdat.data);
+	free(mp4->moof.data);
+	free(mp4->lengths);
+	free(mp4->iov);
+	free(mp4);
+
+	return ret;
+}
+
+int
+mp4writer_is_mp4_filename(const char *filename)
+{
+	const char *ext = strrchr(filename, '.');
+
+	return (ext != NULL && strcasecmp(ext, ".mp4") == 0);
+}
@@ -0,0 +1,47 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+#ifndef __MP4WRITER_H__
+#define __MP4WRITER_H__
+
+#include <sys/uio.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+struct mp4writer;
+
+/* Create a fragmented MP4 writer for an H.264 encoder, and write the
+   initialization segment to fd. With per_frame set, each access unit is
+   written as its own fragment straight from the encoder's buffers;
+   otherwise each fragment holds one GOP. Returns NULL on error. */
+struct mp4writer * mp4writer_new (int fd, SHCodecs_Encoder * encoder, int per_frame);
+
+/* Add an access unit, from an SHCodecs_Encoder_AU_Output callback.
+   Returns 0 on success, -1 on error */
+int mp4writer_write_au (struct mp4writer * mp4,
+			const struct iovec * iov, int iovcnt,
+			const SHCodecs_Encoder_AU_Info * info);
+
+/* Write any buffered fragment and free the writer.
+   Returns 0 on success, -1 on error */
+int mp4writer_close (struct mp4writer * mp4);
+
+/* Check whether a filename has a .mp4 extension */
+int mp4writer_is_mp4_filename (const char * filename);
+
+#endif /* __MP4WRITER_H__ */
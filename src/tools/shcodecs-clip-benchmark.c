@@ -0,0 +1,192 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Measure the per-frame cost of clipping an input frame for H.263. The
+ * previous method, copying the planes out to temporary buffers, clipping
+ * bytewise and copying them back, is compared with clipping in place and
+ * with clipping while copying to the encoder's input frame. A plain copy
+ * of the frame is shown for reference.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "h263_clip.h"
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-s WxH] [-n iterations]\n", progname);
+	printf ("Measure the per-frame cost of clipping input frames for H.263\n");
+	printf ("\n  -s WxH         Frame size (default 640x480)\n");
+	printf ("  -n iterations  Frames clipped by each method (default 200)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+static double
+now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* The previous method, for one plane */
+static int
+clip_copy_out (unsigned char * addr, unsigned long size)
+{
+	unsigned char *tmp, *p;
+	unsigned long i;
+	int clipped = 0;
+
+	tmp = malloc (size);
+	if (tmp == NULL)
+		return -1;
+	memcpy (tmp, addr, size);
+
+	p = tmp;
+	for (i=0; i < size; i++) {
+		if (*p < 1) {
+			*p = 1;
+			clipped = 1;
+		} else if (*p > 254) {
+			*p = 254;
+			clipped = 1;
+		}
+		p++;
+	}
+
+	memcpy (addr, tmp, size);
+	free (tmp);
+
+	return clipped;
+}
+
+/* Sensor-like data, with some samples at each extreme */
+static void
+fill_frame (unsigned char * frame, unsigned long size)
+{
+	unsigned int seed = 1;
+	unsigned long i;
+
+	for (i=0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		frame[i] = (seed >> 16) & 0xff;
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	unsigned char *src, *frame, *dst;
+	unsigned long y_bytes, size;
+	int w = 640, h = 480, iterations = 200, i;
+	double t, legacy, inplace, fused, copy;
+	int c;
+
+	while ((c = getopt (argc, argv, "s:n:h")) != -1) {
+		switch (c) {
+		case 's':
+			if (sscanf (optarg, "%dx%d", &w, &h) != 2) {
+				usage (progname);
+				return -1;
+			}
+			break;
+		case 'n':
+			iterations = atoi (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc || w <= 0 || h <= 0 || iterations <= 0) {
+		usage (progname);
+		return -1;
+	}
+
+	y_bytes = ((w + 15) / 16 * 16) * ((h + 15) / 16 * 16);
+	size = y_bytes * 3 / 2;
+
+	src = malloc (size);
+	frame = malloc (size);
+	dst = malloc (size);
+	if (src == NULL || frame == NULL || dst == NULL) {
+		fprintf (stderr, "Error allocating frames\n");
+		return -1;
+	}
+	fill_frame (src, size);
+
+	/* Check the methods agree */
+	memcpy (frame, src, size);
+	clip_copy_out (frame, size);
+	h263_clip (dst, src, size);
+	if (memcmp (frame, dst, size) != 0) {
+		fprintf (stderr, "Clipped frames differ\n");
+		return -1;
+	}
+
+	legacy = inplace = fused = copy = 0;
+	for (i=0; i < iterations; i++) {
+		memcpy (frame, src, size);
+		t = now_us ();
+		clip_copy_out (frame, y_bytes);
+		clip_copy_out (frame + y_bytes, y_bytes / 2);
+		legacy += now_us () - t;
+
+		memcpy (frame, src, size);
+		t = now_us ();
+		h263_clip (frame, frame, y_bytes);
+		h263_clip (frame + y_bytes, frame + y_bytes, y_bytes / 2);
+		inplace += now_us () - t;
+
+		t = now_us ();
+		h263_clip (dst, src, y_bytes);
+		h263_clip (dst + y_bytes, src + y_bytes, y_bytes / 2);
+		fused += now_us () - t;
+
+		t = now_us ();
+		memcpy (dst, src, y_bytes);
+		memcpy (dst + y_bytes, src + y_bytes, y_bytes / 2);
+		copy += now_us () - t;
+	}
+
+	// Method us/frame
+	printf ("%dx%d, %d frames\n", w, h, iterations);
+	printf ("copy-out\t%.1f\n", legacy / iterations);
+	printf ("in-place\t%.1f\n", inplace / iterations);
+	printf ("fused-copy\t%.1f\n", fused / iterations);
+	printf ("memcpy\t%.1f\n", copy / iterations);
+
+	free (src);
+	free (frame);
+	free (dst);
+
+	return 0;
+}
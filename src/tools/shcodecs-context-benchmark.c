@@ -0,0 +1,181 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Measure the cost of saving and restoring the encoder stream context.
+ * A synthetic sequence is encoded by a single encoder, which keeps the VPU
+ * to itself so its context is never saved, and then by two encoders with
+ * the same parameters taking turns frame by frame, so that each context
+ * is saved and restored for every frame. The streams of the two encoders
+ * must be identical to that of the single encoder.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+#include "benchutil.h"
+
+static APPLI_INFO ainfo;
+static const char *ctrl_filename;
+static long stream_type;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-n frames] <control file>\n", progname);
+	printf ("Measure the cost of switching the SH-Mobile VPU between encoders\n");
+	printf ("\n  -n frames   Frames to encode (default from the control file)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+static SHCodecs_Encoder *
+open_encoder (struct stream_sum * sum)
+{
+	SHCodecs_Encoder * encoder;
+
+	encoder = bench_open_encoder (ainfo.xpic, ainfo.ypic, stream_type, sum);
+	if (encoder == NULL)
+		return NULL;
+
+	stream_sum_init (sum);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0) {
+		shcodecs_encoder_close (encoder);
+		return NULL;
+	}
+
+	return encoder;
+}
+
+static int
+encode_frame (SHCodecs_Encoder * encoder, long frame, double * elapsed)
+{
+	unsigned char *pY, *pC;
+	double start;
+	int ret;
+
+	if (shcodecs_encoder_get_input_buffer (encoder, &pY, &pC) < 0)
+		return -1;
+	synth_frame (pY, pC, ainfo.xpic, ainfo.ypic, frame);
+
+	start = bench_now_us ();
+	ret = shcodecs_encoder_encode_1frame (encoder, pY, pC, NULL);
+	*elapsed += bench_now_us () - start;
+
+	return ret;
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	SHCodecs_Encoder *single, *enc[2];
+	struct stream_sum single_sum, sum[2];
+	double single_us = 0, shared_us = 0;
+	long frames = 0, frame;
+	int i, c, ret = 0;
+
+	while ((c = getopt (argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			frames = atol (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+	if (frames <= 0)
+		frames = ainfo.frames_to_encode;
+
+	/* One encoder, which keeps its context loaded */
+	single = open_encoder (&single_sum);
+	if (single == NULL) {
+		fprintf (stderr, "Error opening encoder\n");
+		return -1;
+	}
+	for (frame=0; frame < frames; frame++) {
+		if (encode_frame (single, frame, &single_us) != 0) {
+			fprintf (stderr, "Error encoding frame %ld\n", frame);
+			return -1;
+		}
+	}
+	shcodecs_encoder_finish (single);
+	shcodecs_encoder_close (single);
+
+	/* Two encoders taking turns */
+	for (i=0; i < 2; i++) {
+		enc[i] = open_encoder (&sum[i]);
+		if (enc[i] == NULL) {
+			fprintf (stderr, "Error opening encoder\n");
+			return -1;
+		}
+	}
+	for (frame=0; frame < frames; frame++) {
+		for (i=0; i < 2; i++) {
+			if (encode_frame (enc[i], frame, &shared_us) != 0) {
+				fprintf (stderr, "Error encoding frame %ld\n", frame);
+				return -1;
+			}
+		}
+	}
+	for (i=0; i < 2; i++) {
+		shcodecs_encoder_finish (enc[i]);
+		shcodecs_encoder_close (enc[i]);
+	}
+
+	// Run us/frame bytes
+	printf ("single\t%.1f\t%ld\n", single_us / frames, single_sum.bytes);
+	printf ("shared\t%.1f\t%ld\t%ld\n", shared_us / (frames * 2),
+		sum[0].bytes, sum[1].bytes);
+	printf ("Switching costs %.1f us/frame\n",
+		shared_us / (frames * 2) - single_us / frames);
+
+	for (i=0; i < 2; i++) {
+		if (sum[i].hash != single_sum.hash || sum[i].bytes != single_sum.bytes) {
+			fprintf (stderr, "Stream of shared encoder %d differs\n", i);
+			ret = -1;
+		}
+	}
+	if (ret == 0)
+		printf ("Streams identical\n");
+
+	return ret;
+}
@@ -0,0 +1,273 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Decode the same elementary stream N times in parallel, either with one
+ * thread per stream or with all streams batched through
+ * shcodecs_decode_multi(), and report the aggregate throughput.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <shcodecs/shcodecs_decoder.h>
+
+#include "framerate.h"
+
+#define DEFAULT_WIDTH 320
+#define DEFAULT_HEIGHT 240
+#define MAX_STREAMS 16
+
+struct dec_stream {
+	SHCodecs_Decoder *decoder;
+	struct framerate *framerate;
+	pthread_t thread;
+};
+
+static unsigned char *input;
+static int input_len;
+static struct dec_stream streams[MAX_STREAMS];
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [options] <input file>\n", progname);
+	printf ("Benchmark decoding of multiple streams using the SH-Mobile VPU\n");
+	printf ("\nEncoding format\n");
+	printf ("  -f, --format           Set the input format [h264, mpeg4]\n");
+	printf ("\nDimensions\n");
+	printf ("  -w, --width            Set the input image width in pixels\n");
+	printf ("  -h, --height           Set the input image height in pixels\n");
+	printf ("\nBenchmark options\n");
+	printf ("  -n, --streams          Number of streams to decode in parallel\n");
+	printf ("  -b, --batch            Decode all streams from one thread using\n");
+	printf ("                         shcodecs_decode_multi() (default: one thread\n");
+	printf ("                         per stream)\n");
+	printf ("\nMiscellaneous options\n");
+	printf ("  --help                 Display this help and exit\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+static char * optstring = "f:w:h:n:bH";
+
+#ifdef HAVE_GETOPT_LONG
+static struct option long_options[] = {
+	{ "format", required_argument, NULL, 'f'},
+	{ "width" , required_argument, NULL, 'w'},
+	{ "height", required_argument, NULL, 'h'},
+	{ "streams", required_argument, NULL, 'n'},
+	{ "batch", no_argument, NULL, 'b'},
+	{ "help", no_argument, 0, 'H'},
+};
+#endif
+
+static int
+frame_decoded (SHCodecs_Decoder * decoder,
+		    unsigned char * y_buf, int y_size,
+		    unsigned char * c_buf, int c_size,
+		    void * user_data)
+{
+	struct dec_stream * stream = (struct dec_stream *)user_data;
+
+	framerate_mark (stream->framerate);
+
+	return 0;
+}
+
+static int load_input (const char * filename)
+{
+	FILE * f;
+	long size;
+
+	if ((f = fopen (filename, "rb")) == NULL) {
+		perror (filename);
+		return -1;
+	}
+
+	fseek (f, 0, SEEK_END);
+	size = ftell (f);
+	fseek (f, 0, SEEK_SET);
+
+	input = malloc (size);
+	if (input == NULL || fread (input, 1, size, f) != (size_t)size) {
+		fclose (f);
+		return -1;
+	}
+	input_len = size;
+
+	fclose (f);
+	return 0;
+}
+
+/* Thread per stream: each thread decodes its stream independently */
+static void * decode_thread (void * data)
+{
+	struct dec_stream * stream = (struct dec_stream *)data;
+	int pos = 0, n;
+
+	do {
+		n = shcodecs_decode (stream->decoder, input + pos, input_len - pos);
+		pos += n;
+	} while (n > 0 && pos < input_len);
+
+	shcodecs_decode_final (stream->decoder, input + pos, input_len - pos);
+	shcodecs_decoder_finalize (stream->decoder);
+
+	return NULL;
+}
+
+static void decode_threaded (int nr_streams)
+{
+	int i;
+
+	for (i=0; i < nr_streams; i++)
+		pthread_create (&streams[i].thread, NULL, decode_thread, &streams[i]);
+
+	for (i=0; i < nr_streams; i++)
+		pthread_join (streams[i].thread, NULL);
+}
+
+/* Batched: one thread drives all streams through shcodecs_decode_multi() */
+static void decode_batched (int nr_streams)
+{
+	SHCodecs_Decoder * decoders[MAX_STREAMS];
+	unsigned char * data[MAX_STREAMS];
+	int len[MAX_STREAMS], used[MAX_STREAMS];
+	int i, n;
+
+	for (i=0; i < nr_streams; i++) {
+		decoders[i] = streams[i].decoder;
+		data[i] = input;
+		len[i] = input_len;
+	}
+
+	do {
+		shcodecs_decode_multi (decoders, data, len, used, nr_streams);
+
+		n = 0;
+		for (i=0; i < nr_streams; i++) {
+			data[i] += used[i];
+			len[i] -= used[i];
+			n += used[i];
+		}
+	} while (n > 0);
+
+	for (i=0; i < nr_streams; i++) {
+		shcodecs_decode_final (decoders[i], data[i], len[i]);
+		shcodecs_decoder_finalize (decoders[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char * progname = argv[0];
+	int w = DEFAULT_WIDTH, h = DEFAULT_HEIGHT;
+	int format = -1, nr_streams = 1, batch = 0;
+	struct framerate * total;
+	double time;
+	int c, i, nr_frames = 0;
+
+	while (1) {
+#ifdef HAVE_GETOPT_LONG
+		c = getopt_long(argc, argv, optstring, long_options, &i);
+#else
+		c = getopt (argc, argv, optstring);
+#endif
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'f':
+			if (strncmp(optarg, "mpeg4", 5) == 0)
+				format = SHCodecs_Format_MPEG4;
+			else if (strncmp(optarg, "h264", 4) == 0)
+				format = SHCodecs_Format_H264;
+			break;
+		case 'w':
+			w = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+			h = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			nr_streams = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		default:
+			usage (progname);
+			return 0;
+		}
+	}
+
+	if (optind >= argc || format == -1 ||
+	    nr_streams < 1 || nr_streams > MAX_STREAMS) {
+		usage (progname);
+		return -1;
+	}
+
+	if (load_input (argv[optind]) < 0)
+		return -1;
+
+	for (i=0; i < nr_streams; i++) {
+		streams[i].decoder = shcodecs_decoder_init (w, h, format);
+		if (streams[i].decoder == NULL) {
+			fprintf (stderr, "Error initializing decoder %d\n", i);
+			return -1;
+		}
+		streams[i].framerate = framerate_new_measurer ();
+		shcodecs_decoder_set_decoded_callback (streams[i].decoder,
+						       frame_decoded, &streams[i]);
+	}
+
+	total = framerate_new_measurer ();
+
+	if (batch)
+		decode_batched (nr_streams);
+	else
+		decode_threaded (nr_streams);
+
+	time = (double)framerate_elapsed_time (total) / 1000000;
+
+	for (i=0; i < nr_streams; i++) {
+		nr_frames += shcodecs_decoder_get_frame_count (streams[i].decoder);
+		fprintf (stderr, "stream %d: %d frames, %.2f fps\n", i,
+			 shcodecs_decoder_get_frame_count (streams[i].decoder),
+			 framerate_mean_fps (streams[i].framerate));
+		framerate_destroy (streams[i].framerate);
+		shcodecs_decoder_close (streams[i].decoder);
+	}
+	framerate_destroy (total);
+
+	// Mode Streams Frames Time FPS
+	printf ("%s\t%d\t%d\t%.3f\t%.2f\n", batch ? "batch" : "thread",
+		nr_streams, nr_frames, time, nr_frames / time);
+
+	free (input);
+
+	return 0;
+}
@@ -218,7 +218,7 @@ int decode(struct dec_opts *opts)
 		dec->si_isize = rem + n;
 	} while (!(n == 0 && bytes_decoded == 0));
 
-	bytes_decoded = shcodecs_decode (decoder, dec->input_buffer, dec->si_isize);
+	bytes_decoded = shcodecs_decode_final (decoder, dec->input_buffer, dec->si_isize);
 
 	/* Finalize the decode output, in case a final frame is available */
 	shcodecs_decoder_finalize (decoder);
@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <limits.h>
 #include <ctype.h>
 #include <string.h>
@@ -31,6 +32,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
 
 #include <shcodecs/shcodecs_encoder.h>
 
@@ -45,17 +47,105 @@ struct framerate * enc_framerate = NULL;
 static void
 usage (const char * progname)
 {
-	printf ("Usage: %s <control file>\n", progname);
+	printf ("Usage: %s [-a depth] [-s bytes] [-f] [-c percent] [-k frames] <control file>\n", progname);
 	printf ("Encode a video file using the SH-Mobile VPU\n");
+	printf ("\n  -a depth    Encode asynchronously with up to depth frames in flight\n");
+	printf ("  -s bytes    Limit H.264 slices to bytes and report the latency from\n");
+	printf ("              a frame being ready to its first and last slices\n");
+	printf ("  -f          Print the statistics of each frame, and their means\n");
+	printf ("  -c percent  Force a keyframe where the luma histogram changes by percent\n");
+	printf ("  -k frames   Skip up to frames static frames in a row, and report the\n");
+	printf ("              bits and VPU time saved\n");
 	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
 }
 
 long frame_counter=0;
 
+/* Times at which recent frames were ready for encoding */
+#define READY_TIMES 64
+static double ready_time[READY_TIMES];
+
+/* Latency from a frame being ready to its first and last slices, in ms */
+static long nr_latency;
+static double first_slice_latency, frame_latency, max_frame_latency;
+
+/* Totals of the per-frame statistics */
+static long nr_stats, nr_stats_skipped;
+static double total_qp, total_vpu_ms, total_lock_wait_ms, total_wall_ms;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Stand in for capture or format conversion of the next frame */
+static void prepare_frame(unsigned char *pY, unsigned char *pC)
+{
+	int y_bytes = ainfo.xpic * ainfo.ypic;
+
+	memset(pY, frame_counter & 0xff, y_bytes);
+	memset(pC, 0x80, y_bytes / 2);
+
+	ready_time[frame_counter % READY_TIMES] = now_ms();
+}
+
+/* SHCodecs_Encoder_Slice_Output callback, where a real application would
+   send each slice as it arrives */
+static int write_slice(SHCodecs_Encoder * encoder,
+		       unsigned char *data, int length,
+		       const SHCodecs_Encoder_Slice_Info *info, void *user_data)
+{
+	long frame = info->frame_number / shcodecs_encoder_get_frame_no_increment(encoder);
+	double latency = now_ms() - ready_time[frame % READY_TIMES];
+
+	if (info->index == 0)
+		first_slice_latency += latency;
+
+	if (info->last) {
+		if (enc_framerate != NULL)
+			framerate_mark (enc_framerate);
+		frame_latency += latency;
+		if (latency > max_frame_latency)
+			max_frame_latency = latency;
+		nr_latency++;
+	}
+
+	return 0;
+}
+
+/* SHCodecs_Encoder_Frame_Stats_Callback */
+static int frame_stats(SHCodecs_Encoder * encoder,
+		       const SHCodecs_Encoder_Frame_Stats *stats, void *user_data)
+{
+	static const char pic_types[] = "IIPB";
+
+	// Frame Type Bits Slices QP VPU(ms) Wait(ms) Wall(ms)
+	fprintf (stderr, "%ld\t%c\t%ld\t%d\t%.1f\t%.2f\t%.2f\t%.2f\n",
+		 stats->frame_number,
+		 stats->skipped ? 'S' : pic_types[stats->pic_type],
+		 stats->bits, stats->nr_slices, stats->average_qp,
+		 stats->vpu_ms, stats->lock_wait_ms, stats->wall_ms);
+
+	nr_stats++;
+	if (stats->skipped)
+		nr_stats_skipped++;
+	else
+		total_qp += stats->average_qp;
+	total_vpu_ms += stats->vpu_ms;
+	total_lock_wait_ms += stats->lock_wait_ms;
+	total_wall_ms += stats->wall_ms;
+
+	return 0;
+}
+
 /* SHCodecs_Encoder_Input callback for acquiring an image from the input file */
 static int get_input(SHCodecs_Encoder * encoder, void *user_data)
 {
 	APPLI_INFO *appli_info = (APPLI_INFO *) user_data;
+	unsigned char *pY, *pC;
 
 	if (enc_framerate == NULL) {
 		enc_framerate = framerate_new_measurer ();
@@ -64,11 +154,55 @@ static int get_input(SHCodecs_Encoder * encoder, void *user_data)
 	if (frame_counter >= appli_info->frames_to_encode)
 		return 1;
 
+	if (shcodecs_encoder_get_input_buffer(encoder, &pY, &pC) < 0)
+		return -1;
+
+	prepare_frame(pY, pC);
+	shcodecs_encoder_input_provide(encoder, pY, pC);
+
 	frame_counter++;
 
 	return 0;
 }
 
+/* Prepare frames on this thread while the worker keeps the VPU busy */
+static int encode_async(APPLI_INFO *appli_info, int depth)
+{
+	unsigned char *pY, *pC;
+	int rc, ret = 0;
+
+	if (shcodecs_encoder_start_async(encoder, depth) < 0)
+		return -1;
+
+	enc_framerate = framerate_new_measurer ();
+
+	while (frame_counter < appli_info->frames_to_encode) {
+		/* Input buffers go back to the pool as frames complete */
+		while (shcodecs_encoder_get_input_buffer(encoder, &pY, &pC) < 0) {
+			if (shcodecs_encoder_wait_async(encoder, NULL, NULL, NULL, &rc) < 0)
+				goto drain;
+			if (rc < 0)
+				ret = rc;
+		}
+
+		prepare_frame(pY, pC);
+		frame_counter++;
+
+		if (shcodecs_encoder_submit(encoder, pY, pC, NULL) < 0)
+			break;
+	}
+
+drain:
+	while (shcodecs_encoder_wait_async(encoder, NULL, NULL, NULL, &rc) == 0) {
+		if (rc < 0)
+			ret = rc;
+	}
+
+	shcodecs_encoder_stop_async(encoder);
+
+	return ret;
+}
+
 /* SHCodecs_Encoder_Output callback for writing encoded data to the output file */
 static int write_output(SHCodecs_Encoder * encoder,
 			unsigned char *data, int length, void *user_data)
@@ -88,6 +222,7 @@ static int write_output(SHCodecs_Encoder * encoder,
 
 void cleanup (void)
 {
+	SHCodecs_Encoder_Scene_Stats scene;
 	double time;
 
 	time = (double)framerate_elapsed_time (enc_framerate);
@@ -99,6 +234,28 @@ void cleanup (void)
 		       framerate_mean_fps(enc_framerate));
 	framerate_destroy (enc_framerate);
 
+	if (nr_latency > 0) {
+		fprintf (stderr, "Latency: first slice %.2f ms, frame %.2f ms (max %.2f ms)\n",
+			 first_slice_latency / nr_latency, frame_latency / nr_latency,
+			 max_frame_latency);
+	}
+
+	if (nr_stats > 0) {
+		fprintf (stderr, "Frames: %ld (%ld skipped), mean QP %.1f, "
+			 "VPU %.2f ms, lock wait %.2f ms, wall %.2f ms\n",
+			 nr_stats, nr_stats_skipped,
+			 nr_stats > nr_stats_skipped ? total_qp / (nr_stats - nr_stats_skipped) : 0.0,
+			 total_vpu_ms / nr_stats, total_lock_wait_ms / nr_stats,
+			 total_wall_ms / nr_stats);
+	}
+
+	if (shcodecs_encoder_get_scene_stats(encoder, &scene) == 0) {
+		fprintf (stderr, "Scenes: %ld frames, %ld cuts, %ld static skipped, "
+			 "saved about %lld kbit and %.1f ms VPU\n",
+			 scene.nr_frames, scene.nr_scene_cuts, scene.nr_static_skipped,
+			 scene.bits_saved / 1000, scene.vpu_ms_saved);
+	}
+
 	if (encoder != NULL)
 		shcodecs_encoder_close(encoder);
 }
@@ -118,16 +275,43 @@ void sig_handler(int sig)
 
 int main(int argc, char *argv[])
 {
+	char * progname = argv[0];
 	int return_code;
 	long stream_type;
 	const char *ctrl_filename;
+	int depth = 0, slice_bytes = 0, show_stats = 0;
+	int cut_percent = 0, max_static_skip = 0;
+	int c;
+
+	while ((c = getopt (argc, argv, "a:s:fc:k:h")) != -1) {
+		switch (c) {
+		case 'a':
+			depth = atoi (optarg);
+			break;
+		case 's':
+			slice_bytes = atoi (optarg);
+			break;
+		case 'f':
+			show_stats = 1;
+			break;
+		case 'c':
+			cut_percent = atoi (optarg);
+			break;
+		case 'k':
+			max_static_skip = atoi (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
 
-	if (argc != 2 || !strncmp (argv[1], "-h", 2) || !strncmp (argv[1], "--help", 6)) {
-		usage (argv[0]);
+	if (optind != argc - 1) {
+		usage (progname);
 		return -1;
 	}
 
-	ctrl_filename = argv[1];
+	ctrl_filename = argv[optind];
 	return_code = ctrlfile_get_params(ctrl_filename, &ainfo, &stream_type);
 	if (return_code < 0) {
 		perror("Error opening control file");
@@ -150,7 +334,35 @@ int main(int argc, char *argv[])
 		return (-3);
 	}
 
-	return_code = shcodecs_encoder_run(encoder);
+	if (slice_bytes > 0) {
+		if (shcodecs_encoder_set_max_slice_bytes(encoder, slice_bytes) < 0) {
+			fprintf(stderr, "Slice mode requires H.264\n");
+			return (-4);
+		}
+		shcodecs_encoder_set_slice_output_callback(encoder, write_slice, NULL);
+	}
+
+	if (show_stats)
+		shcodecs_encoder_set_frame_stats_callback(encoder, frame_stats, NULL);
+
+	if (cut_percent > 0 || max_static_skip > 0) {
+		if (shcodecs_encoder_set_scene_analysis(encoder, cut_percent,
+							max_static_skip) < 0) {
+			fprintf(stderr, "Error enabling scene analysis\n");
+			return (-4);
+		}
+	}
+
+	/* One input buffer per frame in flight, plus one being prepared */
+	if (shcodecs_encoder_alloc_input_buffers(encoder, depth + 1) < 0) {
+		fprintf(stderr, "Error allocating input buffers\n");
+		return (-4);
+	}
+
+	if (depth > 0)
+		return_code = encode_async(&ainfo, depth);
+	else
+		return_code = shcodecs_encoder_run(encoder);
 
 	if (return_code < 0) {
 		fprintf(stderr, "Error encoding, error code=%d\n", return_code);
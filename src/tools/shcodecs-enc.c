@@ -26,11 +26,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/uio.h>
 
 #include <shcodecs/shcodecs_encoder.h>
 
 #include "ControlFileUtil.h"
 #include "avcbencsmp.h"
+#include "mp4writer.h"
 
 static int nr_in=0;
 static int nr_out=0;
@@ -38,6 +40,8 @@ static SHCodecs_Encoder *encoder; /* Encoder */
 static long stream_type;
 static int width;
 static int height;
+static int mp4_output;
+static struct mp4writer *mp4;
 
 static void
 usage (const char * progname)
@@ -45,6 +49,8 @@ usage (const char * progname)
 	printf ("Usage: %s <control file> ...\n", progname);
 	printf ("Encode raw YCbCr4:2:0 image data to a video Elementary Stream using the SH-Mobile VPU\n");
 	printf ("Input on stdin, output on stdout\n");
+	printf ("\nOutput options\n");
+	printf ("  -m, --mp4              Write H.264 as fragmented MP4, one fragment per GOP\n");
 	printf ("\nMiscellaneous options\n");
 	printf ("  -h, --help             Display this help and exit\n");
 	printf ("  -v, --version          Output version information and exit\n");
@@ -64,8 +70,32 @@ static int write_output(SHCodecs_Encoder * encoder,
 	}
 }
 
+/* SHCodecs_Encoder_AU_Output callback for writing a whole access unit at once */
+static int write_au(SHCodecs_Encoder * encoder,
+		    const struct iovec *iov, int iovcnt,
+		    const SHCodecs_Encoder_AU_Info *info, void *user_data)
+{
+	ssize_t length = info->header_bytes + info->slice_bytes;
+
+	if (info->pic_type != SHCodecs_Picture_End)
+		nr_out++;
+
+	if (mp4)
+		return mp4writer_write_au(mp4, iov, iovcnt, info);
+
+	if (writev(STDOUT_FILENO, iov, iovcnt) == length) {
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
 static void cleanup ()
 {
+	if (mp4writer_close(mp4) < 0)
+		fprintf(stderr, "Error writing MP4 output\n");
+	mp4 = NULL;
+
 	shcodecs_encoder_close(encoder);
 }
 
@@ -97,6 +127,10 @@ static int setup_enc(char * ctl_file)
 
 	shcodecs_encoder_set_output_callback(encoder, write_output, NULL);
 
+	/* H.264 output is written one access unit at a time */
+	if (stream_type == SHCodecs_Format_H264)
+		shcodecs_encoder_set_au_output_callback(encoder, write_au, NULL);
+
 	/* set parameters for use in encoding */
 	ret = ctrlfile_set_enc_param(encoder, ctl_file);
 	if (ret < 0) {
@@ -104,6 +138,18 @@ static int setup_enc(char * ctl_file)
 		goto err;
 	}
 
+	if (mp4_output) {
+		if (stream_type != SHCodecs_Format_H264) {
+			fprintf(stderr, "MP4 output requires H.264\n");
+			goto err;
+		}
+		mp4 = mp4writer_new(STDOUT_FILENO, encoder, 0);
+		if (!mp4) {
+			fprintf(stderr, "Error writing MP4 header\n");
+			goto err;
+		}
+	}
+
 	return 0;
 
 err:
@@ -113,31 +159,53 @@ err:
 
 int convert_main(char *ctl_file)
 {
-	unsigned char *pY;
-	unsigned char *pC;
+	unsigned char *pY = NULL;
+	unsigned char *pC = NULL;
+	unsigned char *pY_user = NULL;
+	unsigned char *pC_user = NULL;
+	int pooled;
 	int ret = -1;
 
 	if (setup_enc(ctl_file) < 0)
 		return -1;
 
-	pY = malloc(width * height);
-	pC = malloc(width * height / 2);
-
-	if (pY && pC) {
+	/* Read frames straight into encoder memory if possible; the encoder
+	   returns the buffer to its pool once the frame has been encoded */
+	pooled = (shcodecs_encoder_alloc_input_buffers(encoder, 1) == 0);
+	if (!pooled) {
+		pY_user = malloc(width * height);
+		pC_user = malloc(width * height / 2);
+		if (!pY_user || !pC_user)
+			goto out;
+	}
 
-		while (read_1frame_YCbCr420sp(stdin,
-						width, height, pY, pC) == 0) {
-			nr_in++;
-			ret = shcodecs_encoder_encode_1frame(encoder, pY, pC, NULL);
-			if (ret != 0)
+	while (1) {
+		if (pooled) {
+			if (shcodecs_encoder_get_input_buffer(encoder, &pY, &pC) < 0)
 				break;
+		} else {
+			pY = pY_user;
+			pC = pC_user;
 		}
-		ret = shcodecs_encoder_finish(encoder);
-		cleanup ();
+
+		if (read_1frame_YCbCr420sp(stdin, width, height, pY, pC) != 0) {
+			if (pooled)
+				shcodecs_encoder_put_input_buffer(encoder, pY);
+			break;
+		}
+
+		nr_in++;
+		ret = shcodecs_encoder_encode_1frame(encoder, pY, pC, NULL);
+		if (ret != 0)
+			break;
 	}
+	ret = shcodecs_encoder_finish(encoder);
 
-	free (pY);
-	free (pC);
+out:
+	cleanup ();
+
+	free (pY_user);
+	free (pC_user);
 
 	return ret;
 }
@@ -145,6 +213,7 @@ int convert_main(char *ctl_file)
 int main(int argc, char *argv[])
 {
 	char * progname = argv[0];
+	char * ctl_file = NULL;
 	int show_help = 0, show_version = 0;
 	int ret, i;
 
@@ -160,6 +229,11 @@ int main(int argc, char *argv[])
 
 		if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--version"))
 			show_version = 1;
+
+		if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--mp4"))
+			mp4_output = 1;
+		else if (argv[i][0] != '-' && ctl_file == NULL)
+			ctl_file = argv[i];
 	}
 	if (show_version)
 		printf ("%s version " VERSION "\n", progname);
@@ -170,11 +244,16 @@ int main(int argc, char *argv[])
 	if (show_version || show_help)
 		return 0;
 
+	if (ctl_file == NULL) {
+		usage(progname);
+		return -1;
+	}
+
 
 	signal (SIGINT, sig_handler);
 	signal (SIGPIPE, sig_handler);
 
-	ret = convert_main(argv[1]);
+	ret = convert_main(ctl_file);
 	if (ret < 0)
 		fprintf(stderr, "Error encoding\n");
 
@@ -0,0 +1,229 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Measure the cost of copying the encoded stream out of the encoder. A
+ * synthetic sequence is encoded into a write buffer, as if for a file,
+ * first by copying the data passed to the output callback, and then by
+ * having the encoder encode straight into the write buffer. The streams
+ * must be identical.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+#include "benchutil.h"
+
+#define WRITE_BUFFER_SIZE (4*1024*1024)
+
+struct write_buffer {
+	unsigned char *data;
+	int used;
+	struct stream_sum sum;	/* The flushed stream */
+	long copied;		/* Bytes copied into the buffer */
+	long flushes;
+};
+
+static APPLI_INFO ainfo;
+static const char *ctrl_filename;
+static long stream_type;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-n frames] <control file>\n", progname);
+	printf ("Measure the cost of copying the stream out of the encoder\n");
+	printf ("\n  -n frames   Frames to encode (default from the control file)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+static double
+cpu_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Hash the data in the write buffer, as if writing it to a file */
+static void
+flush (struct write_buffer * wb)
+{
+	stream_sum_update (&wb->sum, wb->data, wb->used);
+	wb->used = 0;
+	wb->flushes++;
+}
+
+/* SHCodecs_Encoder_Output callback, appending to the write buffer */
+static int write_output (SHCodecs_Encoder * encoder,
+			 unsigned char * data, int length, void * user_data)
+{
+	struct write_buffer * wb = (struct write_buffer *)user_data;
+
+	/* Data encoded in place is already in the buffer */
+	if (data == wb->data + wb->used) {
+		wb->used += length;
+		return 0;
+	}
+
+	if (wb->used + length > WRITE_BUFFER_SIZE)
+		flush (wb);
+	memcpy (wb->data + wb->used, data, length);
+	wb->used += length;
+	wb->copied += length;
+
+	return 0;
+}
+
+/* SHCodecs_Encoder_Output_Buffer callback, giving the free space at the
+ * end of the write buffer */
+static unsigned char * write_buffer_space (SHCodecs_Encoder * encoder,
+					   int min_length, int * length,
+					   void * user_data)
+{
+	struct write_buffer * wb = (struct write_buffer *)user_data;
+
+	if (wb->used + min_length > WRITE_BUFFER_SIZE)
+		flush (wb);
+
+	*length = WRITE_BUFFER_SIZE - wb->used;
+	return wb->data + wb->used;
+}
+
+static int
+encode_stream (int in_place, long frames, struct write_buffer * wb, double * elapsed)
+{
+	SHCodecs_Encoder * encoder;
+	unsigned char *pY, *pC;
+	double start;
+	long frame;
+	int ret = 0;
+
+	memset (wb, 0, sizeof(*wb));
+	stream_sum_init (&wb->sum);
+	wb->data = malloc (WRITE_BUFFER_SIZE);
+	if (wb->data == NULL)
+		return -1;
+
+	encoder = shcodecs_encoder_init (ainfo.xpic, ainfo.ypic, stream_type);
+	if (encoder == NULL) {
+		free (wb->data);
+		return -1;
+	}
+
+	shcodecs_encoder_set_output_callback (encoder, write_output, wb);
+	if (in_place)
+		shcodecs_encoder_set_output_buffer_callback (encoder, write_buffer_space, wb);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0 ||
+	    shcodecs_encoder_alloc_input_buffers (encoder,
+			shcodecs_encoder_get_min_input_frames (encoder)) < 0) {
+		shcodecs_encoder_close (encoder);
+		free (wb->data);
+		return -1;
+	}
+
+	*elapsed = 0;
+	for (frame=0; frame < frames && ret == 0; frame++) {
+		if (shcodecs_encoder_get_input_buffer (encoder, &pY, &pC) < 0) {
+			ret = -1;
+			break;
+		}
+		synth_frame (pY, pC, ainfo.xpic, ainfo.ypic, frame);
+
+		start = cpu_ms ();
+		ret = shcodecs_encoder_encode_1frame (encoder, pY, pC, NULL);
+		*elapsed += cpu_ms () - start;
+	}
+	if (ret == 0)
+		ret = shcodecs_encoder_finish (encoder);
+	flush (wb);
+
+	shcodecs_encoder_close (encoder);
+	free (wb->data);
+
+	return ret;
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	struct write_buffer copied, in_place;
+	double copy_ms, in_place_ms;
+	long frames = 0;
+	int c;
+
+	while ((c = getopt (argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			frames = atol (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+	if (frames <= 0)
+		frames = ainfo.frames_to_encode;
+
+	if (encode_stream (0, frames, &copied, &copy_ms) < 0 ||
+	    encode_stream (1, frames, &in_place, &in_place_ms) < 0) {
+		fprintf (stderr, "Error encoding\n");
+		return -1;
+	}
+
+	// Method CPU-ms/frame bytes bytes-copied flushes
+	printf ("%ldx%ld, %ld frames\n", ainfo.xpic, ainfo.ypic, frames);
+	printf ("copy\t%.3f\t%ld\t%ld\t%ld\n", copy_ms / frames,
+		copied.sum.bytes, copied.copied, copied.flushes);
+	printf ("in-place\t%.3f\t%ld\t%ld\t%ld\n", in_place_ms / frames,
+		in_place.sum.bytes, in_place.copied, in_place.flushes);
+
+	if (copied.sum.hash != in_place.sum.hash ||
+	    copied.sum.bytes != in_place.sum.bytes) {
+		fprintf (stderr, "Stream encoded in place differs\n");
+		return -1;
+	}
+	printf ("Streams identical\n");
+
+	return 0;
+}
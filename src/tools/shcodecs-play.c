@@ -587,6 +587,9 @@ int main(int argc, char **argv)
 
 	} while (bytes_decoded > 0 && update_input(pvt, bytes_decoded) > 0);
 
+	/* Decode the end of the stream, held back by shcodecs_decode() */
+	shcodecs_decode_final(decoder, pvt->input_buf, pvt->input_buf_len);
+
 	/* Finalize the decode output, in case a final MPEG4 frame is available */
 	shcodecs_decoder_finalize (decoder);
 
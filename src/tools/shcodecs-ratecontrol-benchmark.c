@@ -0,0 +1,277 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Compare the bitrate accuracy of the VPU rate control alone with the
+ * lookahead rate controller. A synthetic sequence cycles every two seconds
+ * through a static scene, a pan, heavy noise and a flat scene with a moving
+ * object, with a scene cut at each change. For each run, the mean bitrate
+ * relative to the target and the variation of the bits in each second are
+ * reported.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+
+struct run_result {
+	long bitrate;		/* Target */
+	double mean_bitrate;
+	double stddev;		/* Of the bits in each second */
+	double max_second;
+	long nr_seconds;
+};
+
+static APPLI_INFO ainfo;
+static const char *ctrl_filename;
+static long stream_type;
+
+/* Bits of each whole second of the current run */
+static long fps;
+static long frames_in_second;
+static double second_bits, total_bits, total_sq_bits, max_second_bits;
+static long nr_seconds;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-a depth] <control file>\n", progname);
+	printf ("Compare the bitrate accuracy of the SH-Mobile VPU rate control with the\n");
+	printf ("lookahead rate controller\n");
+	printf ("\n  -a depth    Frames of lookahead, as asynchronous encoding depth (default 8)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+/* SHCodecs_Encoder_Output callback, counting the encoded bits */
+static int count_output (SHCodecs_Encoder * encoder,
+			 unsigned char * data, int length, void * user_data)
+{
+	second_bits += length * 8.0;
+	return 0;
+}
+
+/* SHCodecs_Encoder_Frame_Stats_Callback, closing each second */
+static int frame_stats (SHCodecs_Encoder * encoder,
+			const SHCodecs_Encoder_Frame_Stats * stats, void * user_data)
+{
+	if (++frames_in_second < fps)
+		return 0;
+
+	total_bits += second_bits;
+	total_sq_bits += second_bits * second_bits;
+	if (second_bits > max_second_bits)
+		max_second_bits = second_bits;
+	nr_seconds++;
+
+	frames_in_second = 0;
+	second_bits = 0;
+
+	return 0;
+}
+
+static void
+synth_frame (unsigned char * pY, unsigned char * pC, long frame)
+{
+	static unsigned int seed = 1;
+	int w = ainfo.xpic, h = ainfo.ypic;
+	int x, y, bx;
+
+	switch ((frame / (fps * 2)) % 4) {
+	case 0:
+		/* Static texture with a little noise */
+		for (y=0; y < h; y++) {
+			for (x=0; x < w; x++) {
+				seed = seed * 1103515245 + 12345;
+				pY[y*w + x] = 64 + ((x ^ y) & 0x7f) + ((seed >> 16) & 1);
+			}
+		}
+		break;
+	case 1:
+		/* Pan */
+		for (y=0; y < h; y++) {
+			for (x=0; x < w; x++)
+				pY[y*w + x] = 32 + (((x + frame * 5) * (y + 3)) & 0xbf);
+		}
+		break;
+	case 2:
+		/* Heavy noise */
+		for (y=0; y < h; y++) {
+			for (x=0; x < w; x++) {
+				seed = seed * 1103515245 + 12345;
+				pY[y*w + x] = 16 + ((seed >> 16) % 220);
+			}
+		}
+		break;
+	default:
+		/* Flat with a moving box */
+		memset (pY, 100, w * h);
+		bx = (frame * 8) % (w - w / 4);
+		for (y=h / 4; y < h / 2; y++)
+			memset (pY + y*w + bx, 200, w / 4);
+		break;
+	}
+
+	memset (pC, 0x80, w * h / 2);
+}
+
+static int
+encode_run (int lookahead, int depth, struct run_result * res)
+{
+	SHCodecs_Encoder * encoder;
+	unsigned char *pY, *pC;
+	long frame;
+	double mean;
+	int rc, ret = 0;
+
+	encoder = shcodecs_encoder_init (ainfo.xpic, ainfo.ypic, stream_type);
+	if (encoder == NULL)
+		return -1;
+
+	shcodecs_encoder_set_output_callback (encoder, count_output, NULL);
+	shcodecs_encoder_set_frame_stats_callback (encoder, frame_stats, NULL);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	if (lookahead && shcodecs_encoder_set_lookahead_rate_control (encoder, 1) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	if (shcodecs_encoder_alloc_input_buffers (encoder, depth + 1) < 0 ||
+	    shcodecs_encoder_start_async (encoder, depth) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	fps = (shcodecs_encoder_get_frame_rate (encoder) + 5) / 10;
+	frames_in_second = 0;
+	second_bits = total_bits = total_sq_bits = max_second_bits = 0;
+	nr_seconds = 0;
+
+	for (frame=0; frame < ainfo.frames_to_encode; frame++) {
+		while (shcodecs_encoder_get_input_buffer (encoder, &pY, &pC) < 0) {
+			if (shcodecs_encoder_wait_async (encoder, NULL, NULL, NULL, &rc) < 0)
+				goto drain;
+			if (rc < 0)
+				ret = rc;
+		}
+		synth_frame (pY, pC, frame);
+		if (shcodecs_encoder_submit (encoder, pY, pC, NULL) < 0)
+			break;
+	}
+
+drain:
+	while (shcodecs_encoder_wait_async (encoder, NULL, NULL, NULL, &rc) == 0) {
+		if (rc < 0)
+			ret = rc;
+	}
+	shcodecs_encoder_stop_async (encoder);
+	shcodecs_encoder_finish (encoder);
+
+	res->bitrate = shcodecs_encoder_get_bitrate (encoder);
+	res->nr_seconds = nr_seconds;
+	if (nr_seconds > 0) {
+		mean = total_bits / nr_seconds;
+		res->mean_bitrate = mean;
+		res->stddev = sqrt (total_sq_bits / nr_seconds - mean * mean);
+		res->max_second = max_second_bits;
+	}
+
+out:
+	shcodecs_encoder_close (encoder);
+	return ret;
+}
+
+static void
+print_result (const char * name, const struct run_result * res)
+{
+	if (res->nr_seconds == 0 || res->bitrate <= 0) {
+		printf ("%s\tno complete seconds encoded\n", name);
+		return;
+	}
+
+	// Run Target Mean Error(%) StdDev(%) Max(%)
+	printf ("%s\t%ld\t%.0f\t%+.1f\t%.1f\t%.1f\n", name, res->bitrate,
+		res->mean_bitrate,
+		100.0 * (res->mean_bitrate - res->bitrate) / res->bitrate,
+		100.0 * res->stddev / res->bitrate,
+		100.0 * res->max_second / res->bitrate);
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	struct run_result vpu, lookahead;
+	int depth = 8;
+	int c;
+
+	while ((c = getopt (argc, argv, "a:h")) != -1) {
+		switch (c) {
+		case 'a':
+			depth = atoi (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1 || depth < 1 || depth > 16) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+
+	memset (&vpu, 0, sizeof (vpu));
+	memset (&lookahead, 0, sizeof (lookahead));
+
+	if (encode_run (0, depth, &vpu) < 0) {
+		fprintf (stderr, "Error encoding with VPU rate control\n");
+		return -1;
+	}
+
+	if (encode_run (1, depth, &lookahead) < 0) {
+		fprintf (stderr, "Error encoding with lookahead rate control\n");
+		return -1;
+	}
+
+	print_result ("vpu", &vpu);
+	print_result ("lookahead", &lookahead);
+
+	return 0;
+}
@@ -74,6 +74,7 @@
 #include "capture.h"
 #include "ControlFileUtil.h"
 #include "framerate.h"
+#include "mp4writer.h"
 #include "display.h"
 #include "thrqueue.h"
 
@@ -113,6 +114,9 @@ struct encode_data {
 
 	long stream_type;
 
+	/* Fragmented MP4 output, if the output file name ends in .mp4 */
+	struct mp4writer * mp4;
+
 	struct Queue * enc_input_q;
 	struct Queue * enc_input_empty_q;
 
@@ -377,16 +381,14 @@ static int get_input(SHCodecs_Encoder *encoder, void *user_data)
 }
 
 /* SHCodecs_Encoder_Output callback for writing out the encoded data */
-static int write_output(SHCodecs_Encoder *encoder,
-			unsigned char *data, int length, void *user_data)
+/* Update the frame rate and bitrate, returning 1 once enough frames have
+   been encoded */
+static int count_output(struct encode_data *encdata, int length, int new_frame)
 {
-	struct encode_data *encdata = (struct encode_data*)user_data;
-
 	/* count number of bytes passed */
 	framerate_add_bytes (encdata->enc_framerate, length);
 
-	if (shcodecs_encoder_get_frame_num_delta(encoder) > 0 &&
-			encdata->enc_framerate != NULL) {
+	if (new_frame && encdata->enc_framerate != NULL) {
 		if (encdata->enc_framerate->nr_handled >= encdata->ainfo.frames_to_encode &&
 				encdata->ainfo.frames_to_encode > 0)
 			return 1;
@@ -398,12 +400,41 @@ static int write_output(SHCodecs_Encoder *encoder,
 		encdata->mbps = framerate_mean_bps (encdata->enc_framerate);
 	}
 
+	return 0;
+}
+
+static int write_output(SHCodecs_Encoder *encoder,
+			unsigned char *data, int length, void *user_data)
+{
+	struct encode_data *encdata = (struct encode_data*)user_data;
+
+	if (count_output(encdata, length,
+			 shcodecs_encoder_get_frame_num_delta(encoder) > 0))
+		return 1;
+
 	if (write_output_file(&encdata->ainfo, data, length))
 		return -1;
 
 	return (encdata->alive?0:1);
 }
 
+/* SHCodecs_Encoder_AU_Output callback for fragmented MP4 output */
+static int write_au(SHCodecs_Encoder *encoder,
+		    const struct iovec *iov, int iovcnt,
+		    const SHCodecs_Encoder_AU_Info *info, void *user_data)
+{
+	struct encode_data *encdata = (struct encode_data*)user_data;
+
+	if (count_output(encdata, info->header_bytes + info->slice_bytes,
+			 info->pic_type != SHCodecs_Picture_End))
+		return 1;
+
+	if (mp4writer_write_au(encdata->mp4, iov, iovcnt, info) < 0)
+		return -1;
+
+	return (encdata->alive?0:1);
+}
+
 int cleanup (void)
 {
 	double time;
@@ -449,6 +480,8 @@ int cleanup (void)
 				fprintf (stderr, "\tOK");
 			}
 		}
+		if (mp4writer_close(encdata->mp4) < 0)
+			fprintf (stderr, "\tMP4 write error %d", i);
 		shcodecs_encoder_close(encdata->encoder);
 		close_output_file(&encdata->ainfo);
 		framerate_destroy(encdata->enc_framerate);
@@ -852,6 +885,21 @@ int main(int argc, char *argv[])
 			return -9;
 		}
 
+		if (mp4writer_is_mp4_filename(encdata->ainfo.output_file_name_buf)) {
+			if (encdata->stream_type != SHCodecs_Format_H264) {
+				fprintf (stderr, "MP4 output requires H.264\n");
+				return -10;
+			}
+			fflush (encdata->ainfo.output_file_fp);
+			encdata->mp4 = mp4writer_new(fileno(encdata->ainfo.output_file_fp),
+						     encdata->encoder, 0);
+			if (encdata->mp4 == NULL) {
+				fprintf (stderr, "Error writing MP4 header\n");
+				return -10;
+			}
+			shcodecs_encoder_set_au_output_callback(encdata->encoder, write_au, encdata);
+		}
+
 		/* Allocate encoder input frames & and add them to empty queue */
 		size = (encdata->enc_surface.w * encdata->enc_surface.h * 3) / 2;
 		for (j=0; j<shcodecs_encoder_get_min_input_frames(encdata->encoder)+1; j++) {
@@ -0,0 +1,185 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Measure the bitrate saved by each extra H.264 reference frame. The input
+ * clip named in the control file is encoded once for each reference count
+ * with the quantizer fixed, so that quality is roughly constant and only
+ * the size of the stream changes. The contiguous memory taken by each
+ * reference frame is shown alongside.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+
+#define MAX_REFS 2
+
+static APPLI_INFO ainfo;
+static const char *ctrl_filename;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-q quant] [-n frames] <control file>\n", progname);
+	printf ("Measure the H.264 bitrate saved by extra reference frames\n");
+	printf ("\n  -q quant    Fixed quantizer, 1 to 51 (default 28)\n");
+	printf ("  -n frames   Frames to encode (default from the control file)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+static double
+now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* SHCodecs_Encoder_Output callback, counting the stream */
+static int count_output (SHCodecs_Encoder * encoder,
+			 unsigned char * data, int length, void * user_data)
+{
+	long * bytes = (long *)user_data;
+
+	*bytes += length;
+
+	return 0;
+}
+
+static int
+encode_clip (int refs, unsigned long quant, long * bytes, double * elapsed)
+{
+	SHCodecs_Encoder * encoder;
+	double start;
+	int ret;
+
+	encoder = shcodecs_encoder_init (ainfo.xpic, ainfo.ypic, SHCodecs_Format_H264);
+	if (encoder == NULL)
+		return -1;
+
+	*bytes = 0;
+	shcodecs_encoder_set_output_callback (encoder, count_output, bytes);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0 ||
+	    shcodecs_encoder_set_h264_ref_frames (encoder, refs) == (unsigned long)-1 ||
+	    shcodecs_encoder_alloc_input_buffers (encoder,
+			shcodecs_encoder_get_min_input_frames (encoder)) < 0) {
+		shcodecs_encoder_close (encoder);
+		return -1;
+	}
+
+	/* Fix the quantizer */
+	shcodecs_encoder_set_ratecontrol_skip_enable (encoder, 0);
+	shcodecs_encoder_set_h264_Ivop_quant_initial_value (encoder, quant);
+	shcodecs_encoder_set_h264_Pvop_quant_initial_value (encoder, quant);
+	shcodecs_encoder_set_h264_quant_min (encoder, quant);
+	shcodecs_encoder_set_h264_quant_max (encoder, quant);
+	shcodecs_encoder_set_h264_use_dquant (encoder, 0);
+
+	if (open_input_image_file (&ainfo) < 0) {
+		shcodecs_encoder_close (encoder);
+		return -1;
+	}
+
+	start = now_us ();
+	while ((ret = load_1frame_from_image_file (encoder, &ainfo)) == 0)
+		;
+	if (ret > 0)
+		ret = shcodecs_encoder_finish (encoder);
+	*elapsed = now_us () - start;
+
+	close_input_file (&ainfo);
+	shcodecs_encoder_close (encoder);
+
+	return ret;
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	long stream_type, frames = 0, bytes[MAX_REFS+1];
+	double elapsed;
+	unsigned long quant = 28, frame_bytes;
+	int refs, c;
+
+	while ((c = getopt (argc, argv, "q:n:h")) != -1) {
+		switch (c) {
+		case 'q':
+			quant = atol (optarg);
+			break;
+		case 'n':
+			frames = atol (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1 || quant < 1 || quant > 51) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+	if (stream_type != SHCodecs_Format_H264) {
+		fprintf (stderr, "The control file must be for H.264\n");
+		return -1;
+	}
+	if (frames > 0)
+		ainfo.frames_to_encode = frames;
+
+	frame_bytes = ((ainfo.xpic + 15) / 16 * 16) * ((ainfo.ypic + 15) / 16 * 16) * 3 / 2;
+
+	// Refs bytes bytes/frame change us/frame contiguous-bytes
+	printf ("%ldx%ld, %ld frames, quant %lu\n", ainfo.xpic, ainfo.ypic,
+		ainfo.frames_to_encode, quant);
+	for (refs=1; refs <= MAX_REFS; refs++) {
+		if (encode_clip (refs, quant, &bytes[refs], &elapsed) < 0) {
+			fprintf (stderr, "Error encoding with %d reference frames\n", refs);
+			return -1;
+		}
+		printf ("%d\t%ld\t%ld\t%+.1f%%\t%.1f\t%lu\n", refs, bytes[refs],
+			bytes[refs] / ainfo.frames_to_encode,
+			100.0 * (bytes[refs] - bytes[1]) / bytes[1],
+			elapsed / ainfo.frames_to_encode,
+			frame_bytes * (refs + 1));
+	}
+	printf ("Each reference frame costs %lu bytes of contiguous memory\n",
+		frame_bytes);
+
+	return 0;
+}
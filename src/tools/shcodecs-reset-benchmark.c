@@ -0,0 +1,160 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Measure the cost of setting up an encoder for each of a series of short
+ * jobs. Each job encodes a few synthetic frames as a stream of its own,
+ * first with an encoder initialized and closed for every job, and then
+ * with one encoder reset between jobs. The streams must be identical.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+#include "benchutil.h"
+
+static APPLI_INFO ainfo;
+static const char *ctrl_filename;
+static long stream_type;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-j jobs] [-n frames] <control file>\n", progname);
+	printf ("Measure the cost of setting up an encoder for each stream\n");
+	printf ("\n  -j jobs     Streams to encode (default 20)\n");
+	printf ("  -n frames   Frames in each stream (default 5)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+/* Encode one stream, with the encoder set up for it */
+static int
+encode_job (SHCodecs_Encoder * encoder, long frames, struct stream_sum * sum)
+{
+	unsigned char *pY, *pC;
+	long frame;
+
+	stream_sum_init (sum);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0)
+		return -1;
+
+	for (frame=0; frame < frames; frame++) {
+		if (shcodecs_encoder_get_input_buffer (encoder, &pY, &pC) < 0)
+			return -1;
+		synth_frame (pY, pC, ainfo.xpic, ainfo.ypic, frame);
+		if (shcodecs_encoder_encode_1frame (encoder, pY, pC, NULL) != 0)
+			return -1;
+	}
+
+	return shcodecs_encoder_finish (encoder);
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	SHCodecs_Encoder *encoder;
+	struct stream_sum first, sum;
+	double start, init_us, reset_us;
+	long jobs = 20, frames = 5, job;
+	int c, ret = 0;
+
+	while ((c = getopt (argc, argv, "j:n:h")) != -1) {
+		switch (c) {
+		case 'j':
+			jobs = atol (optarg);
+			break;
+		case 'n':
+			frames = atol (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1 || jobs <= 0 || frames <= 0) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+
+	/* A new encoder for each job */
+	start = bench_now_us ();
+	for (job=0; job < jobs; job++) {
+		encoder = bench_open_encoder (ainfo.xpic, ainfo.ypic, stream_type, &sum);
+		if (encoder == NULL || encode_job (encoder, frames, &sum) < 0) {
+			fprintf (stderr, "Error encoding job %ld\n", job);
+			return -1;
+		}
+		shcodecs_encoder_close (encoder);
+		if (job == 0)
+			first = sum;
+	}
+	init_us = bench_now_us () - start;
+
+	/* One encoder, reset between jobs */
+	start = bench_now_us ();
+	encoder = bench_open_encoder (ainfo.xpic, ainfo.ypic, stream_type, &sum);
+	if (encoder == NULL) {
+		fprintf (stderr, "Error opening encoder\n");
+		return -1;
+	}
+	for (job=0; job < jobs; job++) {
+		if (job > 0 && shcodecs_encoder_reset (encoder, ainfo.xpic, ainfo.ypic) < 0) {
+			fprintf (stderr, "Error resetting encoder\n");
+			return -1;
+		}
+		if (encode_job (encoder, frames, &sum) < 0) {
+			fprintf (stderr, "Error encoding job %ld\n", job);
+			return -1;
+		}
+		if (sum.hash != first.hash || sum.bytes != first.bytes) {
+			fprintf (stderr, "Stream of job %ld differs after reset\n", job);
+			ret = -1;
+		}
+	}
+	shcodecs_encoder_close (encoder);
+	reset_us = bench_now_us () - start;
+
+	// Method ms/job
+	printf ("%ldx%ld, %ld jobs of %ld frames\n", ainfo.xpic, ainfo.ypic, jobs, frames);
+	printf ("init+close\t%.2f\n", init_us / jobs / 1000);
+	printf ("reset\t%.2f\n", reset_us / jobs / 1000);
+	if (ret == 0)
+		printf ("Streams identical\n");
+
+	return ret;
+}
@@ -0,0 +1,268 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Measure the bitrate saved by a region of interest at equal quality in
+ * the region. A synthetic surveillance scene, a noisy static background
+ * with a moving object, is first encoded at the bitrate of the control
+ * file. It is then encoded with the background quantizer raised, searching
+ * for the lowest bitrate at which the quantizer of the region is no worse.
+ *
+ * The quantizer of the region is estimated from the frame average, less
+ * the background offset weighted by the background's share of macroblocks.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+
+#define SEARCH_STEPS 6
+
+struct pass_result {
+	long bitrate;
+	long bytes;
+	double roi_qp;
+};
+
+static APPLI_INFO ainfo;
+static const char *ctrl_filename;
+static long stream_type;
+
+static long pass_bytes;
+static long nr_qp;
+static double total_qp;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-o offset] [-r x,y,w,h] <control file>\n", progname);
+	printf ("Measure the bitrate saved by a region of interest using the SH-Mobile VPU\n");
+	printf ("\n  -o offset   Quantizer offset of the background (default 6)\n");
+	printf ("  -r x,y,w,h  The region of interest (default the centre quarter)\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+/* SHCodecs_Encoder_Output callback, counting the encoded bytes */
+static int count_output (SHCodecs_Encoder * encoder,
+			 unsigned char * data, int length, void * user_data)
+{
+	pass_bytes += length;
+	return 0;
+}
+
+/* SHCodecs_Encoder_Frame_Stats_Callback */
+static int frame_stats (SHCodecs_Encoder * encoder,
+			const SHCodecs_Encoder_Frame_Stats * stats, void * user_data)
+{
+	if (!stats->skipped) {
+		total_qp += stats->average_qp;
+		nr_qp++;
+	}
+	return 0;
+}
+
+/* A static textured background with sensor noise, and a textured square
+   moving across the region of interest */
+static void
+synth_frame (unsigned char * pY, unsigned char * pC, long frame,
+	     const SHCodecs_Encoder_ROI * roi)
+{
+	static unsigned int seed = 1;
+	int w = ainfo.xpic, h = ainfo.ypic;
+	int size = roi->height / 2;
+	int ox, oy, x, y;
+
+	for (y=0; y < h; y++) {
+		for (x=0; x < w; x++) {
+			seed = seed * 1103515245 + 12345;
+			pY[y*w + x] = 64 + ((x ^ y) & 0x3f) + ((seed >> 16) & 3);
+		}
+	}
+
+	ox = roi->x + (frame * 4) % (roi->width - size > 0 ? roi->width - size : 1);
+	oy = roi->y + roi->height / 4;
+	for (y=oy; y < oy + size && y < h; y++) {
+		for (x=ox; x < ox + size && x < w; x++)
+			pY[y*w + x] = 160 + ((x * 7 + y * 3) & 0x3f);
+	}
+
+	memset (pC, 0x80, w * h / 2);
+}
+
+static int
+encode_pass (long bitrate, const SHCodecs_Encoder_ROI * roi, int offset,
+	     struct pass_result * res)
+{
+	SHCodecs_Encoder * encoder;
+	SHCodecs_Encoder_ROI rois[2];
+	unsigned char *pY, *pC;
+	long frame;
+	int ret = 0;
+
+	encoder = shcodecs_encoder_init (ainfo.xpic, ainfo.ypic, stream_type);
+	if (encoder == NULL)
+		return -1;
+
+	shcodecs_encoder_set_output_callback (encoder, count_output, NULL);
+	shcodecs_encoder_set_frame_stats_callback (encoder, frame_stats, NULL);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0) {
+		ret = -1;
+		goto out;
+	}
+	if (bitrate > 0)
+		shcodecs_encoder_set_bitrate (encoder, bitrate);
+	res->bitrate = shcodecs_encoder_get_bitrate (encoder);
+
+	if (offset != 0) {
+		/* The whole picture, then the region at the normal quantizer */
+		rois[0].x = rois[0].y = 0;
+		rois[0].width = ainfo.xpic;
+		rois[0].height = ainfo.ypic;
+		rois[0].qp_offset = offset;
+		rois[1] = *roi;
+		rois[1].qp_offset = 0;
+		if (shcodecs_encoder_set_roi (encoder, rois, 2) < 0) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (shcodecs_encoder_alloc_input_buffers (encoder, 1) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	pass_bytes = 0;
+	total_qp = 0;
+	nr_qp = 0;
+
+	for (frame=0; frame < ainfo.frames_to_encode; frame++) {
+		if (shcodecs_encoder_get_input_buffer (encoder, &pY, &pC) < 0)
+			break;
+		synth_frame (pY, pC, frame, roi);
+		ret = shcodecs_encoder_encode_1frame (encoder, pY, pC, NULL);
+		if (ret != 0)
+			break;
+	}
+	shcodecs_encoder_finish (encoder);
+
+	res->bytes = pass_bytes;
+	res->roi_qp = nr_qp > 0 ? total_qp / nr_qp : 0.0;
+
+out:
+	shcodecs_encoder_close (encoder);
+	return ret;
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	SHCodecs_Encoder_ROI roi;
+	struct pass_result base, pass, best;
+	int offset = 6, have_roi = 0;
+	long lo, hi;
+	double bg_fraction;
+	int roi_mbs, i, c;
+
+	while ((c = getopt (argc, argv, "o:r:h")) != -1) {
+		switch (c) {
+		case 'o':
+			offset = atoi (optarg);
+			break;
+		case 'r':
+			if (sscanf (optarg, "%d,%d,%d,%d", &roi.x, &roi.y,
+				    &roi.width, &roi.height) != 4) {
+				usage (progname);
+				return -1;
+			}
+			have_roi = 1;
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1 || offset <= 0) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+
+	if (!have_roi) {
+		roi.x = ainfo.xpic / 4;
+		roi.y = ainfo.ypic / 4;
+		roi.width = ainfo.xpic / 2;
+		roi.height = ainfo.ypic / 2;
+	}
+
+	roi_mbs = ((roi.x + roi.width + 15) / 16 - roi.x / 16) *
+		  ((roi.y + roi.height + 15) / 16 - roi.y / 16);
+	bg_fraction = 1.0 - (double)roi_mbs /
+		      (((ainfo.xpic + 15) / 16) * ((ainfo.ypic + 15) / 16));
+
+	/* Baseline at the control file bitrate */
+	if (encode_pass (0, &roi, 0, &base) < 0) {
+		fprintf (stderr, "Error encoding baseline\n");
+		return -1;
+	}
+
+	/* Lowest bitrate with the region's quantizer no worse than baseline */
+	best = base;
+	lo = base.bitrate / 10;
+	hi = base.bitrate;
+	for (i=0; i < SEARCH_STEPS; i++) {
+		if (encode_pass ((lo + hi) / 2, &roi, offset, &pass) < 0) {
+			fprintf (stderr, "Error encoding with region of interest\n");
+			return -1;
+		}
+		pass.roi_qp -= offset * bg_fraction;
+
+		if (pass.roi_qp <= base.roi_qp + 0.5) {
+			best = pass;
+			hi = pass.bitrate;
+		} else {
+			lo = pass.bitrate;
+		}
+	}
+
+	// Pass Bitrate Bytes ROI-QP
+	printf ("base\t%ld\t%ld\t%.2f\n", base.bitrate, base.bytes, base.roi_qp);
+	printf ("roi\t%ld\t%ld\t%.2f\n", best.bitrate, best.bytes, best.roi_qp);
+	printf ("Saved %.1f%% of the bitrate at equal region quality\n",
+		base.bytes > 0 ? 100.0 * (base.bytes - best.bytes) / base.bytes : 0.0);
+
+	return 0;
+}
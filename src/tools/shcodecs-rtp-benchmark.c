@@ -0,0 +1,287 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Encode H.264, packetize each access unit for RTP and send the packets
+ * over loopback UDP to a receiver thread. Reports the packet rate and the
+ * CPU time spent packetizing and sending each packet.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+#include <shcodecs/shcodecs_rtp.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+#include "framerate.h"
+
+#define DEFAULT_MTU 1400
+#define PAYLOAD_TYPE 96
+
+SHCodecs_Encoder *encoder; /* Encoder */
+SHCodecs_RTP_Packetizer *rtp;
+APPLI_INFO ainfo;	/* Control file data */
+
+static int tx_sock = -1, rx_sock = -1;
+static long frame_counter;
+
+/* Sender statistics */
+static long nr_sent, nr_send_errors;
+static long long bytes_sent;
+static double send_cpu;		/* seconds */
+
+/* Receiver statistics */
+static long nr_received, nr_markers;
+static long long bytes_received;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [-m mtu] <control file>\n", progname);
+	printf ("Packetize H.264 from the SH-Mobile VPU for RTP over loopback UDP\n");
+	printf ("\n  -m mtu      Maximum RTP packet size (default %d)\n", DEFAULT_MTU);
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+static double cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void * receive_thread (void * data)
+{
+	unsigned char buf[65536];
+	ssize_t n;
+
+	while ((n = recv (rx_sock, buf, sizeof(buf), 0)) > 0) {
+		nr_received++;
+		bytes_received += n;
+		if (n >= 2 && (buf[1] & 0x80))
+			nr_markers++;
+	}
+
+	return NULL;
+}
+
+static int open_sockets (void)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int rcvbuf = 4 * 1024 * 1024;
+
+	rx_sock = socket (AF_INET, SOCK_DGRAM, 0);
+	tx_sock = socket (AF_INET, SOCK_DGRAM, 0);
+	if (rx_sock < 0 || tx_sock < 0)
+		return -1;
+
+	setsockopt (rx_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if (bind (rx_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		return -1;
+	if (getsockname (rx_sock, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+	if (connect (tx_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* SHCodecs_RTP_Output callback: send the packet without copying it */
+static int send_packet (SHCodecs_RTP_Packetizer * rtp,
+			const struct iovec * iov, int iovcnt,
+			int length, void * user_data)
+{
+	struct msghdr msg;
+
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = iovcnt;
+
+	if (sendmsg (tx_sock, &msg, 0) != length) {
+		nr_send_errors++;
+		return 0;
+	}
+
+	nr_sent++;
+	bytes_sent += length;
+
+	return 0;
+}
+
+/* SHCodecs_Encoder_AU_Output callback */
+static int write_au (SHCodecs_Encoder * encoder,
+		     const struct iovec * iov, int iovcnt,
+		     const SHCodecs_Encoder_AU_Info * info, void * user_data)
+{
+	double start = cpu_time ();
+	int ret;
+
+	ret = shcodecs_rtp_packetize_au (rtp, iov, iovcnt, info);
+
+	send_cpu += cpu_time () - start;
+
+	return ret;
+}
+
+/* SHCodecs_Encoder_Input callback with a synthetic moving image */
+static int get_input (SHCodecs_Encoder * encoder, void *user_data)
+{
+	APPLI_INFO *appli_info = (APPLI_INFO *) user_data;
+	int y_bytes = appli_info->xpic * appli_info->ypic;
+	unsigned char *pY, *pC;
+	int i;
+
+	if (frame_counter >= appli_info->frames_to_encode)
+		return 1;
+
+	if (shcodecs_encoder_get_input_buffer (encoder, &pY, &pC) < 0)
+		return -1;
+
+	for (i=0; i < y_bytes; i++)
+		pY[i] = (i + frame_counter * 4) & 0xff;
+	memset (pC, 0x80, y_bytes / 2);
+
+	shcodecs_encoder_input_provide (encoder, pY, pC);
+
+	frame_counter++;
+
+	return 0;
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	const char *ctrl_filename;
+	struct framerate * total;
+	pthread_t receiver;
+	long stream_type;
+	int mtu = DEFAULT_MTU;
+	double time;
+	int c, ret;
+
+	while ((c = getopt (argc, argv, "m:h")) != -1) {
+		switch (c) {
+		case 'm':
+			mtu = atoi (optarg);
+			break;
+		default:
+			usage (progname);
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage (progname);
+		return -1;
+	}
+
+	ctrl_filename = argv[optind];
+	if (ctrlfile_get_params (ctrl_filename, &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+
+	if (stream_type != SHCodecs_Format_H264) {
+		fprintf (stderr, "RTP packetization requires H.264\n");
+		return -1;
+	}
+
+	if (open_sockets () < 0) {
+		perror ("Error opening loopback sockets");
+		return -1;
+	}
+
+	encoder = shcodecs_encoder_init (ainfo.xpic, ainfo.ypic, stream_type);
+	if (encoder == NULL) {
+		fprintf (stderr, "Error initializing encoder\n");
+		return -1;
+	}
+
+	shcodecs_encoder_set_input_callback (encoder, get_input, &ainfo);
+	shcodecs_encoder_set_au_output_callback (encoder, write_au, NULL);
+
+	if (ctrlfile_set_enc_param (encoder, ctrl_filename) < 0) {
+		fprintf (stderr, "Problem with encoder params in control file!\n");
+		return -1;
+	}
+
+	if (shcodecs_encoder_alloc_input_buffers (encoder, 1) < 0) {
+		fprintf (stderr, "Error allocating input buffers\n");
+		return -1;
+	}
+
+	rtp = shcodecs_rtp_packetizer_init (encoder, mtu, PAYLOAD_TYPE,
+					    0x12345678, send_packet, NULL);
+	if (rtp == NULL) {
+		fprintf (stderr, "Error initializing packetizer, MTU %d\n", mtu);
+		return -1;
+	}
+
+	pthread_create (&receiver, NULL, receive_thread, NULL);
+
+	total = framerate_new_measurer ();
+
+	ret = shcodecs_encoder_run (encoder);
+	if (ret < 0)
+		fprintf (stderr, "Error encoding, error code=%d\n", ret);
+
+	time = (double)framerate_elapsed_time (total) / 1000000;
+	framerate_destroy (total);
+
+	/* An empty datagram stops the receiver */
+	send (tx_sock, NULL, 0, 0);
+	pthread_join (receiver, NULL);
+
+	fprintf (stderr, "Sent %ld packets (%lld bytes, %ld errors), received %ld (%lld bytes, %ld frames)\n",
+		 nr_sent, bytes_sent, nr_send_errors,
+		 nr_received, bytes_received, nr_markers);
+
+	// MTU Frames Packets Packets/s us/packet
+	printf ("%d\t%ld\t%ld\t%.0f\t%.2f\n", mtu, frame_counter, nr_sent,
+		nr_sent / time, nr_sent ? send_cpu * 1000000 / nr_sent : 0.0);
+
+	shcodecs_rtp_packetizer_close (rtp);
+	shcodecs_encoder_close (encoder);
+	close (tx_sock);
+	close (rx_sock);
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * Encode one synthetic input into several renditions with the simulcast
+ * encoder, one control file per rendition in decreasing priority, and
+ * report the throughput of each rendition.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <shcodecs/shcodecs_simulcast.h>
+
+#include "ControlFileUtil.h"
+#include "avcbencsmp.h"
+
+#define MAX_RENDITIONS 8
+
+static long nr_bytes[MAX_RENDITIONS];
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s <control file> [<control file> ...]\n", progname);
+	printf ("Benchmark simulcast encoding using the SH-Mobile VPU\n");
+	printf ("\nThe first control file sets the input size and the number of frames,\n");
+	printf ("and has the highest priority. Output is discarded.\n");
+	printf ("\nPlease report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+/* SHCodecs_Encoder_Output callback, counting the encoded bytes */
+static int count_output (SHCodecs_Encoder * encoder,
+			 unsigned char * data, int length, void * user_data)
+{
+	long * bytes = (long *)user_data;
+
+	*bytes += length;
+
+	return 0;
+}
+
+int main (int argc, char *argv[])
+{
+	char * progname = argv[0];
+	SHCodecs_Simulcast * simulcast;
+	SHCodecs_Simulcast_Stats stats;
+	SHCodecs_Encoder * encoder;
+	APPLI_INFO ainfo;
+	long stream_type;
+	int width, height, nr_renditions;
+	unsigned char *pY, *pC;
+	long frame;
+	int i, ret = 0;
+
+	nr_renditions = argc - 1;
+	if (nr_renditions < 1 || nr_renditions > MAX_RENDITIONS ||
+	    !strcmp (argv[1], "-h") || !strcmp (argv[1], "--help")) {
+		usage (progname);
+		return -1;
+	}
+
+	if (ctrlfile_get_params (argv[1], &ainfo, &stream_type) < 0) {
+		perror ("Error opening control file");
+		return -1;
+	}
+
+	simulcast = shcodecs_simulcast_init (ainfo.xpic, ainfo.ypic);
+	if (simulcast == NULL) {
+		fprintf (stderr, "Error initializing simulcast encoder\n");
+		return -1;
+	}
+
+	for (i=0; i < nr_renditions; i++) {
+		if (ctrlfile_get_size_type (argv[i+1], &width, &height, &stream_type) < 0) {
+			fprintf (stderr, "Error opening control file %s\n", argv[i+1]);
+			return -1;
+		}
+
+		encoder = shcodecs_simulcast_add_rendition (simulcast, width, height,
+							    stream_type, nr_renditions - i);
+		if (encoder == NULL) {
+			fprintf (stderr, "Error adding rendition %d\n", i);
+			return -1;
+		}
+
+		shcodecs_encoder_set_output_callback (encoder, count_output, &nr_bytes[i]);
+
+		if (ctrlfile_set_enc_param (encoder, argv[i+1]) < 0) {
+			fprintf (stderr, "Problem with encoder params in control file %s\n", argv[i+1]);
+			return -1;
+		}
+	}
+
+	if (shcodecs_simulcast_alloc_input_buffers (simulcast, 1) < 0) {
+		fprintf (stderr, "Error allocating input buffers\n");
+		return -1;
+	}
+
+	for (frame=0; frame < ainfo.frames_to_encode; frame++) {
+		if (shcodecs_simulcast_get_input_buffer (simulcast, &pY, &pC) < 0)
+			break;
+
+		memset (pY, frame & 0xff, ainfo.xpic * ainfo.ypic);
+		memset (pC, 0x80, ainfo.xpic * ainfo.ypic / 2);
+
+		ret = shcodecs_simulcast_encode_1frame (simulcast, pY, pC);
+		if (ret != 0) {
+			fprintf (stderr, "Error encoding, error code=%d\n", ret);
+			break;
+		}
+	}
+
+	shcodecs_simulcast_finish (simulcast);
+
+	// Rendition Frames Skipped Late Mean(ms) Max(ms) FPS Bytes
+	for (i=0; i < nr_renditions; i++) {
+		shcodecs_simulcast_get_stats (simulcast, i, &stats);
+		printf ("%d\t%ld\t%ld\t%ld\t%.2f\t%.2f\t%.2f\t%ld\n", i,
+			stats.nr_frames, stats.nr_skipped, stats.nr_late,
+			stats.mean_encode_ms, stats.max_encode_ms, stats.fps,
+			nr_bytes[i]);
+	}
+
+	shcodecs_simulcast_close (simulcast);
+
+	return ret < 0 ? -1 : 0;
+}